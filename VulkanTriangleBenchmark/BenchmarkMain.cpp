@@ -0,0 +1,235 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <thread>
+#include <cmath>
+#include <cstdio>
+#include "../VulkanTriangleTest/TriangleApplication.h"
+
+//One benchmark scenario: a name and the settings it renders with. Every preset runs headless, so it works on
+//GPU-less hosts with a software implementation such as lavapipe
+struct BenchmarkPreset
+{
+	std::string name;
+	ApplicationSettings settings;
+};
+
+//Options shared by every preset
+struct BenchmarkOptions
+{
+	std::vector<std::string> presets;		//Empty runs them all
+	uint32_t warmUpFrames = 50;
+	uint32_t measuredFrames = 500;
+	std::string outputPath = "benchmark.json";
+	std::string shaderArchivePath = "../VulkanTriangleTest/Shaders/shaders.pak";	//Relative to this project's directory
+};
+
+static std::vector<BenchmarkPreset> GetPresets(const BenchmarkOptions& options)
+{
+	//Startup has to be comparable between runs, so nothing is loaded from a pipeline cache
+	ApplicationSettings base;
+	base.headless = true;
+	base.pipelineCachePath.clear();
+	base.shaderArchivePath = options.shaderArchivePath;
+
+	std::vector<BenchmarkPreset> presets;
+
+	BenchmarkPreset triangle = { "triangle", base };
+	presets.push_back(triangle);
+
+	BenchmarkPreset instances = { "instances", base };
+	instances.settings.instanceCount = 100000;
+	presets.push_back(instances);
+
+	//Same instances, frustum culled in a compute pass and drawn with indirect draws
+	BenchmarkPreset culledInstances = { "instances-culled", instances.settings };
+	culledInstances.settings.gpuCulling = true;
+	presets.push_back(culledInstances);
+
+	BenchmarkPreset pipelines = { "pipelines", base };
+	pipelines.settings.pipelineVariantCount = 64;
+	presets.push_back(pipelines);
+
+	BenchmarkPreset draws = { "draws", base };
+	draws.settings.drawCount = 10000;
+	draws.settings.recordingThreadCount = std::max(1u, std::thread::hardware_concurrency());
+	presets.push_back(draws);
+
+	//Same draws, with their parameters rebound through a dynamic uniform offset instead of pushed
+	BenchmarkPreset drawUniforms = { "draws-uniforms", draws.settings };
+	drawUniforms.settings.drawParameters = DrawParameterSource::DynamicUniforms;
+	presets.push_back(drawUniforms);
+
+	BenchmarkPreset manyDraws = { "draws-100k", draws.settings };
+	manyDraws.settings.drawCount = 100000;
+	presets.push_back(manyDraws);
+
+	BenchmarkPreset manyDrawUniforms = { "draws-100k-uniforms", manyDraws.settings };
+	manyDrawUniforms.settings.drawParameters = DrawParameterSource::DynamicUniforms;
+	presets.push_back(manyDrawUniforms);
+
+	//Same draws as "draws", sampling a generated texture that streams in during the run. Frame times should match
+	BenchmarkPreset textures = { "draws-textured", draws.settings };
+	textures.settings.texturePath = "checker";
+	presets.push_back(textures);
+
+	return presets;
+}
+
+static BenchmarkOptions ParseArguments(int argc, char** argv)
+{
+	BenchmarkOptions options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--preset") == 0 && i + 1 < argc)
+		{
+			options.presets.push_back(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--warm-up") == 0 && i + 1 < argc)
+		{
+			options.warmUpFrames = (uint32_t)std::stoul(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			options.measuredFrames = std::max(1u, (uint32_t)std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+		{
+			options.outputPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--shader-archive") == 0 && i + 1 < argc)
+		{
+			options.shaderArchivePath = argv[++i];
+		}
+		else
+		{
+			throw std::runtime_error(std::string("Unknown argument: ") + argv[i]);
+		}
+	}
+
+	return options;
+}
+
+//Nearest rank percentile of sorted samples
+static double Percentile(const std::vector<double>& sorted, double percentile)
+{
+	size_t rank = (size_t)std::ceil(percentile / 100.0 * sorted.size());
+	return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+//Writes a quoted JSON string. The device name comes from the driver, so quotes, backslashes and control characters are escaped
+static void WriteString(std::ostream& out, const std::string& text)
+{
+	out << '"';
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out << '\\' << c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)(unsigned char)c);
+			out << escaped;
+		}
+		else
+		{
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+static void WriteStatistics(std::ostream& out, std::vector<double> samples)
+{
+	if (samples.empty())
+	{
+		out << "null";
+		return;
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	double total = 0.0;
+	for (double sample : samples)
+	{
+		total += sample;
+	}
+
+	out << "{\"mean\":" << total / samples.size() << ",\"p50\":" << Percentile(samples, 50.0) << ",\"p95\":" << Percentile(samples, 95.0)
+		<< ",\"p99\":" << Percentile(samples, 99.0) << ",\"max\":" << samples.back() << "}";
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		BenchmarkOptions options = ParseArguments(argc, argv);
+
+		std::vector<BenchmarkPreset> presets = GetPresets(options);
+		if (!options.presets.empty())
+		{
+			for (const auto& name : options.presets)
+			{
+				if (std::none_of(presets.begin(), presets.end(), [&](const BenchmarkPreset& preset) { return preset.name == name; }))
+					throw std::runtime_error("Unknown preset: " + name);
+			}
+
+			presets.erase(std::remove_if(presets.begin(), presets.end(), [&](const BenchmarkPreset& preset)
+			{
+				return std::find(options.presets.begin(), options.presets.end(), preset.name) == options.presets.end();
+			}), presets.end());
+		}
+
+		std::vector<std::pair<std::string, BenchmarkResult>> results;
+		for (const auto& preset : presets)
+		{
+			std::cerr << "benchmark: " << preset.name << std::endl;
+
+			//Each preset gets a fresh application, so no state carries over between them
+			TriangleApplication application(preset.settings);
+			results.push_back(std::make_pair(preset.name, application.RunBenchmark(options.warmUpFrames, options.measuredFrames)));
+		}
+
+		std::ofstream out(options.outputPath, std::ios::trunc);
+		if (!out.is_open())
+		{
+			throw std::runtime_error("Failed to open " + options.outputPath);
+		}
+
+		out << "{\"device\":";
+		WriteString(out, results.empty() ? "" : results[0].second.deviceName);
+		out << ",\"warmUpFrames\":" << options.warmUpFrames
+			<< ",\"measuredFrames\":" << options.measuredFrames << ",\"presets\":[";
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const BenchmarkResult& result = results[i].second;
+
+			out << (i > 0 ? "," : "") << "\n{\"name\":";
+			WriteString(out, results[i].first);
+			out << ",\"startupMs\":" << result.startupTime << ",\"cpuMs\":";
+			WriteStatistics(out, result.cpuFrameTimes);
+			out << ",\"gpuMs\":";
+			WriteStatistics(out, result.gpuFrameTimes);
+			out << "}";
+		}
+
+		out << "\n]}" << std::endl;
+		std::cerr << "benchmark: results written to " << options.outputPath << std::endl;
+	}
+	catch (const std::exception& err)
+	{
+		std::cerr << err.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,346 @@
+#include "AsyncQueue.h"
+#include <stdexcept>
+
+void BufferOwnershipTransfer::RecordRelease(VkCommandBuffer commandBuffer) const
+{
+	if (srcFamily == dstFamily)
+	{
+		return;
+	}
+
+	//The destination half of a release is ignored, the acquire on the other queue provides it
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = 0;
+	barrier.srcQueueFamilyIndex = srcFamily;
+	barrier.dstQueueFamilyIndex = dstFamily;
+	barrier.buffer = buffer;
+	barrier.offset = offset;
+	barrier.size = size;
+
+	vkCmdPipelineBarrier(commandBuffer, srcStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void BufferOwnershipTransfer::RecordAcquire(VkCommandBuffer commandBuffer) const
+{
+	if (srcFamily == dstFamily)
+	{
+		return;
+	}
+
+	//Availability was handled by the release and the semaphore, so the source half is empty
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccess;
+	barrier.srcQueueFamilyIndex = srcFamily;
+	barrier.dstQueueFamilyIndex = dstFamily;
+	barrier.buffer = buffer;
+	barrier.offset = offset;
+	barrier.size = size;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void ImageOwnershipTransfer::RecordRelease(VkCommandBuffer commandBuffer) const
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccess;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+
+	//Without a change of family this is the only barrier, so it has to make the writes visible and do the transition itself.
+	//ALL_COMMANDS since the consumer's stages may not exist on this queue; the semaphore orders the rest
+	if (srcFamily == dstFamily)
+	{
+		barrier.dstAccessMask = dstAccess;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+		vkCmdPipelineBarrier(commandBuffer, srcStage, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		return;
+	}
+
+	barrier.dstAccessMask = 0;
+	barrier.srcQueueFamilyIndex = srcFamily;
+	barrier.dstQueueFamilyIndex = dstFamily;
+
+	vkCmdPipelineBarrier(commandBuffer, srcStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void ImageOwnershipTransfer::RecordAcquire(VkCommandBuffer commandBuffer) const
+{
+	if (srcFamily == dstFamily)
+	{
+		return;
+	}
+
+	//The layouts have to match the release exactly, the transition happens once between the two
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccess;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = srcFamily;
+	barrier.dstQueueFamilyIndex = dstFamily;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void AsyncWork::RecordAcquires(VkCommandBuffer commandBuffer) const
+{
+	for (const auto& transfer : transfers)
+	{
+		transfer.RecordAcquire(commandBuffer);
+	}
+
+	for (const auto& transfer : imageTransfers)
+	{
+		transfer.RecordAcquire(commandBuffer);
+	}
+}
+
+
+AsyncQueue::AsyncQueue()
+{
+}
+
+
+AsyncQueue::~AsyncQueue()
+{
+	Destroy();
+}
+
+void AsyncQueue::Initialize(VkDevice device, VkQueue queue, uint32_t familyIndex)
+{
+	this->device = device;
+	this->queue = queue;
+	this->familyIndex = familyIndex;
+
+	//Command buffers are reset one at a time as their submissions finish
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = familyIndex;
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create async queue command pool");
+	}
+}
+
+void AsyncQueue::Destroy()
+{
+	if (commandPool == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	vkQueueWaitIdle(queue);
+	Collect();
+
+	for (auto fence : freeFences)
+	{
+		vkDestroyFence(device, fence, nullptr);
+	}
+
+	for (auto semaphore : semaphores)
+	{
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
+
+	vkDestroyCommandPool(device, commandPool, nullptr);
+
+	freeFences.clear();
+	freeSemaphores.clear();
+	semaphores.clear();
+	freeCommandBuffers.clear();
+	commandPool = VK_NULL_HANDLE;
+}
+
+VkCommandBuffer AsyncQueue::Begin()
+{
+	Collect();
+
+	VkCommandBuffer commandBuffer;
+	if (!freeCommandBuffers.empty())
+	{
+		commandBuffer = freeCommandBuffers.back();
+		freeCommandBuffers.pop_back();
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate async queue command buffer");
+		}
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to begin async queue command buffer");
+	}
+
+	return commandBuffer;
+}
+
+void AsyncQueue::AcquireAll(VkCommandBuffer commandBuffer, const std::vector<AsyncWork>& waitFor)
+{
+	for (const auto& work : waitFor)
+	{
+		work.RecordAcquires(commandBuffer);
+	}
+}
+
+AsyncWork AsyncQueue::Submit(VkCommandBuffer commandBuffer, const std::vector<AsyncWork>& waitFor, const std::vector<BufferOwnershipTransfer>& transfers,
+	uint32_t dstFamily, VkPipelineStageFlags dstWaitStage, std::function<void()> onComplete)
+{
+	return Submit(commandBuffer, waitFor, transfers, {}, dstFamily, dstWaitStage, onComplete);
+}
+
+AsyncWork AsyncQueue::Submit(VkCommandBuffer commandBuffer, const std::vector<AsyncWork>& waitFor, const std::vector<BufferOwnershipTransfer>& transfers,
+	const std::vector<ImageOwnershipTransfer>& imageTransfers, uint32_t dstFamily, VkPipelineStageFlags dstWaitStage, std::function<void()> onComplete)
+{
+	for (const auto& transfer : transfers)
+	{
+		transfer.RecordRelease(commandBuffer);
+	}
+
+	for (const auto& transfer : imageTransfers)
+	{
+		transfer.RecordRelease(commandBuffer);
+	}
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record async queue command buffer");
+	}
+
+	VkSemaphore signalSemaphore;
+	if (!freeSemaphores.empty())
+	{
+		signalSemaphore = freeSemaphores.back();
+		freeSemaphores.pop_back();
+	}
+	else
+	{
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &signalSemaphore) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create async queue semaphore");
+		}
+		semaphores.push_back(signalSemaphore);
+	}
+
+	VkFence fence;
+	if (!freeFences.empty())
+	{
+		fence = freeFences.back();
+		freeFences.pop_back();
+	}
+	else
+	{
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create async queue fence");
+		}
+	}
+
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<VkPipelineStageFlags> waitStages;
+	for (const auto& work : waitFor)
+	{
+		waitSemaphores.push_back(work.semaphore);
+		waitStages.push_back(work.waitStage);
+	}
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = (uint32_t)waitSemaphores.size();
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &signalSemaphore;
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to submit to async queue");
+	}
+
+	Submission submission;
+	submission.commandBuffer = commandBuffer;
+	submission.fence = fence;
+	submission.waitedFor = waitFor;
+	submission.onComplete = onComplete;
+	submissions.push_back(submission);
+
+	AsyncWork work;
+	work.queue = this;
+	work.semaphore = signalSemaphore;
+	work.waitStage = dstWaitStage;
+	work.dstFamily = dstFamily;
+	work.transfers = transfers;
+	work.imageTransfers = imageTransfers;
+	return work;
+}
+
+void AsyncQueue::Collect()
+{
+	//Polls every submission, so nothing here ever waits on the GPU
+	for (size_t i = 0; i < submissions.size();)
+	{
+		Submission& submission = submissions[i];
+		if (vkGetFenceStatus(device, submission.fence) != VK_SUCCESS)
+		{
+			i++;
+			continue;
+		}
+
+		if (submission.onComplete)
+			submission.onComplete();
+
+		for (const auto& work : submission.waitedFor)
+		{
+			if (work.queue)
+				work.queue->RecycleSemaphore(work.semaphore);
+		}
+
+		vkResetFences(device, 1, &submission.fence);
+		vkResetCommandBuffer(submission.commandBuffer, 0);
+		freeFences.push_back(submission.fence);
+		freeCommandBuffers.push_back(submission.commandBuffer);
+
+		if (i + 1 < submissions.size())
+			submissions[i] = std::move(submissions.back());
+		submissions.pop_back();
+	}
+}
+
+void AsyncQueue::RecycleSemaphore(VkSemaphore semaphore)
+{
+	freeSemaphores.push_back(semaphore);
+}
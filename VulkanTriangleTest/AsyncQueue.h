@@ -0,0 +1,119 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <functional>
+
+//A buffer range moving between queue families. With VK_SHARING_MODE_EXCLUSIVE the source queue has to release it and the
+//destination queue acquire it with matching barriers before the destination may read what the source wrote.
+//Both halves are no-ops when the families are the same.
+struct BufferOwnershipTransfer
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = VK_WHOLE_SIZE;
+	uint32_t srcFamily = VK_QUEUE_FAMILY_IGNORED;
+	uint32_t dstFamily = VK_QUEUE_FAMILY_IGNORED;
+	VkPipelineStageFlags srcStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;		//Writes the release has to wait for
+	VkAccessFlags srcAccess = 0;
+	VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;		//First use after the acquire
+	VkAccessFlags dstAccess = 0;
+
+	void RecordRelease(VkCommandBuffer commandBuffer) const;
+	void RecordAcquire(VkCommandBuffer commandBuffer) const;
+};
+
+//The same for mip levels of an image, with the layout transition folded into the release and acquire barriers.
+//When both families are the same the release records a plain barrier with the transition instead, and the acquire is a no-op
+struct ImageOwnershipTransfer
+{
+	VkImage image = VK_NULL_HANDLE;
+	VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+	VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VkImageLayout newLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	uint32_t srcFamily = VK_QUEUE_FAMILY_IGNORED;
+	uint32_t dstFamily = VK_QUEUE_FAMILY_IGNORED;
+	VkPipelineStageFlags srcStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	VkAccessFlags srcAccess = 0;
+	VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	VkAccessFlags dstAccess = 0;
+
+	void RecordRelease(VkCommandBuffer commandBuffer) const;
+	void RecordAcquire(VkCommandBuffer commandBuffer) const;
+};
+
+class AsyncQueue;
+
+//Submitted work that another queue has to wait for before it uses the results
+struct AsyncWork
+{
+	AsyncQueue* queue = nullptr;			//Gets the semaphore back once the consumer's wait has completed. Null for semaphores owned elsewhere
+	VkSemaphore semaphore = VK_NULL_HANDLE;	//Signaled when the work completes. Wait on it exactly once
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;	//Earliest stage of the consumer that needs the results
+	uint32_t dstFamily = VK_QUEUE_FAMILY_IGNORED;	//Family of the consumer
+	std::vector<BufferOwnershipTransfer> transfers;	//To acquire on the consumer's queue before use
+	std::vector<ImageOwnershipTransfer> imageTransfers;
+
+	//Records the acquire half of every transfer
+	void RecordAcquires(VkCommandBuffer commandBuffer) const;
+};
+
+//Submits command buffers to one queue, normally a dedicated transfer or compute queue, so the work overlaps the graphics queue
+//instead of queueing behind it. Command buffers, fences and semaphores are recycled once the GPU is done with them.
+//Not thread safe, every call has to come from the same thread.
+class AsyncQueue
+{
+public:
+	AsyncQueue();
+	~AsyncQueue();
+
+	AsyncQueue(const AsyncQueue&) = delete;
+	AsyncQueue& operator=(const AsyncQueue&) = delete;
+
+	void Initialize(VkDevice device, VkQueue queue, uint32_t familyIndex);
+
+	//Waits for the queue to go idle first
+	void Destroy();
+
+	//Returns a command buffer in the recording state
+	VkCommandBuffer Begin();
+
+	//Acquires the transfers of the work this submission depends on. Call right after Begin()
+	void AcquireAll(VkCommandBuffer commandBuffer, const std::vector<AsyncWork>& waitFor);
+
+	//Records the release half of the transfers, ends the command buffer and submits it after the waitFor work.
+	//The returned work is for the consumer in dstFamily. onComplete runs from a later Collect() once the GPU has finished,
+	//e.g. to free a staging buffer
+	AsyncWork Submit(VkCommandBuffer commandBuffer, const std::vector<AsyncWork>& waitFor, const std::vector<BufferOwnershipTransfer>& transfers,
+		uint32_t dstFamily, VkPipelineStageFlags dstWaitStage, std::function<void()> onComplete = nullptr);
+	AsyncWork Submit(VkCommandBuffer commandBuffer, const std::vector<AsyncWork>& waitFor, const std::vector<BufferOwnershipTransfer>& transfers,
+		const std::vector<ImageOwnershipTransfer>& imageTransfers, uint32_t dstFamily, VkPipelineStageFlags dstWaitStage, std::function<void()> onComplete = nullptr);
+
+	//Runs the callbacks of finished submissions and recycles what they used. Never blocks
+	void Collect();
+
+	//Hands back a semaphore from Submit() once the consumer's wait on it has completed
+	void RecycleSemaphore(VkSemaphore semaphore);
+
+	VkQueue GetQueue() const { return queue; }
+	uint32_t GetFamilyIndex() const { return familyIndex; }
+
+private:
+	struct Submission
+	{
+		VkCommandBuffer commandBuffer;
+		VkFence fence;
+		std::vector<AsyncWork> waitedFor;		//Their semaphores are free again once the fence signals
+		std::function<void()> onComplete;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueue queue = VK_NULL_HANDLE;
+	uint32_t familyIndex = 0;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+
+	std::vector<Submission> submissions;
+	std::vector<VkCommandBuffer> freeCommandBuffers;
+	std::vector<VkFence> freeFences;
+	std::vector<VkSemaphore> freeSemaphores;
+	std::vector<VkSemaphore> semaphores;	//Every semaphore created, for Destroy()
+};
@@ -0,0 +1,312 @@
+#include "DebugMessenger.h"
+#include <stdexcept>
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <cstring>
+
+const uint32_t DebugMessenger::rateLimits[severityCount] = { 10, 10, 20, 100 };
+
+static const char* severityNames[] = { "verbose", "info", "warning", "error" };
+
+//Copies at most size - 1 characters and always terminates, so a missing or overlong string is harmless
+static void CopyString(char* destination, size_t size, const char* source)
+{
+	if (source == nullptr)
+	{
+		destination[0] = '\0';
+		return;
+	}
+
+	size_t length = std::min(strlen(source), size - 1);
+	memcpy(destination, source, length);
+	destination[length] = '\0';
+}
+
+//FNV-1a, for messages that come without an ID number
+static uint64_t HashString(const char* text)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (; *text != '\0'; text++)
+	{
+		hash = (hash ^ (uint8_t)*text) * 1099511628211ull;
+	}
+	return hash;
+}
+
+
+DebugMessenger::DebugMessenger() : enqueuePosition(0), stopping(false), lost(0)
+{
+	for (auto& count : received)
+	{
+		count.store(0);
+	}
+}
+
+
+DebugMessenger::~DebugMessenger()
+{
+	Destroy();
+}
+
+void DebugMessenger::Initialize(VkInstance instance, bool validation)
+{
+	this->instance = instance;
+
+	//Extension functions are not exported by the loader, they have to be looked up
+	setObjectName = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(instance, "vkSetDebugUtilsObjectNameEXT");
+	beginLabel = (PFN_vkCmdBeginDebugUtilsLabelEXT)vkGetInstanceProcAddr(instance, "vkCmdBeginDebugUtilsLabelEXT");
+	endLabel = (PFN_vkCmdEndDebugUtilsLabelEXT)vkGetInstanceProcAddr(instance, "vkCmdEndDebugUtilsLabelEXT");
+
+	if (!validation)
+		return;
+
+	ring.reset(new Cell[ringSize]);
+	for (size_t i = 0; i < ringSize; i++)
+	{
+		ring[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	for (uint32_t severity = 0; severity < severityCount; severity++)
+	{
+		budget[severity] = rateLimits[severity];
+	}
+	budgetStart = std::chrono::steady_clock::now();
+
+	drainThread = std::thread(&DebugMessenger::DrainLoop, this);
+
+	auto createMessenger = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+	destroyMessenger = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+
+	VkDebugUtilsMessengerCreateInfoEXT messengerInfo = {};
+	messengerInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+	//Every severity, the flood of info and verbose messages is what the per-severity rate limits are there for
+	messengerInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+	messengerInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+	messengerInfo.pfnUserCallback = Callback;
+	messengerInfo.pUserData = this;
+
+	if (createMessenger == nullptr || createMessenger(instance, &messengerInfo, nullptr, &messenger) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to set up debug messenger");
+	}
+}
+
+void DebugMessenger::Destroy()
+{
+	if (messenger != VK_NULL_HANDLE)
+	{
+		destroyMessenger(instance, messenger, nullptr);
+		messenger = VK_NULL_HANDLE;
+	}
+
+	//The messenger is gone, so nothing can be pushed any more and the final drain sees everything
+	if (drainThread.joinable())
+	{
+		stopping.store(true);
+		wakeCondition.notify_one();
+		drainThread.join();
+		PrintCounters();
+	}
+
+	setObjectName = nullptr;
+	beginLabel = nullptr;
+	endLabel = nullptr;
+}
+
+void DebugMessenger::SetObjectName(VkDevice device, VkObjectType type, uint64_t handle, const char* name)
+{
+	if (setObjectName == nullptr)
+		return;
+
+	VkDebugUtilsObjectNameInfoEXT nameInfo = {};
+	nameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
+	nameInfo.objectType = type;
+	nameInfo.objectHandle = handle;
+	nameInfo.pObjectName = name;
+
+	setObjectName(device, &nameInfo);
+}
+
+void DebugMessenger::BeginLabel(VkCommandBuffer commandBuffer, const char* name)
+{
+	if (beginLabel == nullptr)
+		return;
+
+	VkDebugUtilsLabelEXT label = {};
+	label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+	label.pLabelName = name;
+
+	beginLabel(commandBuffer, &label);
+}
+
+void DebugMessenger::EndLabel(VkCommandBuffer commandBuffer)
+{
+	if (endLabel != nullptr)
+		endLabel(commandBuffer);
+}
+
+//Bounded multi-producer queue after Dmitry Vyukov. Producers claim a position with one compare-exchange and publish the
+//message through the slot's sequence. Returns false when the ring is full, the message is then only counted
+bool DebugMessenger::Push(const VkDebugUtilsMessengerCallbackDataEXT* callbackData, Severity severity)
+{
+	size_t position = enqueuePosition.load(std::memory_order_relaxed);
+	Cell* cell;
+
+	for (;;)
+	{
+		cell = &ring[position & (ringSize - 1)];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)position;
+
+		if (difference == 0)
+		{
+			if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (difference < 0)
+		{
+			return false;
+		}
+		else
+		{
+			position = enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->message.severity = severity;
+	cell->message.id = callbackData->messageIdNumber;
+	CopyString(cell->message.idName, sizeof(cell->message.idName), callbackData->pMessageIdName);
+	CopyString(cell->message.text, sizeof(cell->message.text), callbackData->pMessage);
+	cell->sequence.store(position + 1, std::memory_order_release);
+
+	return true;
+}
+
+bool DebugMessenger::Pop(Message& message)
+{
+	Cell& cell = ring[dequeuePosition & (ringSize - 1)];
+	if (cell.sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+		return false;
+
+	message = cell.message;
+	cell.sequence.store(dequeuePosition + ringSize, std::memory_order_release);
+	dequeuePosition++;
+
+	return true;
+}
+
+void DebugMessenger::DrainLoop()
+{
+	while (!stopping.load())
+	{
+		{
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wakeCondition.wait_for(lock, std::chrono::milliseconds(50));
+		}
+
+		Drain();
+	}
+
+	Drain();
+}
+
+void DebugMessenger::Drain()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (now - budgetStart >= std::chrono::seconds(1))
+	{
+		for (uint32_t severity = 0; severity < severityCount; severity++)
+		{
+			budget[severity] = rateLimits[severity];
+		}
+		budgetStart = now;
+	}
+
+	//Written in one go, std::cerr would otherwise flush after every piece
+	std::string batch;
+	Message message;
+
+	while (Pop(message))
+	{
+		uint64_t key = message.id != 0 ? (uint64_t)(uint32_t)message.id : HashString(message.idName[0] != '\0' ? message.idName : message.text);
+
+		auto seen = seenMessages.find(key);
+		if (seen != seenMessages.end())
+		{
+			seen->second++;
+			duplicates++;
+			continue;
+		}
+
+		//Not remembered as seen, so the message still gets printed once the budget allows
+		if (budget[message.severity] == 0)
+		{
+			rateLimited++;
+			continue;
+		}
+
+		budget[message.severity]--;
+		seenMessages[key] = 1;
+
+		batch += "validation ";
+		batch += severityNames[message.severity];
+		batch += ": ";
+		if (message.idName[0] != '\0')
+		{
+			batch += "[";
+			batch += message.idName;
+			batch += "] ";
+		}
+		batch += message.text;
+		batch += "\n";
+	}
+
+	if (!batch.empty())
+		std::cerr.write(batch.data(), batch.size());
+}
+
+void DebugMessenger::PrintCounters()
+{
+	uint64_t total = 0;
+	for (const auto& count : received)
+	{
+		total += count.load();
+	}
+
+	if (total == 0)
+		return;
+
+	std::cerr << "validation:";
+	for (uint32_t severity = 0; severity < severityCount; severity++)
+	{
+		if (received[severity].load() > 0)
+			std::cerr << " " << received[severity].load() << " " << severityNames[severity];
+	}
+	std::cerr << ", " << duplicates << " repeats, " << rateLimited << " over the rate limit, " << lost.load() << " lost to a full ring" << std::endl;
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL DebugMessenger::Callback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType,
+	const VkDebugUtilsMessengerCallbackDataEXT* callbackData, void* userData)
+{
+	auto messenger = reinterpret_cast<DebugMessenger*>(userData);
+
+	Severity severity = severityVerbose;
+	if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT)
+		severity = severityError;
+	else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+		severity = severityWarning;
+	else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT)
+		severity = severityInfo;
+
+	messenger->received[severity].fetch_add(1, std::memory_order_relaxed);
+
+	if (!messenger->Push(callbackData, severity))
+		messenger->lost.fetch_add(1, std::memory_order_relaxed);
+	else if (severity == severityError)
+		messenger->wakeCondition.notify_one();		//Errors are printed right away, the rest waits for the next periodic drain
+
+	//Returning true would abort the call that raised the message
+	return VK_FALSE;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <unordered_map>
+
+//VK_EXT_debug_utils: validation messages, object names and command buffer labels.
+//The callback runs on whatever thread raised the message, often in the middle of a frame, so it only copies the message
+//into a lock-free ring. A background thread drains the ring, drops repeats of a message ID and anything over the
+//per-severity rate limit, and writes the rest to std::cerr in batches.
+class DebugMessenger
+{
+public:
+	DebugMessenger();
+	~DebugMessenger();
+
+	DebugMessenger(const DebugMessenger&) = delete;
+	DebugMessenger& operator=(const DebugMessenger&) = delete;
+
+	//Call with an instance created with VK_EXT_DEBUG_UTILS_EXTENSION_NAME. Messages are only received with validation
+	void Initialize(VkInstance instance, bool validation);
+
+	//Stops the messenger, prints what is left in the ring and the counters. Call before the instance is destroyed
+	void Destroy();
+
+	//No-ops when the extension is not enabled. Names are copied by the implementation
+	void SetObjectName(VkDevice device, VkObjectType type, uint64_t handle, const char* name);
+	void BeginLabel(VkCommandBuffer commandBuffer, const char* name);
+	void EndLabel(VkCommandBuffer commandBuffer);
+
+	uint64_t GetErrorCount() const { return received[severityError].load(std::memory_order_relaxed); }
+
+private:
+	enum Severity { severityVerbose, severityInfo, severityWarning, severityError, severityCount };
+
+	//Fixed size, so the callback never allocates. Longer messages are truncated
+	struct Message
+	{
+		Severity severity;
+		int32_t id;
+		char idName[64];
+		char text[1024];
+	};
+
+	//A slot is free for position p when its sequence is p, and holds the message for p once it is p + 1
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		Message message;
+	};
+
+	static const size_t ringSize = 1024;				//Power of two
+	static const uint32_t rateLimits[severityCount];	//Messages printed per second per severity, the rest are counted
+
+	VkInstance instance = VK_NULL_HANDLE;
+	VkDebugUtilsMessengerEXT messenger = VK_NULL_HANDLE;
+	PFN_vkDestroyDebugUtilsMessengerEXT destroyMessenger = nullptr;
+	PFN_vkSetDebugUtilsObjectNameEXT setObjectName = nullptr;
+	PFN_vkCmdBeginDebugUtilsLabelEXT beginLabel = nullptr;
+	PFN_vkCmdEndDebugUtilsLabelEXT endLabel = nullptr;
+
+	//Ring stuff - any number of producers, the drain thread is the only consumer
+	std::unique_ptr<Cell[]> ring;
+	std::atomic<size_t> enqueuePosition;
+	size_t dequeuePosition = 0;
+
+	//Drain thread stuff
+	std::thread drainThread;
+	std::mutex wakeMutex;
+	std::condition_variable wakeCondition;
+	std::atomic<bool> stopping;
+
+	//Counters. received and lost are written by the callback, the rest only by the drain thread
+	std::atomic<uint64_t> received[severityCount];
+	std::atomic<uint64_t> lost;							//Ring was full
+	uint64_t duplicates = 0;
+	uint64_t rateLimited = 0;
+	std::unordered_map<uint64_t, uint64_t> seenMessages;	//Message key to the number of times it was seen
+	uint32_t budget[severityCount];
+	std::chrono::steady_clock::time_point budgetStart;
+
+	bool Push(const VkDebugUtilsMessengerCallbackDataEXT* callbackData, Severity severity);
+	bool Pop(Message& message);
+	void DrainLoop();
+	void Drain();
+	void PrintCounters();
+
+	static VKAPI_ATTR VkBool32 VKAPI_CALL Callback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType,
+		const VkDebugUtilsMessengerCallbackDataEXT* callbackData, void* userData);
+};
@@ -0,0 +1,140 @@
+#include "DeletionQueue.h"
+#include <algorithm>
+
+
+DeviceObject::DeviceObject(DeletionQueue& queue, std::function<void()> destroy) : queue(&queue), destroy(std::move(destroy))
+{
+	queue.Register(this);
+}
+
+DeviceObject::~DeviceObject()
+{
+	Reset();
+}
+
+DeviceObject::DeviceObject(DeviceObject&& other) : queue(other.queue), destroy(std::move(other.destroy))
+{
+	if (queue)
+		queue->Move(&other, this);
+	other.queue = nullptr;
+	other.destroy = nullptr;
+}
+
+//The object owned so far is released, then the other one's is taken over
+DeviceObject& DeviceObject::operator=(DeviceObject&& other)
+{
+	if (this == &other)
+		return *this;
+
+	Reset();
+	queue = other.queue;
+	destroy = std::move(other.destroy);
+	if (queue)
+		queue->Move(&other, this);
+	other.queue = nullptr;
+	other.destroy = nullptr;
+	return *this;
+}
+
+void DeviceObject::Reset()
+{
+	if (queue == nullptr)
+		return;
+
+	queue->Unregister(this);
+	queue->Release(std::move(destroy));
+	queue = nullptr;
+	destroy = nullptr;
+}
+
+
+DeletionQueue::DeletionQueue()
+{
+}
+
+
+DeletionQueue::~DeletionQueue()
+{
+}
+
+void DeletionQueue::Initialize(VkDevice device, uint32_t framesInFlight)
+{
+	this->device = device;
+	this->framesInFlight = framesInFlight;
+}
+
+DeviceObject DeletionQueue::Own(std::function<void()> destroy)
+{
+	return DeviceObject(*this, std::move(destroy));
+}
+
+void DeletionQueue::OwnUntilShutdown(std::function<void()> destroy)
+{
+	untilShutdown.emplace_back(*this, std::move(destroy));
+}
+
+//Frame frameCount may already have recorded against the object, and is only known to be done once the fence of its slot
+//has been waited on again, framesInFlight frames later
+void DeletionQueue::Release(std::function<void()> destroy)
+{
+	pending.push_back({ std::move(destroy), frameCount + framesInFlight });
+}
+
+void DeletionQueue::Collect(uint64_t frameCount)
+{
+	this->frameCount = frameCount;
+
+	//In release order, so objects released together are destroyed in the order they were released in
+	size_t kept = 0;
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		if (frameCount < pending[i].retireFrame)
+		{
+			if (kept != i)
+				pending[kept] = std::move(pending[i]);
+			kept++;
+			continue;
+		}
+
+		pending[i].destroy();
+	}
+
+	pending.resize(kept);
+}
+
+void DeletionQueue::Flush()
+{
+	//Newest first, since objects may depend on ones created before them
+	while (!owners.empty())
+	{
+		owners.back()->Reset();
+	}
+
+	for (auto& destruction : pending)
+	{
+		destruction.destroy();
+	}
+
+	pending.clear();
+	untilShutdown.clear();
+}
+
+void DeletionQueue::Register(DeviceObject* owner)
+{
+	owners.push_back(owner);
+}
+
+void DeletionQueue::Unregister(DeviceObject* owner)
+{
+	//Usually the newest, so search from the back
+	auto it = std::find(owners.rbegin(), owners.rend(), owner);
+	if (it != owners.rend())
+		owners.erase(std::next(it).base());
+}
+
+void DeletionQueue::Move(DeviceObject* from, DeviceObject* to)
+{
+	auto it = std::find(owners.rbegin(), owners.rend(), from);
+	if (it != owners.rend())
+		*it = to;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <deque>
+#include <functional>
+
+class DeletionQueue;
+
+//Owns something the GPU may still be using. Resetting, replacing or destroying the owner hands it to the deletion queue,
+//which destroys it once the frames in flight are done with it
+class DeviceObject
+{
+public:
+	DeviceObject() {}
+	DeviceObject(DeletionQueue& queue, std::function<void()> destroy);
+	~DeviceObject();
+
+	DeviceObject(const DeviceObject&) = delete;
+	DeviceObject& operator=(const DeviceObject&) = delete;
+	DeviceObject(DeviceObject&& other);
+	DeviceObject& operator=(DeviceObject&& other);
+
+	void Reset();
+	bool IsOwning() const { return queue != nullptr; }
+
+private:
+	DeletionQueue* queue = nullptr;
+	std::function<void()> destroy;
+};
+
+//A Vulkan handle with a DeviceObject owning it. Converts to the handle, so it can be passed to Vulkan as is
+template<typename T>
+class VulkanHandle
+{
+public:
+	VulkanHandle() {}
+	VulkanHandle(DeviceObject owner, T handle) : handle(handle), owner(std::move(owner)) {}
+
+	VulkanHandle(VulkanHandle&& other) : handle(other.handle), owner(std::move(other.owner))
+	{
+		other.handle = VK_NULL_HANDLE;
+	}
+
+	VulkanHandle& operator=(VulkanHandle&& other)
+	{
+		if (this != &other)
+		{
+			owner = std::move(other.owner);
+			handle = other.handle;
+			other.handle = VK_NULL_HANDLE;
+		}
+		return *this;
+	}
+
+	operator T() const { return handle; }
+	T Get() const { return handle; }
+	const T* GetAddress() const { return &handle; }		//For create infos taking arrays of handles
+
+	void Reset()
+	{
+		owner.Reset();
+		handle = VK_NULL_HANDLE;
+	}
+
+private:
+	T handle = VK_NULL_HANDLE;
+	DeviceObject owner;
+};
+
+//Destroys device objects only once every frame that may have recorded against them has retired, so replacing one at runtime
+//never waits for the device:
+//- objects released during or after frame n are destroyed by Collect() at the start of frame n + framesInFlight, once that
+//  frame slot's fence has been waited on
+//- every DeviceObject registers here while it owns something, so Flush() can release and destroy all of them at shutdown,
+//  newest first, after the ones released earlier
+//Not thread safe, objects have to be owned and released on the thread that draws the frames.
+class DeletionQueue
+{
+public:
+	DeletionQueue();
+	~DeletionQueue();
+
+	DeletionQueue(const DeletionQueue&) = delete;
+	DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+	void Initialize(VkDevice device, uint32_t framesInFlight);
+
+	//Ownership of a handle, destroyed with its vkDestroy* function
+	template<typename T>
+	VulkanHandle<T> Own(T handle, void (VKAPI_PTR* destroyFunction)(VkDevice, T, const VkAllocationCallbacks*))
+	{
+		VkDevice device = this->device;
+		return VulkanHandle<T>(DeviceObject(*this, [device, handle, destroyFunction]()
+		{
+			destroyFunction(device, handle, nullptr);
+		}), handle);
+	}
+
+	//Ownership of anything else, such as a resource and its memory
+	DeviceObject Own(std::function<void()> destroy);
+
+	//For objects that live until shutdown, with nothing to hold on to the owner
+	void OwnUntilShutdown(std::function<void()> destroy);
+
+	//Destroys the object once the frames in flight are done with it
+	void Release(std::function<void()> destroy);
+
+	//Call once a frame, after waiting for its frame slot's fence. Destroys whatever the finished frames used last
+	void Collect(uint64_t frameCount);
+
+	//The device has to be idle. Releases every owned object and destroys everything
+	void Flush();
+
+	size_t GetPendingCount() const { return pending.size(); }
+
+private:
+	friend class DeviceObject;
+
+	struct PendingDestruction
+	{
+		std::function<void()> destroy;
+		uint64_t retireFrame;				//Destroyed by the Collect() of this frame
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	uint32_t framesInFlight = 1;
+	uint64_t frameCount = 0;				//Of the last Collect()
+
+	std::vector<DeviceObject*> owners;		//In the order they took ownership
+	std::vector<PendingDestruction> pending;	//In the order they were released
+	std::deque<DeviceObject> untilShutdown;	//Never moved, so their registrations stay valid
+
+	void Register(DeviceObject* owner);
+	void Unregister(DeviceObject* owner);
+	void Move(DeviceObject* from, DeviceObject* to);
+};
@@ -0,0 +1,223 @@
+#include "DescriptorHeap.h"
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+
+static const VkDescriptorType descriptorTypes[] = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_DESCRIPTOR_TYPE_SAMPLER };
+static const char* kindNames[] = { "storage buffer", "sampled image", "sampler" };
+
+
+DescriptorHeap::DescriptorHeap()
+{
+}
+
+
+DescriptorHeap::~DescriptorHeap()
+{
+	Destroy();
+}
+
+void DescriptorHeap::Initialize(VkDevice device, const VkPhysicalDeviceDescriptorIndexingPropertiesEXT& limits, VkShaderStageFlags stages,
+	uint32_t bufferCapacity, uint32_t imageCapacity, uint32_t samplerCapacity)
+{
+	this->device = device;
+
+	//Every array counts towards the per stage total as well, so each gets at most a third of it
+	uint32_t resourceShare = limits.maxPerStageUpdateAfterBindResources / 3;
+	capacity[(size_t)DescriptorKind::StorageBuffer] = std::min({ bufferCapacity, limits.maxDescriptorSetUpdateAfterBindStorageBuffers,
+		limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers, resourceShare });
+	capacity[(size_t)DescriptorKind::SampledImage] = std::min({ imageCapacity, limits.maxDescriptorSetUpdateAfterBindSampledImages,
+		limits.maxPerStageDescriptorUpdateAfterBindSampledImages, resourceShare });
+	capacity[(size_t)DescriptorKind::Sampler] = std::min({ samplerCapacity, limits.maxDescriptorSetUpdateAfterBindSamplers,
+		limits.maxPerStageDescriptorUpdateAfterBindSamplers, resourceShare });
+
+	const uint32_t kindCount = (uint32_t)DescriptorKind::Count;
+
+	VkDescriptorSetLayoutBinding bindings[kindCount] = {};
+	VkDescriptorBindingFlagsEXT bindingFlags[kindCount] = {};
+	VkDescriptorPoolSize poolSizes[kindCount] = {};
+
+	for (uint32_t kind = 0; kind < kindCount; kind++)
+	{
+		bindings[kind].binding = kind;
+		bindings[kind].descriptorType = descriptorTypes[kind];
+		bindings[kind].descriptorCount = std::max(capacity[kind], 1u);
+		bindings[kind].stageFlags = stages;
+
+		//Slots are written while frames that bind the set are recorded or executing, and most of them stay empty
+		bindingFlags[kind] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+
+		poolSizes[kind].type = descriptorTypes[kind];
+		poolSizes[kind].descriptorCount = bindings[kind].descriptorCount;
+	}
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+	bindingFlagsInfo.bindingCount = kindCount;
+	bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &bindingFlagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	layoutInfo.bindingCount = kindCount;
+	layoutInfo.pBindings = bindings;
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor heap layout");
+	}
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = kindCount;
+	poolInfo.pPoolSizes = poolSizes;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor heap pool");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = pool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	if (vkAllocateDescriptorSets(device, &allocInfo, &set) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate descriptor heap set");
+	}
+}
+
+void DescriptorHeap::Destroy()
+{
+	if (device == VK_NULL_HANDLE)
+		return;
+
+	//Frees the set along with the pool
+	vkDestroyDescriptorPool(device, pool, nullptr);
+	vkDestroyDescriptorSetLayout(device, layout, nullptr);
+
+	pool = VK_NULL_HANDLE;
+	layout = VK_NULL_HANDLE;
+	set = VK_NULL_HANDLE;
+	device = VK_NULL_HANDLE;
+
+	for (uint32_t kind = 0; kind < (uint32_t)DescriptorKind::Count; kind++)
+	{
+		highWater[kind] = 0;
+		freeSlots[kind].clear();
+	}
+	retiredSlots.clear();
+}
+
+uint32_t DescriptorHeap::AllocateBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = buffer;
+	bufferInfo.offset = offset;
+	bufferInfo.range = range;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t index = AllocateSlot(DescriptorKind::StorageBuffer);
+	Write(DescriptorKind::StorageBuffer, index, &bufferInfo, nullptr);
+	return index;
+}
+
+uint32_t DescriptorHeap::AllocateImage(VkImageView imageView, VkImageLayout layout)
+{
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.imageView = imageView;
+	imageInfo.imageLayout = layout;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t index = AllocateSlot(DescriptorKind::SampledImage);
+	Write(DescriptorKind::SampledImage, index, nullptr, &imageInfo);
+	return index;
+}
+
+uint32_t DescriptorHeap::AllocateSampler(VkSampler sampler)
+{
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.sampler = sampler;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t index = AllocateSlot(DescriptorKind::Sampler);
+	Write(DescriptorKind::Sampler, index, nullptr, &imageInfo);
+	return index;
+}
+
+void DescriptorHeap::Free(DescriptorKind kind, uint32_t index, uint64_t retireFrame)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	retiredSlots.push_back({ kind, index, retireFrame });
+}
+
+void DescriptorHeap::Recycle(uint64_t frameCount)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (size_t i = 0; i < retiredSlots.size();)
+	{
+		if (frameCount < retiredSlots[i].retireFrame)
+		{
+			i++;
+			continue;
+		}
+
+		freeSlots[(size_t)retiredSlots[i].kind].push_back(retiredSlots[i].index);
+		retiredSlots[i] = retiredSlots.back();
+		retiredSlots.pop_back();
+	}
+}
+
+uint32_t DescriptorHeap::GetUsed(DescriptorKind kind) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint32_t used = highWater[(size_t)kind] - (uint32_t)freeSlots[(size_t)kind].size();
+	for (const auto& retired : retiredSlots)
+	{
+		if (retired.kind == kind)
+			used--;
+	}
+
+	return used;
+}
+
+//Prefers recycled slots, so the occupied part of each array stays dense. Called with the mutex held
+uint32_t DescriptorHeap::AllocateSlot(DescriptorKind kind)
+{
+	auto& slots = freeSlots[(size_t)kind];
+	if (!slots.empty())
+	{
+		uint32_t index = slots.back();
+		slots.pop_back();
+		return index;
+	}
+
+	if (highWater[(size_t)kind] == capacity[(size_t)kind])
+		throw std::runtime_error(std::string("descriptor heap is out of ") + kindNames[(size_t)kind] + " slots");
+
+	return highWater[(size_t)kind]++;
+}
+
+//Called with the mutex held. Writes to one set must not overlap, even for different slots
+void DescriptorHeap::Write(DescriptorKind kind, uint32_t index, const VkDescriptorBufferInfo* bufferInfo, const VkDescriptorImageInfo* imageInfo)
+{
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = set;
+	descriptorWrite.dstBinding = (uint32_t)kind;
+	descriptorWrite.dstArrayElement = index;
+	descriptorWrite.descriptorType = descriptorTypes[(size_t)kind];
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pBufferInfo = bufferInfo;
+	descriptorWrite.pImageInfo = imageInfo;
+
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+}
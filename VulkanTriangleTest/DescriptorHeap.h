@@ -0,0 +1,71 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <mutex>
+
+//What a heap slot holds. Each kind is one binding of the heap's descriptor set
+enum class DescriptorKind
+{
+	StorageBuffer,							//Binding 0, storage buffers
+	SampledImage,							//Binding 1, sampled images
+	Sampler,								//Binding 2, samplers
+	Count
+};
+
+//One global descriptor set with a large array per descriptor kind, built on VK_EXT_descriptor_indexing.
+//Resources are written into a free slot once, and shaders reach them through the slot index, usually passed as a push constant.
+//The set is created UPDATE_AFTER_BIND and PARTIALLY_BOUND, so slots may be written and freed while command buffers that bind the
+//set are pending, and unused slots never have to be valid. Frames bind it once instead of allocating and binding sets per draw.
+class DescriptorHeap
+{
+public:
+	DescriptorHeap();
+	~DescriptorHeap();
+
+	DescriptorHeap(const DescriptorHeap&) = delete;
+	DescriptorHeap& operator=(const DescriptorHeap&) = delete;
+
+	//Capacities are lowered to what the device allows for update after bind descriptors
+	void Initialize(VkDevice device, const VkPhysicalDeviceDescriptorIndexingPropertiesEXT& limits, VkShaderStageFlags stages,
+		uint32_t bufferCapacity, uint32_t imageCapacity, uint32_t samplerCapacity);
+	void Destroy();
+
+	//Write a descriptor into a free slot and return its index. Throws when the heap is full. Safe to call from any thread
+	uint32_t AllocateBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+	uint32_t AllocateImage(VkImageView imageView, VkImageLayout layout);
+	uint32_t AllocateSampler(VkSampler sampler);
+
+	//Frees a slot once retireFrame has been reached, as frames still in flight may read it until then
+	void Free(DescriptorKind kind, uint32_t index, uint64_t retireFrame);
+
+	//Returns the slots whose retire frame has been reached to the free lists. Call once the frames before frameCount have finished
+	void Recycle(uint64_t frameCount);
+
+	VkDescriptorSetLayout GetLayout() const { return layout; }
+	VkDescriptorSet GetSet() const { return set; }
+	uint32_t GetCapacity(DescriptorKind kind) const { return capacity[(size_t)kind]; }
+	uint32_t GetUsed(DescriptorKind kind) const;
+
+private:
+	struct RetiredSlot
+	{
+		DescriptorKind kind;
+		uint32_t index;
+		uint64_t retireFrame;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+
+	//Slot stuff - guarded by mutex, which also serializes the descriptor writes since the set is shared
+	mutable std::mutex mutex;
+	uint32_t capacity[(size_t)DescriptorKind::Count] = {};
+	uint32_t highWater[(size_t)DescriptorKind::Count] = {};			//Slots below this have been handed out at least once
+	std::vector<uint32_t> freeSlots[(size_t)DescriptorKind::Count];	//Returned slots below highWater, reused first
+	std::vector<RetiredSlot> retiredSlots;
+
+	uint32_t AllocateSlot(DescriptorKind kind);
+	void Write(DescriptorKind kind, uint32_t index, const VkDescriptorBufferInfo* bufferInfo, const VkDescriptorImageInfo* imageInfo);
+};
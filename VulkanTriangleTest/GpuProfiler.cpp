@@ -0,0 +1,323 @@
+#include "GpuProfiler.h"
+#include <stdexcept>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+//Names of the VkQueryPipelineStatisticFlagBits, in bit order
+static const char* statisticNames[] =
+{
+	"input assembly vertices",
+	"input assembly primitives",
+	"vertex shader invocations",
+	"geometry shader invocations",
+	"geometry shader primitives",
+	"clipping invocations",
+	"clipping primitives",
+	"fragment shader invocations",
+	"tessellation control shader patches",
+	"tessellation evaluation shader invocations",
+	"compute shader invocations"
+};
+
+static uint32_t CountBits(uint32_t value)
+{
+	uint32_t count = 0;
+	for (; value != 0; value &= value - 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+//Small stable index per thread, so the trace shows one row per thread
+static uint32_t GetThreadIndex()
+{
+	static std::atomic<uint32_t> nextIndex(0);
+	thread_local uint32_t index = nextIndex++;
+	return index;
+}
+
+
+GpuProfiler::GpuProfiler() : enabled(false)
+{
+}
+
+
+GpuProfiler::~GpuProfiler()
+{
+	Destroy();
+}
+
+void GpuProfiler::Initialize(VkDevice device, uint32_t frameSlotCount, uint32_t timestampValidBits, float timestampPeriod, VkQueryPipelineStatisticFlags statistics)
+{
+	this->device = device;
+	this->timestampPeriod = timestampPeriod;
+	this->statistics = statistics;
+	timestampsSupported = timestampValidBits > 0;
+	timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+	epoch = std::chrono::high_resolution_clock::now();
+
+	slots.resize(frameSlotCount);
+
+	for (auto& slot : slots)
+	{
+		if (timestampsSupported)
+		{
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = 2 * maxScopes;
+
+			if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &slot.timestampPool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create timestamp query pool");
+			}
+		}
+
+		if (statistics != 0)
+		{
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+			queryPoolInfo.queryCount = 1;
+			queryPoolInfo.pipelineStatistics = statistics;
+
+			if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &slot.statisticsPool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create pipeline statistics query pool");
+			}
+		}
+	}
+}
+
+void GpuProfiler::Destroy()
+{
+	for (auto& slot : slots)
+	{
+		vkDestroyQueryPool(device, slot.timestampPool, nullptr);
+		vkDestroyQueryPool(device, slot.statisticsPool, nullptr);
+	}
+
+	slots.clear();
+}
+
+void GpuProfiler::SetEnabled(bool enabled)
+{
+	this->enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void GpuProfiler::BeginFrame(uint32_t slot)
+{
+	currentSlot = slot;
+	SlotData& data = slots[slot];
+
+	if (data.submitted)
+		ReadSlot(data);
+
+	data.scopeNames.clear();
+	data.traced = IsEnabled();
+	data.statisticsWritten = false;
+	data.submitted = false;
+}
+
+void GpuProfiler::ReadAll()
+{
+	for (auto& slot : slots)
+	{
+		if (slot.submitted)
+			ReadSlot(slot);
+
+		slot.submitted = false;
+	}
+}
+
+void GpuProfiler::BeginCommandBuffer(VkCommandBuffer commandBuffer)
+{
+	SlotData& slot = slots[currentSlot];
+
+	if (slot.traced && slot.statisticsPool != VK_NULL_HANDLE)
+		vkCmdResetQueryPool(commandBuffer, slot.statisticsPool, 0, 1);
+
+	if (!timestampsSupported)
+		return;
+
+	vkCmdResetQueryPool(commandBuffer, slot.timestampPool, 0, slot.traced ? 2 * maxScopes : 2);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, slot.timestampPool, 0);
+	slot.scopeNames.push_back("GPU frame");
+}
+
+void GpuProfiler::EndCommandBuffer(VkCommandBuffer commandBuffer)
+{
+	if (timestampsSupported)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, slots[currentSlot].timestampPool, 1);
+}
+
+uint32_t GpuProfiler::BeginScope(VkCommandBuffer commandBuffer, const char* name)
+{
+	SlotData& slot = slots[currentSlot];
+	if (!slot.traced || !timestampsSupported || slot.scopeNames.size() >= maxScopes)
+		return ~0u;
+
+	uint32_t scope = (uint32_t)slot.scopeNames.size();
+	slot.scopeNames.push_back(name);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, slot.timestampPool, 2 * scope);
+	return scope;
+}
+
+void GpuProfiler::EndScope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+	if (scope != ~0u)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, slots[currentSlot].timestampPool, 2 * scope + 1);
+}
+
+void GpuProfiler::BeginStatistics(VkCommandBuffer commandBuffer)
+{
+	SlotData& slot = slots[currentSlot];
+	if (!slot.traced || slot.statisticsPool == VK_NULL_HANDLE || slot.statisticsWritten)
+		return;
+
+	vkCmdBeginQuery(commandBuffer, slot.statisticsPool, 0, 0);
+	statisticsActive = true;
+}
+
+void GpuProfiler::EndStatistics(VkCommandBuffer commandBuffer)
+{
+	if (!statisticsActive)
+		return;
+
+	vkCmdEndQuery(commandBuffer, slots[currentSlot].statisticsPool, 0);
+	statisticsActive = false;
+	slots[currentSlot].statisticsWritten = true;
+}
+
+void GpuProfiler::MarkSubmitted()
+{
+	SlotData& slot = slots[currentSlot];
+	slot.submitted = true;
+	slot.submitTime = ToMicroseconds(std::chrono::high_resolution_clock::now());
+}
+
+void GpuProfiler::AddCpuEvent(const char* name, std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end)
+{
+	TraceEvent event;
+	event.name = name;
+	event.thread = GetThreadIndex();
+	event.start = ToMicroseconds(start);
+	event.duration = ToMicroseconds(end) - event.start;
+
+	std::lock_guard<std::mutex> lock(eventMutex);
+	if (events.size() < maxEvents)
+		events.push_back(event);
+	else
+		droppedEvents++;
+}
+
+double GpuProfiler::ToMicroseconds(std::chrono::high_resolution_clock::time_point time) const
+{
+	return std::chrono::duration<double, std::micro>(time - epoch).count();
+}
+
+//The slot's fence has signaled, so every result is available and nothing here waits
+void GpuProfiler::ReadSlot(SlotData& slot)
+{
+	if (timestampsSupported && !slot.scopeNames.empty())
+	{
+		std::vector<uint64_t> timestamps(2 * slot.scopeNames.size());
+		if (vkGetQueryPoolResults(device, slot.timestampPool, 0, (uint32_t)timestamps.size(), timestamps.size() * sizeof(uint64_t),
+			timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			double microsecondsPerTick = timestampPeriod / 1000.0;
+			lastFrameTime = ((timestamps[1] - timestamps[0]) & timestampMask) * microsecondsPerTick / 1000.0;
+
+			//Without calibrated timestamps the GPU clock is anchored to the submit: the frame's GPU work starts there
+			if (slot.traced)
+			{
+				std::lock_guard<std::mutex> lock(eventMutex);
+				for (size_t scope = 0; scope < slot.scopeNames.size(); scope++)
+				{
+					if (events.size() >= maxEvents)
+					{
+						droppedEvents++;
+						continue;
+					}
+
+					TraceEvent event;
+					event.name = slot.scopeNames[scope];
+					event.thread = ~0u;
+					event.start = slot.submitTime + ((timestamps[2 * scope] - timestamps[0]) & timestampMask) * microsecondsPerTick;
+					event.duration = ((timestamps[2 * scope + 1] - timestamps[2 * scope]) & timestampMask) * microsecondsPerTick;
+					events.push_back(event);
+				}
+			}
+		}
+	}
+
+	if (slot.statisticsWritten)
+	{
+		CounterEvent counter;
+		counter.time = slot.submitTime;
+		counter.values.resize(CountBits(statistics));
+
+		if (vkGetQueryPoolResults(device, slot.statisticsPool, 0, 1, counter.values.size() * sizeof(uint64_t), counter.values.data(),
+			counter.values.size() * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			std::lock_guard<std::mutex> lock(eventMutex);
+			if (counters.size() < maxEvents)
+				counters.push_back(counter);
+		}
+	}
+}
+
+bool GpuProfiler::HasEvents()
+{
+	std::lock_guard<std::mutex> lock(eventMutex);
+	return !events.empty() || !counters.empty();
+}
+
+//Chrome's trace event format: complete events ("X") for scopes, counter events ("C") for pipeline statistics
+void GpuProfiler::WriteTrace(const std::string& filename)
+{
+	std::lock_guard<std::mutex> lock(eventMutex);
+
+	std::ofstream file(filename, std::ios::trunc);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open trace file " + filename);
+	}
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GPU graphics queue\"}}";
+
+	for (const auto& event : events)
+	{
+		bool gpu = event.thread == ~0u;
+		file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << (gpu ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"pid\":" << (gpu ? 1 : 0)
+			<< ",\"tid\":" << (gpu ? 0 : event.thread) << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+	}
+
+	for (const auto& counter : counters)
+	{
+		file << ",\n{\"name\":\"pipeline statistics\",\"ph\":\"C\",\"pid\":1,\"ts\":" << counter.time << ",\"args\":{";
+
+		size_t value = 0;
+		for (uint32_t bit = 0; bit < sizeof(statisticNames) / sizeof(statisticNames[0]); bit++)
+		{
+			if (!(statistics & (1u << bit)))
+				continue;
+
+			file << (value > 0 ? "," : "") << "\"" << statisticNames[bit] << "\":" << counter.values[value];
+			value++;
+		}
+
+		file << "}}";
+	}
+
+	file << "\n]}\n";
+
+	std::cout << "trace: " << events.size() << " events written to " << filename;
+	if (droppedEvents > 0)
+		std::cout << ", " << droppedEvents << " dropped";
+	std::cout << std::endl;
+}
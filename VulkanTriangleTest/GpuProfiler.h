@@ -0,0 +1,140 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+//Times the frame loop on both processors. GPU scopes are timestamp pairs written into the frame slot's query pool and
+//read back once the slot's fence has signaled, so reading never stalls. CPU scopes are taken from any thread.
+//Both end up on one timeline in a Chrome about:tracing JSON file.
+//Switched off, scopes cost one relaxed atomic load. Only the frame scope is always written, for the frame time readouts
+class GpuProfiler
+{
+public:
+	GpuProfiler();
+	~GpuProfiler();
+
+	GpuProfiler(const GpuProfiler&) = delete;
+	GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+	//timestampValidBits is that of the queue family the command buffers run on, 0 when it cannot write timestamps.
+	//statistics are the pipeline statistics collected per frame, 0 for none
+	void Initialize(VkDevice device, uint32_t frameSlotCount, uint32_t timestampValidBits, float timestampPeriod, VkQueryPipelineStatisticFlags statistics);
+	void Destroy();
+
+	void SetEnabled(bool enabled);
+	bool IsEnabled() const { return enabled.load(std::memory_order_relaxed); }
+	bool AreTimestampsSupported() const { return timestampsSupported; }
+
+	//Call once the slot's fence has signaled. Turns the slot's previous results into trace events and starts its new frame.
+	//Whether the new frame is traced is decided here, so its scopes are either all written or none are
+	void BeginFrame(uint32_t slot);
+
+	//Reads every slot still holding results. Call once the device is idle
+	void ReadAll();
+
+	//Resets the slot's queries and opens the frame scope. Call first thing in the frame's primary command buffer
+	void BeginCommandBuffer(VkCommandBuffer commandBuffer);
+
+	//Closes the frame scope. Call last thing in the frame's primary command buffer
+	void EndCommandBuffer(VkCommandBuffer commandBuffer);
+
+	//Brackets GPU work of the frame's primary command buffer. Names must outlive the profiler, string literals are meant
+	uint32_t BeginScope(VkCommandBuffer commandBuffer, const char* name);
+	void EndScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+	//Pipeline statistics of everything recorded in between, at most once per frame.
+	//Secondaries executed meanwhile have to inherit GetFrameStatistics()
+	void BeginStatistics(VkCommandBuffer commandBuffer);
+	void EndStatistics(VkCommandBuffer commandBuffer);
+	VkQueryPipelineStatisticFlags GetFrameStatistics() const { return slots[currentSlot].traced ? statistics : 0; }
+
+	//Call right after the frame's submit. GPU scopes are placed on the CPU timeline relative to it
+	void MarkSubmitted();
+
+	//Thread safe
+	void AddCpuEvent(const char* name, std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end);
+
+	//GPU time of the last frame that has been read back, in milliseconds
+	double GetFrameTime() const { return lastFrameTime; }
+
+	bool HasEvents();
+	void WriteTrace(const std::string& filename);
+
+private:
+	struct TraceEvent
+	{
+		const char* name;
+		uint32_t thread;					//Index of the CPU thread, or ~0u for the GPU
+		double start;						//Microseconds since the profiler was initialized
+		double duration;
+	};
+
+	struct CounterEvent
+	{
+		double time;
+		std::vector<uint64_t> values;		//One per statistics bit, in bit order
+	};
+
+	struct SlotData
+	{
+		VkQueryPool timestampPool = VK_NULL_HANDLE;
+		VkQueryPool statisticsPool = VK_NULL_HANDLE;
+		std::vector<const char*> scopeNames;	//Scope i owns queries 2i and 2i+1. Scope 0 is the frame
+		bool traced = false;				//Recorded while enabled, so its scopes go into the trace
+		bool statisticsWritten = false;
+		bool submitted = false;
+		double submitTime = 0.0;
+	};
+
+	static const uint32_t maxScopes = 32;
+	static const size_t maxEvents = 1 << 20;	//Further events are dropped, so a long session cannot eat all memory
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::vector<SlotData> slots;
+	uint32_t currentSlot = 0;
+	bool timestampsSupported = false;
+	float timestampPeriod = 1.0f;			//Nanoseconds per tick
+	uint64_t timestampMask = ~0ull;			//Bits the queue actually writes
+	VkQueryPipelineStatisticFlags statistics = 0;
+	bool statisticsActive = false;
+	std::atomic<bool> enabled;
+	double lastFrameTime = 0.0;
+
+	std::chrono::high_resolution_clock::time_point epoch;
+	std::mutex eventMutex;
+	std::vector<TraceEvent> events;
+	std::vector<CounterEvent> counters;
+	size_t droppedEvents = 0;
+
+	double ToMicroseconds(std::chrono::high_resolution_clock::time_point time) const;
+	void ReadSlot(SlotData& slot);
+};
+
+//Adds a CPU event covering its own lifetime. Does nothing when the profiler is switched off at construction
+class ProfileScope
+{
+public:
+	ProfileScope(GpuProfiler& profiler, const char* name) : profiler(profiler), name(name), active(profiler.IsEnabled())
+	{
+		if (active)
+			start = std::chrono::high_resolution_clock::now();
+	}
+
+	~ProfileScope()
+	{
+		if (active)
+			profiler.AddCpuEvent(name, start, std::chrono::high_resolution_clock::now());
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	GpuProfiler& profiler;
+	const char* name;
+	bool active;
+	std::chrono::high_resolution_clock::time_point start;
+};
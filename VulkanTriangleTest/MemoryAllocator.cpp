@@ -0,0 +1,478 @@
+#include "MemoryAllocator.h"
+#include <stdexcept>
+#include <algorithm>
+#include <iomanip>
+
+//Smallest range the buddy allocator hands out. Allocations below this are rounded up
+static const VkDeviceSize minimumBuddySize = 256;
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static VkDeviceSize NextPowerOfTwo(VkDeviceSize value)
+{
+	VkDeviceSize power = 1;
+	while (power < value)
+	{
+		power <<= 1;
+	}
+	return power;
+}
+
+static VkDeviceSize PreviousPowerOfTwo(VkDeviceSize value)
+{
+	VkDeviceSize power = 1;
+	while ((power << 1) != 0 && (power << 1) <= value)
+	{
+		power <<= 1;
+	}
+	return power;
+}
+
+
+MemoryAllocator::MemoryAllocator()
+{
+}
+
+
+MemoryAllocator::~MemoryAllocator()
+{
+	Destroy();
+}
+
+void MemoryAllocator::Initialize(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize preferredBlockSize)
+{
+	this->device = device;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	//Blocks are powers of two so the buddy allocator can split them evenly. Small heaps such as the
+	//256 MiB host visible device local heap get smaller blocks, so a single block can't exhaust them
+	VkDeviceSize blockSize = PreviousPowerOfTwo(std::max(preferredBlockSize, minimumBuddySize));
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+	{
+		VkDeviceSize heapLimit = PreviousPowerOfTwo(std::max(memoryProperties.memoryHeaps[i].size / 8, minimumBuddySize));
+		blockSizes[i] = std::min(blockSize, heapLimit);
+	}
+}
+
+void MemoryAllocator::Destroy()
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	if (device == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	for (auto& pool : pools)
+	{
+		for (auto& block : pool.second)
+		{
+			DestroyBlock(block.get());
+		}
+	}
+	pools.clear();
+
+	for (auto& block : dedicatedBlocks)
+	{
+		DestroyBlock(block.get());
+	}
+	dedicatedBlocks.clear();
+
+	device = VK_NULL_HANDLE;
+}
+
+uint32_t MemoryAllocator::FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const
+{
+	//Memory types are ordered by the driver from best to worst, so the first match wins
+	VkMemoryPropertyFlags wanted = required | preferred;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((typeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & wanted) == wanted)
+		{
+			return i;
+		}
+	}
+
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((typeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & required) == required)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+MemoryAllocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+	ResourceKind kind, AllocationStrategy strategy)
+{
+	uint32_t memoryTypeIndex = FindMemoryType(requirements.memoryTypeBits, required, preferred);
+	uint32_t heapIndex = memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+	VkDeviceSize blockSize = blockSizes[heapIndex];
+
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	MemoryBlock* block = nullptr;
+	VkDeviceSize offset = 0;
+
+	//Lazily allocated memory is committed as it is touched, and vkGetDeviceMemoryCommitment can only tell per VkDeviceMemory.
+	//Transient attachments are few, so each gets its own allocation and its commitment can be reported
+	bool lazilyAllocated = (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+
+	if (requirements.size > blockSize / 2 || lazilyAllocated)
+	{
+		//Large resources get their own allocation instead of wasting most of a block
+		block = CreateBlock(memoryTypeIndex, requirements.size, strategy, true);
+		dedicatedBlocks.emplace_back(block);
+		block->allocationCount = 1;
+		block->requestedBytes = requirements.size;
+		block->allocatedBytes = requirements.size;
+	}
+	else
+	{
+		auto& pool = pools[PoolKey(memoryTypeIndex, kind, strategy)];
+		for (auto& candidate : pool)
+		{
+			if (AllocateFromBlock(candidate.get(), requirements.size, requirements.alignment, offset))
+			{
+				block = candidate.get();
+				break;
+			}
+		}
+
+		if (block == nullptr)
+		{
+			block = CreateBlock(memoryTypeIndex, blockSize, strategy, false);
+			pool.emplace_back(block);
+			if (!AllocateFromBlock(block, requirements.size, requirements.alignment, offset))
+			{
+				throw std::runtime_error("failed to sub-allocate from a new memory block!");
+			}
+		}
+		block->requestedBytes += requirements.size;
+	}
+
+	MemoryAllocation allocation;
+	allocation.memory = block->memory;
+	allocation.offset = offset;
+	allocation.size = requirements.size;
+	allocation.mappedData = block->mappedData ? block->mappedData + offset : nullptr;
+	allocation.memoryTypeIndex = memoryTypeIndex;
+	allocation.block = block;
+	return allocation;
+}
+
+MemoryAllocation MemoryAllocator::AllocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+	AllocationStrategy strategy)
+{
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(device, buffer, &requirements);
+
+	MemoryAllocation allocation = Allocate(requirements, required, preferred, ResourceKind::Linear, strategy);
+	if (vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS)
+	{
+		Free(allocation);
+		throw std::runtime_error("failed to bind buffer memory!");
+	}
+	return allocation;
+}
+
+MemoryAllocation MemoryAllocator::AllocateForImage(VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+	AllocationStrategy strategy)
+{
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(device, image, &requirements);
+
+	ResourceKind kind = tiling == VK_IMAGE_TILING_OPTIMAL ? ResourceKind::Optimal : ResourceKind::Linear;
+	MemoryAllocation allocation = Allocate(requirements, required, preferred, kind, strategy);
+	if (vkBindImageMemory(device, image, allocation.memory, allocation.offset) != VK_SUCCESS)
+	{
+		Free(allocation);
+		throw std::runtime_error("failed to bind image memory!");
+	}
+	return allocation;
+}
+
+void MemoryAllocator::Free(MemoryAllocation& allocation)
+{
+	if (allocation.block == nullptr)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	MemoryBlock* block = allocation.block;
+	if (block->dedicated)
+	{
+		auto it = std::find_if(dedicatedBlocks.begin(), dedicatedBlocks.end(),
+			[block](const std::unique_ptr<MemoryBlock>& candidate) { return candidate.get() == block; });
+		DestroyBlock(block);
+		dedicatedBlocks.erase(it);
+	}
+	else
+	{
+		block->requestedBytes -= allocation.size;
+		FreeFromBlock(block, allocation.offset);
+
+		//Keep one empty block per pool around for reuse, give any further empty blocks back to the driver
+		if (block->allocationCount == 0)
+		{
+			for (auto& pool : pools)
+			{
+				auto it = std::find_if(pool.second.begin(), pool.second.end(),
+					[block](const std::unique_ptr<MemoryBlock>& candidate) { return candidate.get() == block; });
+				if (it == pool.second.end())
+				{
+					continue;
+				}
+
+				bool otherEmptyBlock = std::any_of(pool.second.begin(), pool.second.end(),
+					[block](const std::unique_ptr<MemoryBlock>& candidate) { return candidate.get() != block && candidate->allocationCount == 0; });
+				if (otherEmptyBlock)
+				{
+					DestroyBlock(block);
+					pool.second.erase(it);
+				}
+				break;
+			}
+		}
+	}
+
+	allocation = MemoryAllocation();
+}
+
+MemoryStatistics MemoryAllocator::GetStatistics() const
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	MemoryStatistics statistics;
+	for (auto& pool : pools)
+	{
+		for (auto& block : pool.second)
+		{
+			statistics.blockCount++;
+			statistics.allocationCount += block->allocationCount;
+			statistics.blockBytes += block->size;
+			statistics.requestedBytes += block->requestedBytes;
+			statistics.allocatedBytes += block->allocatedBytes;
+
+			VkDeviceSize blockFree = 0;
+			VkDeviceSize largestFree = 0;
+			if (block->strategy == AllocationStrategy::General)
+			{
+				for (size_t order = 0; order < block->freeLists.size(); order++)
+				{
+					VkDeviceSize rangeSize = minimumBuddySize << order;
+					blockFree += rangeSize * block->freeLists[order].size();
+					if (!block->freeLists[order].empty())
+					{
+						largestFree = rangeSize;
+					}
+				}
+			}
+			else
+			{
+				blockFree = block->size - block->linearOffset;
+				largestFree = blockFree;
+			}
+			statistics.freeBytes += blockFree;
+			statistics.scatteredFreeBytes += blockFree - largestFree;
+			statistics.largestFreeRange = std::max(statistics.largestFreeRange, largestFree);
+		}
+	}
+
+	for (auto& block : dedicatedBlocks)
+	{
+		statistics.dedicatedBlockCount++;
+		statistics.allocationCount++;
+		statistics.blockBytes += block->size;
+		statistics.requestedBytes += block->requestedBytes;
+		statistics.allocatedBytes += block->allocatedBytes;
+	}
+
+	statistics.vkAllocateMemoryCount = statistics.blockCount + statistics.dedicatedBlockCount;
+	return statistics;
+}
+
+void MemoryAllocator::PrintStatistics(std::ostream& out) const
+{
+	MemoryStatistics statistics = GetStatistics();
+	const double mebibyte = 1024.0 * 1024.0;
+
+	out << "GPU memory: " << statistics.allocationCount << " allocations in " << statistics.blockCount << " blocks + "
+		<< statistics.dedicatedBlockCount << " dedicated (" << statistics.vkAllocateMemoryCount << " vkAllocateMemory)" << std::endl;
+	out << std::fixed << std::setprecision(2)
+		<< "  owned " << statistics.blockBytes / mebibyte << " MiB, requested " << statistics.requestedBytes / mebibyte
+		<< " MiB, allocated " << statistics.allocatedBytes / mebibyte << " MiB, free " << statistics.freeBytes / mebibyte
+		<< " MiB, largest free range " << statistics.largestFreeRange / mebibyte << " MiB, fragmentation "
+		<< statistics.Fragmentation() * 100.0f << "%" << std::endl;
+}
+
+bool MemoryAllocator::IsHostCoherent(uint32_t memoryTypeIndex) const
+{
+	return (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+uint32_t MemoryAllocator::PoolKey(uint32_t memoryTypeIndex, ResourceKind kind, AllocationStrategy strategy)
+{
+	return memoryTypeIndex * 4 + (kind == ResourceKind::Optimal ? 2 : 0) + (strategy == AllocationStrategy::Linear ? 1 : 0);
+}
+
+MemoryBlock* MemoryAllocator::CreateBlock(uint32_t memoryTypeIndex, VkDeviceSize size, AllocationStrategy strategy, bool dedicated)
+{
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate memory block!");
+	}
+
+	MemoryBlock* block = new MemoryBlock();
+	block->memory = memory;
+	block->size = size;
+	block->memoryTypeIndex = memoryTypeIndex;
+	block->strategy = strategy;
+	block->dedicated = dedicated;
+
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		void* data;
+		if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+		{
+			vkFreeMemory(device, memory, nullptr);
+			delete block;
+			throw std::runtime_error("failed to map memory block!");
+		}
+		block->mappedData = static_cast<uint8_t*>(data);
+	}
+
+	if (!dedicated && strategy == AllocationStrategy::General)
+	{
+		uint32_t orderCount = 1;
+		while ((minimumBuddySize << (orderCount - 1)) < size)
+		{
+			orderCount++;
+		}
+		block->freeLists.resize(orderCount);
+		block->freeLists[orderCount - 1].insert(0);
+	}
+
+	return block;
+}
+
+void MemoryAllocator::DestroyBlock(MemoryBlock* block)
+{
+	if (block->mappedData)
+	{
+		vkUnmapMemory(device, block->memory);
+	}
+	vkFreeMemory(device, block->memory, nullptr);
+	block->memory = VK_NULL_HANDLE;
+	block->mappedData = nullptr;
+}
+
+bool MemoryAllocator::AllocateFromBlock(MemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	if (block->strategy == AllocationStrategy::Linear)
+	{
+		VkDeviceSize alignedOffset = AlignUp(block->linearOffset, alignment);
+		if (alignedOffset + size > block->size)
+		{
+			return false;
+		}
+
+		block->allocatedBytes += alignedOffset + size - block->linearOffset;
+		block->linearOffset = alignedOffset + size;
+		block->allocationCount++;
+		offset = alignedOffset;
+		return true;
+	}
+
+	//Every range of a buddy block starts at a multiple of its own size, so rounding the
+	//size up to a power of two no smaller than the alignment also satisfies the alignment
+	VkDeviceSize rangeSize = NextPowerOfTwo(std::max(std::max(size, alignment), minimumBuddySize));
+	uint32_t order = 0;
+	while ((minimumBuddySize << order) < rangeSize)
+	{
+		order++;
+	}
+	if (order >= block->freeLists.size())
+	{
+		return false;
+	}
+
+	uint32_t freeOrder = order;
+	while (freeOrder < block->freeLists.size() && block->freeLists[freeOrder].empty())
+	{
+		freeOrder++;
+	}
+	if (freeOrder == block->freeLists.size())
+	{
+		return false;
+	}
+
+	VkDeviceSize rangeOffset = *block->freeLists[freeOrder].begin();
+	block->freeLists[freeOrder].erase(block->freeLists[freeOrder].begin());
+
+	//Split the range in halves until it is the requested size, keeping the upper halves free
+	while (freeOrder > order)
+	{
+		freeOrder--;
+		block->freeLists[freeOrder].insert(rangeOffset + (minimumBuddySize << freeOrder));
+	}
+
+	block->allocatedOrders[rangeOffset] = order;
+	block->allocatedBytes += rangeSize;
+	block->allocationCount++;
+	offset = rangeOffset;
+	return true;
+}
+
+void MemoryAllocator::FreeFromBlock(MemoryBlock* block, VkDeviceSize offset)
+{
+	block->allocationCount--;
+
+	if (block->strategy == AllocationStrategy::Linear)
+	{
+		//Individual frees only count down, the space comes back once the block is empty
+		if (block->allocationCount == 0)
+		{
+			block->linearOffset = 0;
+			block->allocatedBytes = 0;
+		}
+		return;
+	}
+
+	auto allocated = block->allocatedOrders.find(offset);
+	if (allocated == block->allocatedOrders.end())
+	{
+		throw std::runtime_error("freed memory that was not allocated from this block!");
+	}
+	uint32_t order = allocated->second;
+	block->allocatedOrders.erase(allocated);
+	block->allocatedBytes -= minimumBuddySize << order;
+
+	//Merge with the buddy for as long as it is free too
+	while (order + 1 < block->freeLists.size())
+	{
+		VkDeviceSize buddyOffset = offset ^ (minimumBuddySize << order);
+		auto buddy = block->freeLists[order].find(buddyOffset);
+		if (buddy == block->freeLists[order].end())
+		{
+			break;
+		}
+		block->freeLists[order].erase(buddy);
+		offset = std::min(offset, buddyOffset);
+		order++;
+	}
+	block->freeLists[order].insert(offset);
+}
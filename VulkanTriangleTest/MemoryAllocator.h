@@ -0,0 +1,131 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+
+//How allocations are placed inside a block
+enum class AllocationStrategy
+{
+	General,				//Buddy allocator. Any allocation can be freed on its own and freed neighbours merge back together
+	Linear					//Bump allocator for short-lived data. Space is only reused once every allocation in the block is freed
+};
+
+//Buffers and linear images must not share a bufferImageGranularity page with optimal images.
+//The allocator keeps the two kinds in separate blocks, so neighbours within a block never conflict.
+enum class ResourceKind
+{
+	Linear,					//Buffers and VK_IMAGE_TILING_LINEAR images
+	Optimal					//VK_IMAGE_TILING_OPTIMAL images
+};
+
+struct MemoryBlock;
+
+//A range of device memory handed out by the allocator
+struct MemoryAllocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void* mappedData = nullptr;				//Host visible memory stays mapped for its whole lifetime. Already offset
+	uint32_t memoryTypeIndex = 0;
+	MemoryBlock* block = nullptr;
+};
+
+struct MemoryStatistics
+{
+	uint32_t blockCount = 0;
+	uint32_t dedicatedBlockCount = 0;
+	uint32_t allocationCount = 0;
+	VkDeviceSize blockBytes = 0;			//Device memory owned by the allocator
+	VkDeviceSize requestedBytes = 0;		//Sum of the sizes callers asked for
+	VkDeviceSize allocatedBytes = 0;		//Space taken in the blocks, including alignment and buddy rounding
+	VkDeviceSize freeBytes = 0;
+	VkDeviceSize largestFreeRange = 0;
+	VkDeviceSize scatteredFreeBytes = 0;	//Free bytes outside the largest free range of their block
+	uint32_t vkAllocateMemoryCount = 0;		//Live vkAllocateMemory allocations, limited by maxMemoryAllocationCount
+
+	//0 when each block's free space is one range, approaching 1 as it is split into many small ranges
+	float Fragmentation() const { return freeBytes ? (float)scatteredFreeBytes / (float)freeBytes : 0.0f; }
+};
+
+//Sub-allocates resources from large VkDeviceMemory blocks, so the number of vkAllocateMemory calls stays far below
+//maxMemoryAllocationCount. Blocks are pooled per memory type, resource kind and strategy. Thread safe.
+class MemoryAllocator
+{
+public:
+	MemoryAllocator();
+	~MemoryAllocator();
+
+	MemoryAllocator(const MemoryAllocator&) = delete;
+	MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+	void Initialize(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize preferredBlockSize = 64 * 1024 * 1024);
+
+	//Frees every block. All allocations must have been freed, or be no longer in use
+	void Destroy();
+
+	//Picks a memory type allowed by typeBits with all required flags, favouring one that also has the preferred flags
+	uint32_t FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0) const;
+
+	MemoryAllocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+		ResourceKind kind, AllocationStrategy strategy = AllocationStrategy::General);
+
+	//Allocate and bind in one step
+	MemoryAllocation AllocateForBuffer(VkBuffer buffer, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0,
+		AllocationStrategy strategy = AllocationStrategy::General);
+	MemoryAllocation AllocateForImage(VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0,
+		AllocationStrategy strategy = AllocationStrategy::General);
+
+	void Free(MemoryAllocation& allocation);
+
+	MemoryStatistics GetStatistics() const;
+	void PrintStatistics(std::ostream& out) const;
+
+	const VkPhysicalDeviceMemoryProperties& GetMemoryProperties() const { return memoryProperties; }
+	bool IsHostCoherent(uint32_t memoryTypeIndex) const;
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	VkDeviceSize blockSizes[VK_MAX_MEMORY_HEAPS] = {};		//Power of two per heap, smaller for small heaps
+
+	//Keyed by PoolKey()
+	std::map<uint32_t, std::vector<std::unique_ptr<MemoryBlock>>> pools;
+	std::vector<std::unique_ptr<MemoryBlock>> dedicatedBlocks;
+	mutable std::mutex allocatorMutex;
+
+	static uint32_t PoolKey(uint32_t memoryTypeIndex, ResourceKind kind, AllocationStrategy strategy);
+
+	MemoryBlock* CreateBlock(uint32_t memoryTypeIndex, VkDeviceSize size, AllocationStrategy strategy, bool dedicated);
+	void DestroyBlock(MemoryBlock* block);
+
+	//Return false when the block has no room
+	bool AllocateFromBlock(MemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	void FreeFromBlock(MemoryBlock* block, VkDeviceSize offset);
+};
+
+//A VkDeviceMemory block and the bookkeeping of its strategy
+struct MemoryBlock
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	uint8_t* mappedData = nullptr;
+	uint32_t memoryTypeIndex = 0;
+	AllocationStrategy strategy = AllocationStrategy::General;
+	bool dedicated = false;
+	uint32_t allocationCount = 0;
+	VkDeviceSize requestedBytes = 0;
+	VkDeviceSize allocatedBytes = 0;
+
+	//Buddy state. freeLists[order] holds the offsets of free ranges of minimumBuddySize << order bytes
+	std::vector<std::set<VkDeviceSize>> freeLists;
+	std::unordered_map<VkDeviceSize, uint32_t> allocatedOrders;
+
+	//Linear state
+	VkDeviceSize linearOffset = 0;
+};
@@ -0,0 +1,372 @@
+#include "PipelineBuilder.h"
+#include <stdexcept>
+#include <functional>
+
+template<typename T>
+static void HashCombine(size_t& seed, const T& value)
+{
+	seed ^= std::hash<T>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+size_t PipelineDescription::Hash() const
+{
+	size_t seed = 0;
+	HashCombine(seed, vertexShader);
+	HashCombine(seed, fragmentShader);
+	HashCombine(seed, (uint32_t)topology);
+	HashCombine(seed, (uint32_t)polygonMode);
+	HashCombine(seed, (uint32_t)cullMode);
+	HashCombine(seed, (uint32_t)frontFace);
+	HashCombine(seed, blendEnable);
+	HashCombine(seed, (uint32_t)samples);
+	HashCombine(seed, depthTest);
+	HashCombine(seed, depthWrite);
+	HashCombine(seed, (uint32_t)depthCompareOp);
+
+	for (const auto& binding : vertexBindings)
+	{
+		HashCombine(seed, binding.binding);
+		HashCombine(seed, binding.stride);
+		HashCombine(seed, (uint32_t)binding.inputRate);
+	}
+
+	for (const auto& attribute : vertexAttributes)
+	{
+		HashCombine(seed, attribute.location);
+		HashCombine(seed, attribute.binding);
+		HashCombine(seed, (uint32_t)attribute.format);
+		HashCombine(seed, attribute.offset);
+	}
+
+	HashCombine(seed, layout);
+	HashCombine(seed, renderPass);
+	HashCombine(seed, subpass);
+	return seed;
+}
+
+bool PipelineDescription::operator==(const PipelineDescription& other) const
+{
+	if (vertexShader != other.vertexShader || fragmentShader != other.fragmentShader || topology != other.topology ||
+		polygonMode != other.polygonMode || cullMode != other.cullMode || frontFace != other.frontFace || blendEnable != other.blendEnable ||
+		samples != other.samples || depthTest != other.depthTest || depthWrite != other.depthWrite || depthCompareOp != other.depthCompareOp ||
+		layout != other.layout || renderPass != other.renderPass || subpass != other.subpass ||
+		vertexBindings.size() != other.vertexBindings.size() || vertexAttributes.size() != other.vertexAttributes.size())
+		return false;
+
+	for (size_t i = 0; i < vertexBindings.size(); i++)
+	{
+		const auto& a = vertexBindings[i];
+		const auto& b = other.vertexBindings[i];
+		if (a.binding != b.binding || a.stride != b.stride || a.inputRate != b.inputRate)
+			return false;
+	}
+
+	for (size_t i = 0; i < vertexAttributes.size(); i++)
+	{
+		const auto& a = vertexAttributes[i];
+		const auto& b = other.vertexAttributes[i];
+		if (a.location != b.location || a.binding != b.binding || a.format != b.format || a.offset != b.offset)
+			return false;
+	}
+
+	return true;
+}
+
+
+PipelineBuilder::PipelineBuilder()
+{
+}
+
+
+PipelineBuilder::~PipelineBuilder()
+{
+}
+
+void PipelineBuilder::Initialize(VkDevice device, VkPipelineCache pipelineCache, const ShaderArchive* shaderArchive, ThreadPool* workerPool)
+{
+	this->device = device;
+	this->pipelineCache = pipelineCache;
+	this->shaderArchive = shaderArchive;
+	this->workerPool = workerPool;
+}
+
+//The lock is held while queueing, so two threads asking for the same new state cannot both build it
+std::shared_future<VkPipeline> PipelineBuilder::Request(const PipelineDescription& description)
+{
+	std::lock_guard<std::mutex> lock(requestedMutex);
+	statistics.requests++;
+
+	auto existing = graphicsPipelines.find(description);
+	if (existing != graphicsPipelines.end())
+		return existing->second;
+
+	statistics.builds++;
+	std::shared_future<VkPipeline> pipeline = workerPool->Submit([this, description]() { return Build(description); }).share();
+	graphicsPipelines.emplace(description, pipeline);
+
+	return pipeline;
+}
+
+std::vector<std::shared_future<VkPipeline>> PipelineBuilder::RequestBatch(const std::vector<PipelineDescription>& descriptions)
+{
+	std::vector<std::shared_future<VkPipeline>> pipelines;
+	pipelines.reserve(descriptions.size());
+
+	for (const auto& description : descriptions)
+	{
+		pipelines.push_back(Request(description));
+	}
+
+	return pipelines;
+}
+
+std::shared_future<VkPipeline> PipelineBuilder::RequestCompute(const std::string& computeShader, VkPipelineLayout layout)
+{
+	std::lock_guard<std::mutex> lock(requestedMutex);
+	statistics.requests++;
+
+	auto key = std::make_pair(computeShader, layout);
+	auto existing = computePipelines.find(key);
+	if (existing != computePipelines.end())
+		return existing->second;
+
+	statistics.builds++;
+	std::shared_future<VkPipeline> pipeline = workerPool->Submit([this, computeShader, layout]() { return BuildCompute(computeShader, layout); }).share();
+	computePipelines.emplace(key, pipeline);
+
+	return pipeline;
+}
+
+//A failed build has nothing to destroy. Its error was already reported to whoever waited on it
+static void DestroyPipeline(VkDevice device, const std::shared_future<VkPipeline>& pipeline)
+{
+	try
+	{
+		vkDestroyPipeline(device, pipeline.get(), nullptr);
+	}
+	catch (const std::exception&)
+	{
+	}
+}
+
+void PipelineBuilder::DestroyPipelines()
+{
+	std::lock_guard<std::mutex> lock(requestedMutex);
+
+	for (auto& pipeline : graphicsPipelines)
+	{
+		DestroyPipeline(device, pipeline.second);
+	}
+
+	for (auto& pipeline : computePipelines)
+	{
+		DestroyPipeline(device, pipeline.second);
+	}
+
+	graphicsPipelines.clear();
+	computePipelines.clear();
+}
+
+PipelineBuilderStatistics PipelineBuilder::GetStatistics()
+{
+	std::lock_guard<std::mutex> lock(requestedMutex);
+	return statistics;
+}
+
+VkPipeline PipelineBuilder::Build(const PipelineDescription& description)
+{
+	//Look up the compiled bytecode of the two shaders. The code stays inside the mapped archive
+	ShaderCode vertShaderCode = shaderArchive->Find(description.vertexShader.c_str());
+	ShaderCode fragShaderCode = shaderArchive->Find(description.fragmentShader.c_str());
+
+	//Create the shader module to wrap the shaders before passing them to the pipeline
+	VkShaderModule vertShaderModule = CreateShaderModule(vertShaderCode);
+	VkShaderModule fragShaderModule;
+	try
+	{
+		fragShaderModule = CreateShaderModule(fragShaderCode);
+	}
+	catch (const std::exception&)
+	{
+		vkDestroyShaderModule(device, vertShaderModule, nullptr);
+		throw;
+	}
+
+	//Creates the shader int the pipeline
+	VkPipelineShaderStageCreateInfo vertShaderInfo = {};
+	vertShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vertShaderInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vertShaderInfo.module = vertShaderModule;
+	vertShaderInfo.pName = "main";
+
+	VkPipelineShaderStageCreateInfo fragShaderInfo = {};
+	fragShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	fragShaderInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	fragShaderInfo.module = fragShaderModule;
+	fragShaderInfo.pName = "main";
+
+	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderInfo, fragShaderInfo };
+
+	//Vertex input creation - type of data passed to the vertex shader
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputInfo.vertexBindingDescriptionCount = (uint32_t)description.vertexBindings.size();
+	vertexInputInfo.pVertexBindingDescriptions = description.vertexBindings.data();
+	vertexInputInfo.vertexAttributeDescriptionCount = (uint32_t)description.vertexAttributes.size();
+	vertexInputInfo.pVertexAttributeDescriptions = description.vertexAttributes.data();
+
+	//Input Assembly - specifies the primitives
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = {};
+	inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyInfo.topology = description.topology;
+	inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
+
+	//Viewport - region of the framebuffer the output will be rendered to
+	//Scissors - region in the viewport the pixels will be stored
+	//Both are set when recording, so one pipeline serves every swap chain extent
+	VkPipelineViewportStateCreateInfo viewportInfo = {};
+	viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportInfo.viewportCount = 1;
+	viewportInfo.pViewports = nullptr;
+	viewportInfo.scissorCount = 1;
+	viewportInfo.pScissors = nullptr;
+
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicStateInfo = {};
+	dynamicStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicStateInfo.dynamicStateCount = 2;
+	dynamicStateInfo.pDynamicStates = dynamicStates;
+
+	//Rasterizer - Takes the vertices from the vertex shader and converts them into fragments.
+	VkPipelineRasterizationStateCreateInfo rasterizerInfo = {};
+	rasterizerInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizerInfo.depthClampEnable = VK_FALSE;
+	rasterizerInfo.rasterizerDiscardEnable = VK_FALSE;
+	rasterizerInfo.polygonMode = description.polygonMode;
+	rasterizerInfo.lineWidth = 1.0f;
+	rasterizerInfo.cullMode = description.cullMode;
+	rasterizerInfo.frontFace = description.frontFace;
+	rasterizerInfo.depthBiasEnable = VK_FALSE;
+	rasterizerInfo.depthBiasConstantFactor = 0.0f;
+	rasterizerInfo.depthBiasClamp = 0.0f;
+	rasterizerInfo.depthBiasSlopeFactor = 0.0f;
+
+	//Multisampling - Performs anti-aliasing.
+	//Combines the fragment shader output that maps to the same pixel.
+	VkPipelineMultisampleStateCreateInfo multiSampleInfo = {};
+	multiSampleInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multiSampleInfo.sampleShadingEnable = VK_FALSE;
+	multiSampleInfo.rasterizationSamples = description.samples;
+	//multiSampleInfo.minSampleShading = 1.0f;
+	//multiSampleInfo.pSampleMask = nullptr;
+	//multiSampleInfo.alphaToCoverageEnable = VK_FALSE;
+	//multiSampleInfo.alphaToOneEnable = VK_FALSE;
+
+	//Depth testing - ignored by render passes without a depth attachment
+	VkPipelineDepthStencilStateCreateInfo depthStencilInfo = {};
+	depthStencilInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencilInfo.depthTestEnable = description.depthTest ? VK_TRUE : VK_FALSE;
+	depthStencilInfo.depthWriteEnable = description.depthWrite ? VK_TRUE : VK_FALSE;
+	depthStencilInfo.depthCompareOp = description.depthCompareOp;
+	depthStencilInfo.depthBoundsTestEnable = VK_FALSE;
+	depthStencilInfo.stencilTestEnable = VK_FALSE;
+
+	//Color blending - after the fragment shader returns the color it needs to be combined with the old color.
+	VkPipelineColorBlendAttachmentState colorBlendAttachmentInfo = {};
+	colorBlendAttachmentInfo.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachmentInfo.blendEnable = description.blendEnable ? VK_TRUE : VK_FALSE;
+
+	//Standard alpha blending for the blended variants
+	colorBlendAttachmentInfo.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	colorBlendAttachmentInfo.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	colorBlendAttachmentInfo.colorBlendOp = VK_BLEND_OP_ADD;
+	colorBlendAttachmentInfo.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachmentInfo.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	colorBlendAttachmentInfo.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	VkPipelineColorBlendStateCreateInfo colorBlendInfo = {};
+	colorBlendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlendInfo.logicOpEnable = VK_FALSE;
+	colorBlendInfo.logicOp = VK_LOGIC_OP_COPY;
+	colorBlendInfo.attachmentCount = 1;
+	colorBlendInfo.pAttachments = &colorBlendAttachmentInfo;
+	colorBlendInfo.blendConstants[0] = 0.0f;
+	colorBlendInfo.blendConstants[1] = 0.0f;
+	colorBlendInfo.blendConstants[2] = 0.0f;
+	colorBlendInfo.blendConstants[3] = 0.0f;
+
+	//Create Graphics pipeline
+	VkGraphicsPipelineCreateInfo graphicsPipelineInfo = {};
+	graphicsPipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	graphicsPipelineInfo.stageCount = 2;
+	graphicsPipelineInfo.pStages = shaderStages;
+	graphicsPipelineInfo.pVertexInputState = &vertexInputInfo;
+	graphicsPipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
+	graphicsPipelineInfo.pViewportState = &viewportInfo;
+	graphicsPipelineInfo.pRasterizationState = &rasterizerInfo;
+	graphicsPipelineInfo.pMultisampleState = &multiSampleInfo;
+	graphicsPipelineInfo.pDepthStencilState = &depthStencilInfo;
+	graphicsPipelineInfo.pColorBlendState = &colorBlendInfo;
+	graphicsPipelineInfo.pDynamicState = &dynamicStateInfo;
+	graphicsPipelineInfo.layout = description.layout;
+	graphicsPipelineInfo.renderPass = description.renderPass;
+	graphicsPipelineInfo.subpass = description.subpass;
+	graphicsPipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+	VkPipeline pipeline;
+	VkResult result = vkCreateGraphicsPipelines(device, pipelineCache, 1, &graphicsPipelineInfo, nullptr, &pipeline);
+
+	//Delete the modules	
+	vkDestroyShaderModule(device, fragShaderModule, nullptr);
+	vkDestroyShaderModule(device, vertShaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create Graphics Pipeline");
+	}
+
+	return pipeline;
+}
+
+VkPipeline PipelineBuilder::BuildCompute(const std::string& computeShader, VkPipelineLayout layout)
+{
+	VkShaderModule computeShaderModule = CreateShaderModule(shaderArchive->Find(computeShader.c_str()));
+
+	VkComputePipelineCreateInfo computePipelineInfo = {};
+	computePipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	computePipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	computePipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	computePipelineInfo.stage.module = computeShaderModule;
+	computePipelineInfo.stage.pName = "main";
+	computePipelineInfo.layout = layout;
+	computePipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+	VkPipeline pipeline;
+	VkResult result = vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineInfo, nullptr, &pipeline);
+
+	vkDestroyShaderModule(device, computeShaderModule, nullptr);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create Compute Pipeline");
+	}
+
+	return pipeline;
+}
+
+VkShaderModule PipelineBuilder::CreateShaderModule(const ShaderCode& shader)
+{
+	VkShaderModuleCreateInfo shaderModuleInfo = {};
+	shaderModuleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleInfo.codeSize = shader.size;
+	shaderModuleInfo.pCode = shader.code;
+
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(device, &shaderModuleInfo, nullptr, &shaderModule) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create a shader module");
+	}
+
+	return shaderModule;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <future>
+#include <mutex>
+#include <map>
+#include <unordered_map>
+#include "ShaderArchive.h"
+#include "ThreadPool.h"
+
+//Shaders and fixed-function state of one graphics pipeline variant
+struct PipelineDescription
+{
+	std::string vertexShader = "vert.spv";
+	std::string fragmentShader = "frag.spv";
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+	bool blendEnable = false;
+
+	//Must match the render pass attachments. Depth compares with LESS_OR_EQUAL by default, so equal depths keep draw order
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	bool depthTest = false;
+	bool depthWrite = false;
+	VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+	//Vertex buffers and the attributes read from them. Both empty for shaders that generate their own vertices
+	std::vector<VkVertexInputBindingDescription> vertexBindings;
+	std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+
+	//Objects the pipeline is built against
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	uint32_t subpass = 0;
+
+	//Viewport and scissor are dynamic state, so the pipeline survives swap chain resizes
+
+	//Over every field, so equal descriptions always share one pipeline
+	size_t Hash() const;
+	bool operator==(const PipelineDescription& other) const;
+};
+
+struct PipelineDescriptionHash
+{
+	size_t operator()(const PipelineDescription& description) const { return description.Hash(); }
+};
+
+struct PipelineBuilderStatistics
+{
+	uint64_t requests = 0;
+	uint64_t builds = 0;					//Requests for state no earlier request had
+
+	float HitRate() const { return requests ? (float)(requests - builds) / (float)requests : 0.0f; }
+};
+
+//Builds graphics pipelines on a worker pool. All builds share one pipeline cache, which Vulkan synchronizes internally.
+//Callers get a future per pipeline and only block on the ones they actually need.
+//Requests are deduplicated by their description: asking for state that was requested before returns the same pipeline, so only
+//new state combinations are ever built. The pipelines belong to the builder, callers never destroy them.
+class PipelineBuilder
+{
+public:
+	PipelineBuilder();
+	~PipelineBuilder();
+
+	void Initialize(VkDevice device, VkPipelineCache pipelineCache, const ShaderArchive* shaderArchive, ThreadPool* workerPool);
+
+	//Queues one build and returns immediately
+	std::shared_future<VkPipeline> Request(const PipelineDescription& description);
+
+	//Queues a batch of builds, spread across the worker threads. The futures are in the order of the descriptions
+	std::vector<std::shared_future<VkPipeline>> RequestBatch(const std::vector<PipelineDescription>& descriptions);
+
+	//Queues a compute pipeline build for the given shader
+	std::shared_future<VkPipeline> RequestCompute(const std::string& computeShader, VkPipelineLayout layout);
+
+	//Waits for outstanding builds and destroys every pipeline this builder created
+	void DestroyPipelines();
+
+	PipelineBuilderStatistics GetStatistics();
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+	const ShaderArchive* shaderArchive = nullptr;
+	ThreadPool* workerPool = nullptr;
+
+	std::unordered_map<PipelineDescription, std::shared_future<VkPipeline>, PipelineDescriptionHash> graphicsPipelines;
+	std::map<std::pair<std::string, VkPipelineLayout>, std::shared_future<VkPipeline>> computePipelines;
+	PipelineBuilderStatistics statistics;
+	std::mutex requestedMutex;
+
+	//Runs on a worker thread
+	VkPipeline Build(const PipelineDescription& description);
+	VkPipeline BuildCompute(const std::string& computeShader, VkPipelineLayout layout);
+	VkShaderModule CreateShaderModule(const ShaderCode& shader);
+};
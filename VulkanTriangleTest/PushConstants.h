@@ -0,0 +1,53 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <type_traits>
+
+//Push constant ranges and pushes derived from the C++ struct a shader's push_constant block mirrors.
+//Every block starts at offset 0 of its range, and is checked at compile time against the size every device supports,
+//so a block that grows past it fails to build instead of failing pipeline layout creation on some devices.
+
+//maxPushConstantsSize is at least this on every device
+const uint32_t guaranteedPushConstantsSize = 128;
+
+//Largest of the blocks sharing a range
+template<typename Block>
+constexpr uint32_t PushConstantsSize()
+{
+	return (uint32_t)sizeof(Block);
+}
+
+template<typename Block, typename Next, typename... Rest>
+constexpr uint32_t PushConstantsSize()
+{
+	return PushConstantsSize<Block>() > PushConstantsSize<Next, Rest...>() ? PushConstantsSize<Block>() : PushConstantsSize<Next, Rest...>();
+}
+
+template<typename Block>
+constexpr bool IsPushConstantBlock()
+{
+	return std::is_trivially_copyable<Block>::value && sizeof(Block) % 4 == 0;
+}
+
+//Range for the given stages, large enough for any of the blocks. Pipelines sharing a layout may each push a different one
+template<typename... Blocks>
+VkPushConstantRange PushConstantRange(VkShaderStageFlags stages)
+{
+	static_assert(PushConstantsSize<Blocks...>() <= guaranteedPushConstantsSize, "push constants exceed the 128 bytes every device supports");
+	static_assert(PushConstantsSize<Blocks...>() % 4 == 0, "push constant ranges are sized in multiples of 4");
+
+	VkPushConstantRange range = {};
+	range.stageFlags = stages;
+	range.offset = 0;
+	range.size = PushConstantsSize<Blocks...>();
+	return range;
+}
+
+//Records a push of the whole block. The bound pipeline's layout needs a range for the stages created with PushConstantRange
+template<typename Block>
+void PushConstants(VkCommandBuffer commandBuffer, VkPipelineLayout layout, VkShaderStageFlags stages, const Block& block)
+{
+	static_assert(IsPushConstantBlock<Block>(), "push constant blocks are copied as raw bytes in multiples of 4");
+	static_assert(sizeof(Block) <= guaranteedPushConstantsSize, "push constants exceed the 128 bytes every device supports");
+
+	vkCmdPushConstants(commandBuffer, layout, stages, 0, sizeof(Block), &block);
+}
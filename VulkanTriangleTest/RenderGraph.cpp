@@ -0,0 +1,1071 @@
+#include "RenderGraph.h"
+#include <stdexcept>
+#include <algorithm>
+
+static const VkAccessFlags writeAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+
+RenderGraph::RenderGraph()
+{
+}
+
+
+RenderGraph::~RenderGraph()
+{
+	Destroy();
+}
+
+void RenderGraph::Initialize(VkDevice device, MemoryAllocator& allocator)
+{
+	this->device = device;
+	this->allocator = &allocator;
+}
+
+void RenderGraph::Destroy()
+{
+	if (device == VK_NULL_HANDLE)
+		return;
+
+	for (auto& step : steps)
+	{
+		if (step.renderPass != VK_NULL_HANDLE)
+			vkDestroyRenderPass(device, step.renderPass, nullptr);
+	}
+
+	resources.clear();
+	passes.clear();
+	steps.clear();
+	importedImageCount = 0;
+	slotCount = 0;
+	renderPassCount = 0;
+	culledPassCount = 0;
+	barrierCount = 0;
+	device = VK_NULL_HANDLE;
+}
+
+RenderGraphResource RenderGraph::CreateImage(const std::string& name, const RenderGraphImageDescription& description)
+{
+	Resource resource = {};
+	resource.name = name;
+	resource.image = true;
+	resource.description = description;
+	resource.importIndex = invalidIndex;
+	resources.push_back(resource);
+	return (RenderGraphResource)resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::ImportImage(const std::string& name, VkFormat format, VkSampleCountFlagBits samples, VkImageLayout finalLayout,
+	VkPipelineStageFlags readyStage, bool output)
+{
+	Resource resource = {};
+	resource.name = name;
+	resource.image = true;
+	resource.imported = true;
+	resource.output = output;
+	resource.description.format = format;
+	resource.description.samples = samples;
+	resource.description.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+	resource.finalLayout = finalLayout;
+	resource.readyStage = readyStage;
+	resource.importIndex = importedImageCount++;
+	resources.push_back(resource);
+	return (RenderGraphResource)resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::ImportBuffer(const std::string& name)
+{
+	Resource resource = {};
+	resource.name = name;
+	resource.imported = true;
+	resource.importIndex = invalidIndex;
+	resources.push_back(resource);
+	return (RenderGraphResource)resources.size() - 1;
+}
+
+void RenderGraph::BindBuffer(RenderGraphResource resource, VkBuffer buffer)
+{
+	resources[resource].buffer = buffer;
+}
+
+RenderGraphPass RenderGraph::AddGraphicsPass(const std::string& name, VkSubpassContents contents, std::function<void(VkCommandBuffer)> record)
+{
+	Pass pass = {};
+	pass.name = name;
+	pass.graphics = true;
+	pass.contents = contents;
+	pass.record = record;
+	passes.push_back(pass);
+	return (RenderGraphPass)passes.size() - 1;
+}
+
+RenderGraphPass RenderGraph::AddComputePass(const std::string& name, std::function<void(VkCommandBuffer)> record)
+{
+	Pass pass = {};
+	pass.name = name;
+	pass.graphics = false;
+	pass.contents = VK_SUBPASS_CONTENTS_INLINE;
+	pass.record = record;
+	passes.push_back(pass);
+	return (RenderGraphPass)passes.size() - 1;
+}
+
+void RenderGraph::SetSideEffects(RenderGraphPass pass)
+{
+	passes[pass].sideEffects = true;
+}
+
+//Attachments are read as well when their contents are loaded
+void RenderGraph::WriteColor(RenderGraphPass pass, RenderGraphResource resource)
+{
+	AddUsage(pass, resource, UsageKind::Color, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, nullptr);
+}
+
+void RenderGraph::WriteColor(RenderGraphPass pass, RenderGraphResource resource, const VkClearColorValue& clear)
+{
+	VkClearValue clearValue = {};
+	clearValue.color = clear;
+	AddUsage(pass, resource, UsageKind::Color, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, &clearValue);
+}
+
+void RenderGraph::WriteDepth(RenderGraphPass pass, RenderGraphResource resource)
+{
+	AddUsage(pass, resource, UsageKind::Depth, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true, nullptr);
+}
+
+void RenderGraph::WriteDepth(RenderGraphPass pass, RenderGraphResource resource, const VkClearDepthStencilValue& clear)
+{
+	VkClearValue clearValue = {};
+	clearValue.depthStencil = clear;
+	AddUsage(pass, resource, UsageKind::Depth, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true, &clearValue);
+}
+
+//Overwrites every pixel, so nothing is loaded
+void RenderGraph::WriteResolve(RenderGraphPass pass, RenderGraphResource resource)
+{
+	AddUsage(pass, resource, UsageKind::Resolve, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, nullptr);
+}
+
+void RenderGraph::ReadImage(RenderGraphPass pass, RenderGraphResource resource, VkPipelineStageFlags stages)
+{
+	AddUsage(pass, resource, UsageKind::Image, stages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, nullptr);
+}
+
+void RenderGraph::ReadBuffer(RenderGraphPass pass, RenderGraphResource resource, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	AddUsage(pass, resource, UsageKind::Buffer, stages, access, VK_IMAGE_LAYOUT_UNDEFINED, false, nullptr);
+}
+
+void RenderGraph::WriteBuffer(RenderGraphPass pass, RenderGraphResource resource, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	AddUsage(pass, resource, UsageKind::Buffer, stages, access, VK_IMAGE_LAYOUT_UNDEFINED, true, nullptr);
+}
+
+void RenderGraph::AddUsage(RenderGraphPass pass, RenderGraphResource resource, UsageKind kind, VkPipelineStageFlags stages, VkAccessFlags access,
+	VkImageLayout layout, bool write, const VkClearValue* clear)
+{
+	bool attachment = kind == UsageKind::Color || kind == UsageKind::Depth || kind == UsageKind::Resolve;
+	if (attachment && !passes[pass].graphics)
+	{
+		throw std::runtime_error("render graph pass " + passes[pass].name + " is not a graphics pass, but has attachments");
+	}
+
+	if ((kind == UsageKind::Buffer) == resources[resource].image)
+	{
+		throw std::runtime_error("render graph pass " + passes[pass].name + " uses " + resources[resource].name + " as the wrong kind of resource");
+	}
+
+	Usage usage = {};
+	usage.resource = resource;
+	usage.kind = kind;
+	usage.stages = stages;
+	usage.access = access;
+	usage.layout = layout;
+	usage.write = write;
+	usage.clear = clear != nullptr;
+	if (clear)
+		usage.clearValue = *clear;
+
+	//Cleared attachments never read what was there
+	if (usage.clear)
+		usage.access &= writeAccessMask;
+
+	passes[pass].usages.push_back(usage);
+}
+
+void RenderGraph::Compile()
+{
+	CullPasses();
+	BuildSteps();
+	AssignLifetimes();
+	AssignSlots();
+	DeriveSynchronization();
+}
+
+//Walks the passes backwards from the outputs. A pass survives when something later reads what it writes
+void RenderGraph::CullPasses()
+{
+	std::vector<bool> needed(resources.size());
+	for (size_t i = 0; i < resources.size(); i++)
+	{
+		needed[i] = resources[i].output;
+	}
+
+	culledPassCount = 0;
+	for (size_t p = passes.size(); p-- > 0;)
+	{
+		Pass& pass = passes[p];
+
+		pass.alive = pass.sideEffects;
+		for (const auto& usage : pass.usages)
+		{
+			if (usage.write && needed[usage.resource])
+				pass.alive = true;
+		}
+
+		if (!pass.alive)
+		{
+			culledPassCount++;
+			continue;
+		}
+
+		//Attachments that are loaded need whatever wrote them earlier
+		for (const auto& usage : pass.usages)
+		{
+			bool reads = !usage.write || ((usage.kind == UsageKind::Color || usage.kind == UsageKind::Depth) && !usage.clear);
+			if (reads)
+				needed[usage.resource] = true;
+		}
+	}
+}
+
+//Consecutive graphics passes share a render pass unless one of them reads, outside of its attachments, something another one
+//accesses inside it. Barriers can only be recorded before the render pass begins
+void RenderGraph::BuildSteps()
+{
+	steps.clear();
+	Step* open = nullptr;
+
+	for (uint32_t p = 0; p < passes.size(); p++)
+	{
+		Pass& pass = passes[p];
+		if (!pass.alive)
+			continue;
+
+		bool join = pass.graphics && open != nullptr;
+		for (size_t i = 0; join && i < open->passes.size(); i++)
+		{
+			for (const auto& earlier : passes[open->passes[i]].usages)
+			{
+				for (const auto& usage : pass.usages)
+				{
+					if (earlier.resource != usage.resource)
+						continue;
+
+					bool attachments = IsAttachment(earlier) && IsAttachment(usage);
+					bool reads = !earlier.write && !usage.write;
+					if (!attachments && !reads)
+						join = false;
+				}
+			}
+		}
+
+		if (!join)
+		{
+			Step step = {};
+			step.renderPass = VK_NULL_HANDLE;
+			step.renderPassIndex = invalidIndex;
+			steps.push_back(step);
+			open = pass.graphics ? &steps.back() : nullptr;
+		}
+
+		Step& step = steps.back();
+		pass.step = (uint32_t)steps.size() - 1;
+		pass.subpass = (uint32_t)step.passes.size();
+		step.passes.push_back(p);
+		step.name += (step.name.empty() ? "" : " + ") + pass.name;
+	}
+}
+
+//Lifetimes in steps, and the usage flags the owned images are created with
+void RenderGraph::AssignLifetimes()
+{
+	for (auto& resource : resources)
+	{
+		resource.firstStep = invalidIndex;
+		resource.lastStep = invalidIndex;
+		resource.usage = 0;
+		resource.transient = !resource.imported;
+	}
+
+	for (const auto& pass : passes)
+	{
+		if (!pass.alive)
+			continue;
+
+		for (const auto& usage : pass.usages)
+		{
+			Resource& resource = resources[usage.resource];
+			if (resource.firstStep == invalidIndex)
+				resource.firstStep = pass.step;
+			resource.lastStep = pass.step;
+
+			if (!IsAttachment(usage))
+				resource.transient = false;
+
+			if (usage.kind == UsageKind::Color || usage.kind == UsageKind::Resolve)
+				resource.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+			else if (usage.kind == UsageKind::Depth)
+				resource.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+			else if (usage.kind == UsageKind::Image)
+				resource.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+		}
+	}
+
+	//Never leaving one render pass, the image is never stored, and tiled GPUs may keep it in on-chip memory
+	for (auto& resource : resources)
+	{
+		if (resource.firstStep != resource.lastStep)
+			resource.transient = false;
+		if (resource.transient)
+			resource.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+	}
+}
+
+//Greedy interval packing. An image reuses the memory of one whose last step is over, preferring one of the same format and
+//sample count since it likely has the same size. Transient images only share with transient images, as lazily allocated memory
+//is limited to them
+void RenderGraph::AssignSlots()
+{
+	std::vector<RenderGraphResource> order;
+	for (RenderGraphResource r = 0; r < resources.size(); r++)
+	{
+		resources[r].slot = invalidIndex;
+		resources[r].previousInSlot = invalidIndex;
+		if (resources[r].image && !resources[r].imported && resources[r].firstStep != invalidIndex)
+			order.push_back(r);
+	}
+
+	std::stable_sort(order.begin(), order.end(), [this](RenderGraphResource a, RenderGraphResource b)
+	{
+		return resources[a].firstStep < resources[b].firstStep;
+	});
+
+	std::vector<RenderGraphResource> slotLast;		//Image that used each slot last
+	std::vector<RenderGraphResource> slotFirst;
+
+	for (RenderGraphResource r : order)
+	{
+		Resource& resource = resources[r];
+
+		uint32_t chosen = invalidIndex;
+		for (uint32_t slot = 0; slot < slotLast.size(); slot++)
+		{
+			const Resource& last = resources[slotLast[slot]];
+			if (last.lastStep >= resource.firstStep || last.transient != resource.transient)
+				continue;
+
+			bool sameShape = last.description.format == resource.description.format && last.description.samples == resource.description.samples;
+			if (chosen == invalidIndex || sameShape)
+				chosen = slot;
+			if (sameShape)
+				break;
+		}
+
+		if (chosen == invalidIndex)
+		{
+			chosen = (uint32_t)slotLast.size();
+			slotLast.push_back(r);
+			slotFirst.push_back(r);
+		}
+		else
+		{
+			resource.previousInSlot = slotLast[chosen];
+			slotLast[chosen] = r;
+		}
+
+		resource.slot = chosen;
+	}
+
+	//The first image of a slot follows the last one of the previous frame
+	for (uint32_t slot = 0; slot < slotFirst.size(); slot++)
+	{
+		resources[slotFirst[slot]].previousInSlot = slotLast[slot];
+	}
+
+	slotCount = (uint32_t)slotLast.size();
+}
+
+//Replays a frame, starting from the state the previous one ends in, to find every hazard
+void RenderGraph::DeriveSynchronization()
+{
+	std::vector<State> states(resources.size());
+	for (RenderGraphResource r = 0; r < resources.size(); r++)
+	{
+		if (resources[r].firstStep != invalidIndex)
+			states[r] = InitialState(r);
+	}
+
+	barrierCount = 0;
+	renderPassCount = 0;
+
+	for (uint32_t s = 0; s < steps.size(); s++)
+	{
+		Step& step = steps[s];
+
+		for (uint32_t subpass = 0; subpass < step.passes.size(); subpass++)
+		{
+			for (const auto& usage : passes[step.passes[subpass]].usages)
+			{
+				if (IsAttachment(usage))
+					continue;
+
+				State& state = states[usage.resource];
+				if (NeedsBarrier(state, usage, resources[usage.resource].image))
+					step.barriers.push_back(MakeBarrier(usage.resource, state, usage));
+				Access(state, usage, s, subpass);
+			}
+		}
+
+		barrierCount += (uint32_t)step.barriers.size();
+
+		if (passes[step.passes[0]].graphics)
+			CreateRenderPass(s, states);
+	}
+}
+
+//Owned images start undefined, after whatever used their memory last. Imported images start undefined too, once the frame's
+//wait for them has happened at readyStage. Buffers start as the frame leaves them
+RenderGraph::State RenderGraph::InitialState(RenderGraphResource resource) const
+{
+	State state = {};
+	state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	state.step = invalidIndex;
+	state.subpass = invalidIndex;
+
+	const Resource& current = resources[resource];
+	if (current.image && current.imported)
+	{
+		state.writeStages = current.readyStage;
+		state.readStages = current.readyStage;
+		return state;
+	}
+
+	RenderGraphResource previous = current.image ? current.previousInSlot : resource;
+	uint32_t lastStep = resources[previous].lastStep;
+
+	for (const auto& pass : passes)
+	{
+		if (!pass.alive || pass.step != lastStep)
+			continue;
+
+		for (const auto& usage : pass.usages)
+		{
+			if (usage.resource != previous)
+				continue;
+
+			state.writeStages |= usage.stages;
+			state.readStages |= usage.stages;
+			if (usage.write)
+				state.writeAccess |= usage.access & writeAccessMask;
+		}
+	}
+
+	state.defined = !current.image;
+	return state;
+}
+
+const RenderGraph::Usage* RenderGraph::FindNextUsage(RenderGraphResource resource, uint32_t afterStep) const
+{
+	for (uint32_t s = afterStep + 1; s < steps.size(); s++)
+	{
+		for (uint32_t p : steps[s].passes)
+		{
+			for (const auto& usage : passes[p].usages)
+			{
+				if (usage.resource == resource)
+					return &usage;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+//Writes and layout transitions wait for every earlier access. Reads only wait for a write they cannot see yet
+bool RenderGraph::NeedsBarrier(const State& state, const Usage& usage, bool image)
+{
+	if (image && usage.layout != state.layout)
+		return true;
+
+	if (usage.write)
+		return (state.writeStages | state.readStages) != 0;
+
+	return state.writeAccess != 0 && ((state.visibleStages & usage.stages) != usage.stages || (state.visibleAccess & usage.access) != usage.access);
+}
+
+RenderGraph::Barrier RenderGraph::MakeBarrier(RenderGraphResource resource, const State& state, const Usage& usage)
+{
+	bool transition = usage.layout != state.layout;
+
+	Barrier barrier = {};
+	barrier.resource = resource;
+	barrier.srcStages = usage.write || transition ? state.writeStages | state.readStages : state.writeStages;
+	barrier.srcAccess = state.writeAccess;
+	barrier.dstStages = usage.stages;
+	barrier.dstAccess = usage.access;
+	barrier.oldLayout = state.layout;
+	barrier.newLayout = usage.layout;
+
+	if (barrier.srcStages == 0)
+		barrier.srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	return barrier;
+}
+
+void RenderGraph::Access(State& state, const Usage& usage, uint32_t step, uint32_t subpass)
+{
+	bool transition = usage.layout != state.layout;
+
+	if (usage.write || transition)
+	{
+		state.writeStages = usage.stages;
+		state.writeAccess = usage.write ? usage.access & writeAccessMask : 0;
+		state.readStages = usage.write ? 0 : usage.stages;
+		state.visibleStages = usage.stages;
+		state.visibleAccess = usage.access;
+	}
+	else
+	{
+		state.readStages |= usage.stages;
+		state.visibleStages |= usage.stages;
+		state.visibleAccess |= usage.access;
+	}
+
+	if (usage.write)
+		state.defined = true;
+
+	state.layout = usage.layout;
+	state.step = step;
+	state.subpass = subpass;
+}
+
+//Attachments, subpasses and dependencies of a step of graphics passes. The barriers an attachment would need become subpass
+//dependencies, and a layout the attachment needs after the render pass is reached through finalLayout
+void RenderGraph::CreateRenderPass(uint32_t stepIndex, std::vector<State>& states)
+{
+	Step& step = steps[stepIndex];
+	uint32_t subpassCount = (uint32_t)step.passes.size();
+
+	std::vector<VkAttachmentDescription> attachments;
+	std::vector<uint32_t> attachmentIndices(resources.size(), invalidIndex);
+	std::vector<std::vector<bool>> usedIn;			//[attachment][subpass]
+	std::vector<VkSubpassDependency> dependencies;
+
+	//One dependency per pair of subpasses, with the masks of every hazard between them
+	auto addDependency = [&dependencies](uint32_t src, uint32_t dst, VkPipelineStageFlags srcStages, VkAccessFlags srcAccess,
+		VkPipelineStageFlags dstStages, VkAccessFlags dstAccess)
+	{
+		if (srcStages == 0)
+			srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+		for (auto& dependency : dependencies)
+		{
+			if (dependency.srcSubpass == src && dependency.dstSubpass == dst)
+			{
+				dependency.srcStageMask |= srcStages;
+				dependency.srcAccessMask |= srcAccess;
+				dependency.dstStageMask |= dstStages;
+				dependency.dstAccessMask |= dstAccess;
+				return;
+			}
+		}
+
+		VkSubpassDependency dependency = {};
+		dependency.srcSubpass = src;
+		dependency.dstSubpass = dst;
+		dependency.srcStageMask = srcStages;
+		dependency.srcAccessMask = srcAccess;
+		dependency.dstStageMask = dstStages;
+		dependency.dstAccessMask = dstAccess;
+
+		//Attachments are only ever accessed at their own pixel
+		if (src != VK_SUBPASS_EXTERNAL && dst != VK_SUBPASS_EXTERNAL)
+			dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+		dependencies.push_back(dependency);
+	};
+
+	std::vector<std::vector<VkAttachmentReference>> colorReferences(subpassCount);
+	std::vector<std::vector<VkAttachmentReference>> resolveReferences(subpassCount);
+	std::vector<VkAttachmentReference> depthReferences(subpassCount, { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED });
+
+	for (uint32_t subpass = 0; subpass < subpassCount; subpass++)
+	{
+		for (const auto& usage : passes[step.passes[subpass]].usages)
+		{
+			if (!IsAttachment(usage))
+				continue;
+
+			const Resource& resource = resources[usage.resource];
+			State& state = states[usage.resource];
+
+			uint32_t index = attachmentIndices[usage.resource];
+			if (index == invalidIndex)
+			{
+				//First use in the render pass. Contents are only loaded when something earlier wrote them and this use keeps them
+				bool load = state.defined && !usage.clear && usage.kind != UsageKind::Resolve;
+
+				VkAttachmentDescription attachment = {};
+				attachment.format = resource.description.format;
+				attachment.samples = resource.description.samples;
+				attachment.loadOp = usage.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				attachment.initialLayout = load ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+				attachment.finalLayout = usage.layout;
+
+				index = (uint32_t)attachments.size();
+				attachmentIndices[usage.resource] = index;
+				attachments.push_back(attachment);
+				usedIn.push_back(std::vector<bool>(subpassCount));
+				step.attachments.push_back(usage.resource);
+				step.clearValues.push_back(usage.clearValue);
+
+				//Whatever accessed it before, in an earlier step or the previous frame
+				addDependency(VK_SUBPASS_EXTERNAL, subpass, state.writeStages | state.readStages, state.writeAccess, usage.stages, usage.access);
+			}
+			else if (state.subpass != subpass)
+			{
+				addDependency(state.subpass, subpass, state.writeStages | state.readStages, state.writeAccess, usage.stages, usage.access);
+			}
+
+			VkAttachmentReference reference = { index, usage.layout };
+			if (usage.kind == UsageKind::Color)
+				colorReferences[subpass].push_back(reference);
+			else if (usage.kind == UsageKind::Resolve)
+				resolveReferences[subpass].push_back(reference);
+			else
+				depthReferences[subpass] = reference;
+
+			usedIn[index][subpass] = true;
+			Access(state, usage, stepIndex, subpass);
+		}
+
+		if (!resolveReferences[subpass].empty() && resolveReferences[subpass].size() != colorReferences[subpass].size())
+		{
+			throw std::runtime_error("render graph pass " + passes[step.passes[subpass]].name + " needs one resolve attachment per color attachment");
+		}
+	}
+
+	//How each attachment leaves the render pass
+	for (uint32_t index = 0; index < attachments.size(); index++)
+	{
+		RenderGraphResource r = step.attachments[index];
+		const Resource& resource = resources[r];
+		State& state = states[r];
+		VkAttachmentDescription& attachment = attachments[index];
+
+		const Usage* next = FindNextUsage(r, stepIndex);
+		if (next == nullptr && resource.output)
+		{
+			//Handed over to presentation or a read back. The semaphore or fence of the submit orders it
+			attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			attachment.finalLayout = resource.finalLayout;
+			state.layout = resource.finalLayout;
+		}
+		else if (next != nullptr)
+		{
+			attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+			//A later read gets its layout and visibility from the end of the render pass, instead of from a barrier
+			if (!next->write)
+			{
+				addDependency(state.subpass, VK_SUBPASS_EXTERNAL, state.writeStages | state.readStages, state.writeAccess, next->stages, next->access);
+				attachment.finalLayout = next->layout;
+				state.layout = next->layout;
+				state.visibleStages |= next->stages;
+				state.visibleAccess |= next->access;
+			}
+		}
+		else if (resource.imported)
+		{
+			attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		}
+	}
+
+	//Attachments used before and after a subpass have to be preserved through it
+	std::vector<std::vector<uint32_t>> preserveReferences(subpassCount);
+	for (uint32_t index = 0; index < attachments.size(); index++)
+	{
+		uint32_t first = invalidIndex;
+		uint32_t last = invalidIndex;
+		for (uint32_t subpass = 0; subpass < subpassCount; subpass++)
+		{
+			if (!usedIn[index][subpass])
+				continue;
+			if (first == invalidIndex)
+				first = subpass;
+			last = subpass;
+		}
+
+		for (uint32_t subpass = first + 1; subpass < last; subpass++)
+		{
+			if (!usedIn[index][subpass])
+				preserveReferences[subpass].push_back(index);
+		}
+	}
+
+	std::vector<VkSubpassDescription> subpasses(subpassCount);
+	for (uint32_t subpass = 0; subpass < subpassCount; subpass++)
+	{
+		VkSubpassDescription& description = subpasses[subpass];
+		description.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		description.colorAttachmentCount = (uint32_t)colorReferences[subpass].size();
+		description.pColorAttachments = colorReferences[subpass].data();
+		description.pResolveAttachments = resolveReferences[subpass].empty() ? nullptr : resolveReferences[subpass].data();
+		description.pDepthStencilAttachment = depthReferences[subpass].attachment != VK_ATTACHMENT_UNUSED ? &depthReferences[subpass] : nullptr;
+		description.preserveAttachmentCount = (uint32_t)preserveReferences[subpass].size();
+		description.pPreserveAttachments = preserveReferences[subpass].data();
+	}
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = (uint32_t)attachments.size();
+	renderPassInfo.pAttachments = attachments.data();
+	renderPassInfo.subpassCount = subpassCount;
+	renderPassInfo.pSubpasses = subpasses.data();
+	renderPassInfo.dependencyCount = (uint32_t)dependencies.size();
+	renderPassInfo.pDependencies = dependencies.data();
+
+	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &step.renderPass) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create render graph render pass");
+	}
+
+	step.renderPassIndex = renderPassCount++;
+}
+
+RenderGraphTargets RenderGraph::CreateTargets(VkExtent2D extent, const std::vector<std::vector<RenderGraphImportedImage>>& importedImages)
+{
+	RenderGraphTargets targets;
+	targets.extent = extent;
+	targets.images.resize(resources.size(), VK_NULL_HANDLE);
+	targets.views.resize(resources.size(), VK_NULL_HANDLE);
+	targets.importedImages = importedImages;
+	if (targets.importedImages.empty())
+		targets.importedImages.resize(1);
+
+	//Every image of a slot has to fit the slot's memory and accept its memory type
+	std::vector<VkMemoryRequirements> requirements(resources.size());
+	std::vector<VkMemoryRequirements> slotRequirements(slotCount);
+	std::vector<bool> slotTransient(slotCount);
+	std::vector<uint32_t> slots(resources.size(), invalidIndex);
+
+	for (uint32_t slot = 0; slot < slotCount; slot++)
+	{
+		slotRequirements[slot].memoryTypeBits = ~0u;
+	}
+
+	for (RenderGraphResource r = 0; r < resources.size(); r++)
+	{
+		const Resource& resource = resources[r];
+		if (resource.slot == invalidIndex)
+			continue;
+
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = resource.description.format;
+		imageInfo.extent = { extent.width, extent.height, 1 };
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = resource.description.samples;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = resource.usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		if (vkCreateImage(device, &imageInfo, nullptr, &targets.images[r]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create render graph image " + resource.name);
+		}
+
+		vkGetImageMemoryRequirements(device, targets.images[r], &requirements[r]);
+
+		//An image with no memory type in common with its slot gets memory of its own. The barriers assumed the sharing, so they only over-synchronize
+		uint32_t slot = resource.slot;
+		if ((slotRequirements[slot].memoryTypeBits & requirements[r].memoryTypeBits) == 0)
+		{
+			slot = (uint32_t)slotRequirements.size();
+			slotRequirements.push_back(VkMemoryRequirements());
+			slotRequirements[slot].memoryTypeBits = ~0u;
+			slotTransient.push_back(false);
+		}
+
+		slots[r] = slot;
+		slotRequirements[slot].size = std::max(slotRequirements[slot].size, requirements[r].size);
+		slotRequirements[slot].alignment = std::max(slotRequirements[slot].alignment, requirements[r].alignment);
+		slotRequirements[slot].memoryTypeBits &= requirements[r].memoryTypeBits;
+		slotTransient[slot] = resource.transient;
+	}
+
+	//Lazily allocated memory is preferred for transient attachments, and only committed for what spills out of tile memory
+	for (size_t slot = 0; slot < slotRequirements.size(); slot++)
+	{
+		MemoryAllocation memory = allocator->Allocate(slotRequirements[slot], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			slotTransient[slot] ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0, ResourceKind::Optimal);
+		targets.memory.push_back(memory);
+		targets.lazilyAllocated.push_back((allocator->GetMemoryProperties().memoryTypes[memory.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0);
+	}
+
+	for (RenderGraphResource r = 0; r < resources.size(); r++)
+	{
+		if (targets.images[r] == VK_NULL_HANDLE)
+			continue;
+
+		const MemoryAllocation& memory = targets.memory[slots[r]];
+		if (vkBindImageMemory(device, targets.images[r], memory.memory, memory.offset) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to bind render graph image " + resources[r].name);
+		}
+
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = targets.images[r];
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = resources[r].description.format;
+		viewInfo.subresourceRange.aspectMask = resources[r].description.aspect;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		if (vkCreateImageView(device, &viewInfo, nullptr, &targets.views[r]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create render graph image view " + resources[r].name);
+		}
+	}
+
+	//One framebuffer per render pass and variant, with the variant's imported images
+	targets.framebuffers.resize(targets.importedImages.size());
+	for (size_t variant = 0; variant < targets.importedImages.size(); variant++)
+	{
+		for (const auto& step : steps)
+		{
+			if (step.renderPass == VK_NULL_HANDLE)
+				continue;
+
+			std::vector<VkImageView> views;
+			for (RenderGraphResource r : step.attachments)
+			{
+				views.push_back(resources[r].imported ? targets.importedImages[variant][resources[r].importIndex].view : targets.views[r]);
+			}
+
+			VkFramebufferCreateInfo framebufferInfo = {};
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = step.renderPass;
+			framebufferInfo.attachmentCount = (uint32_t)views.size();
+			framebufferInfo.pAttachments = views.data();
+			framebufferInfo.width = extent.width;
+			framebufferInfo.height = extent.height;
+			framebufferInfo.layers = 1;
+
+			VkFramebuffer framebuffer;
+			if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create render graph framebuffer");
+			}
+			targets.framebuffers[variant].push_back(framebuffer);
+		}
+	}
+
+	return targets;
+}
+
+void RenderGraph::DestroyTargets(RenderGraphTargets& targets)
+{
+	for (const auto& framebuffers : targets.framebuffers)
+	{
+		for (auto framebuffer : framebuffers)
+		{
+			vkDestroyFramebuffer(device, framebuffer, nullptr);
+		}
+	}
+
+	for (size_t i = 0; i < targets.images.size(); i++)
+	{
+		if (targets.images[i] == VK_NULL_HANDLE)
+			continue;
+
+		vkDestroyImageView(device, targets.views[i], nullptr);
+		vkDestroyImage(device, targets.images[i], nullptr);
+	}
+
+	for (auto& memory : targets.memory)
+	{
+		allocator->Free(memory);
+	}
+
+	targets = RenderGraphTargets();
+}
+
+void RenderGraph::Execute(VkCommandBuffer commandBuffer, const RenderGraphTargets& targets, uint32_t variant, const RenderGraphMarkers& markers) const
+{
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+
+	for (const auto& step : steps)
+	{
+		//All of a step's barriers go into one call
+		if (!step.barriers.empty())
+		{
+			bufferBarriers.clear();
+			imageBarriers.clear();
+			VkPipelineStageFlags srcStages = 0;
+			VkPipelineStageFlags dstStages = 0;
+
+			for (const auto& barrier : step.barriers)
+			{
+				const Resource& resource = resources[barrier.resource];
+				srcStages |= barrier.srcStages;
+				dstStages |= barrier.dstStages;
+
+				if (!resource.image)
+				{
+					VkBufferMemoryBarrier bufferBarrier = {};
+					bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+					bufferBarrier.srcAccessMask = barrier.srcAccess;
+					bufferBarrier.dstAccessMask = barrier.dstAccess;
+					bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					bufferBarrier.buffer = resource.buffer;
+					bufferBarrier.offset = 0;
+					bufferBarrier.size = VK_WHOLE_SIZE;
+					bufferBarriers.push_back(bufferBarrier);
+					continue;
+				}
+
+				VkImageMemoryBarrier imageBarrier = {};
+				imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				imageBarrier.srcAccessMask = barrier.srcAccess;
+				imageBarrier.dstAccessMask = barrier.dstAccess;
+				imageBarrier.oldLayout = barrier.oldLayout;
+				imageBarrier.newLayout = barrier.newLayout;
+				imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageBarrier.image = resource.imported ? targets.importedImages[variant][resource.importIndex].image : targets.images[barrier.resource];
+				imageBarrier.subresourceRange = { resource.description.aspect, 0, 1, 0, 1 };
+				imageBarriers.push_back(imageBarrier);
+			}
+
+			vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, nullptr, (uint32_t)bufferBarriers.size(), bufferBarriers.data(),
+				(uint32_t)imageBarriers.size(), imageBarriers.data());
+		}
+
+		if (step.renderPass == VK_NULL_HANDLE)
+		{
+			const Pass& pass = passes[step.passes[0]];
+			if (markers.begin)
+				markers.begin(commandBuffer, step.name.c_str());
+			pass.record(commandBuffer);
+			if (markers.end)
+				markers.end(commandBuffer);
+			continue;
+		}
+
+		VkRenderPassBeginInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = step.renderPass;
+		renderPassInfo.framebuffer = targets.framebuffers[variant][step.renderPassIndex];
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = targets.extent;
+		renderPassInfo.clearValueCount = (uint32_t)step.clearValues.size();
+		renderPassInfo.pClearValues = step.clearValues.data();
+
+		if (markers.begin)
+			markers.begin(commandBuffer, step.name.c_str());
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, passes[step.passes[0]].contents);
+
+		for (size_t i = 0; i < step.passes.size(); i++)
+		{
+			const Pass& pass = passes[step.passes[i]];
+			if (i > 0)
+				vkCmdNextSubpass(commandBuffer, pass.contents);
+			pass.record(commandBuffer);
+		}
+
+		vkCmdEndRenderPass(commandBuffer);
+		if (markers.end)
+			markers.end(commandBuffer);
+	}
+}
+
+VkRenderPass RenderGraph::GetRenderPass(RenderGraphPass pass) const
+{
+	return passes[pass].alive ? steps[passes[pass].step].renderPass : VK_NULL_HANDLE;
+}
+
+uint32_t RenderGraph::GetSubpass(RenderGraphPass pass) const
+{
+	return passes[pass].subpass;
+}
+
+VkFramebuffer RenderGraph::GetFramebuffer(const RenderGraphTargets& targets, RenderGraphPass pass, uint32_t variant) const
+{
+	if (!passes[pass].alive)
+		return VK_NULL_HANDLE;
+
+	return targets.framebuffers[variant][steps[passes[pass].step].renderPassIndex];
+}
+
+//Call with the device idle, after rendering, so the committed sizes of lazily allocated memory are final
+void RenderGraph::PrintReport(const RenderGraphTargets& targets, std::ostream& out) const
+{
+	const double mebibyte = 1024.0 * 1024.0;
+
+	out << "render graph: " << passes.size() - culledPassCount << " of " << passes.size() << " passes kept, " << renderPassCount
+		<< " render passes, " << barrierCount << " barriers per frame" << std::endl;
+
+	out << "render targets at " << targets.extent.width << "x" << targets.extent.height << ":" << std::endl;
+
+	VkDeviceSize unaliasedBytes = 0;
+	for (RenderGraphResource r = 0; r < resources.size(); r++)
+	{
+		if (targets.images[r] == VK_NULL_HANDLE)
+			continue;
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, targets.images[r], &requirements);
+		unaliasedBytes += requirements.size;
+
+		out << "  " << resources[r].name << ": " << requirements.size / mebibyte << " MiB, " << (uint32_t)resources[r].description.samples << "x, slot "
+			<< resources[r].slot << (resources[r].transient ? ", transient" : "") << std::endl;
+	}
+
+	if (targets.memory.empty())
+	{
+		out << "  none" << std::endl;
+		return;
+	}
+
+	//Lazily allocated memory only reports what the driver actually had to back
+	VkDeviceSize allocatedBytes = 0;
+	VkDeviceSize committedBytes = 0;
+	for (size_t slot = 0; slot < targets.memory.size(); slot++)
+	{
+		VkDeviceSize committed = targets.memory[slot].size;
+		if (targets.lazilyAllocated[slot])
+			vkGetDeviceMemoryCommitment(device, targets.memory[slot].memory, &committed);
+
+		allocatedBytes += targets.memory[slot].size;
+		committedBytes += std::min(committed, targets.memory[slot].size);
+	}
+
+	out << "  " << unaliasedBytes / mebibyte << " MiB of images in " << targets.memory.size() << " memory slots of " << allocatedBytes / mebibyte
+		<< " MiB, " << committedBytes / mebibyte << " MiB committed" << std::endl;
+}
@@ -0,0 +1,232 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <functional>
+#include <ostream>
+#include "MemoryAllocator.h"
+
+typedef uint32_t RenderGraphResource;
+typedef uint32_t RenderGraphPass;
+
+//Per frame images the graph creates at the extent given to CreateTargets(), only alive between their first and last use
+struct RenderGraphImageDescription
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+};
+
+//An image the graph does not own, such as a swap chain image. Which one is used is picked per frame by the variant
+struct RenderGraphImportedImage
+{
+	VkImage image = VK_NULL_HANDLE;
+	VkImageView view = VK_NULL_HANDLE;
+};
+
+//Images, views and framebuffers of a compiled graph at one extent. Replaced as a whole when the extent changes
+struct RenderGraphTargets
+{
+	VkExtent2D extent = {};
+	std::vector<VkImage> images;			//Indexed by resource, VK_NULL_HANDLE for buffers and imported images
+	std::vector<VkImageView> views;
+	std::vector<MemoryAllocation> memory;	//One per aliasing slot, shared by the images whose lifetimes never overlap
+	std::vector<bool> lazilyAllocated;		//Per slot
+	std::vector<std::vector<RenderGraphImportedImage>> importedImages;	//[variant][imported image]
+	std::vector<std::vector<VkFramebuffer>> framebuffers;				//[variant][render pass]
+};
+
+//Optional, called around each render pass and each pass recorded outside one, e.g. for debug labels and GPU timing scopes.
+//The names stay valid until the graph is destroyed
+struct RenderGraphMarkers
+{
+	std::function<void(VkCommandBuffer, const char*)> begin;
+	std::function<void(VkCommandBuffer)> end;
+};
+
+//Describes a frame as passes that declare which images and buffers they read and write, in execution order. Compile() then:
+//- culls passes whose results nothing reads, unless they have side effects
+//- merges consecutive graphics passes into the subpasses of one render pass where nothing they sample was written inside it
+//- derives load and store ops, layouts, subpass dependencies and the pipeline barriers between passes. A barrier is only
+//  recorded for a hazard, so reads of data already visible to them are free
+//- assigns the images it owns to memory slots, so images whose lifetimes within the frame never overlap share memory
+//Every frame starts with the resources in the state the previous frame left them in, so no hazard across frames is missed.
+//The graph only synchronizes the queue it is recorded on, work on other queues is handed over with semaphores as before.
+class RenderGraph
+{
+public:
+	static const uint32_t invalidIndex = ~0u;
+
+	RenderGraph();
+	~RenderGraph();
+
+	RenderGraph(const RenderGraph&) = delete;
+	RenderGraph& operator=(const RenderGraph&) = delete;
+
+	void Initialize(VkDevice device, MemoryAllocator& allocator);
+
+	//Destroys the render passes and forgets the declarations. Targets have to be destroyed separately
+	void Destroy();
+
+	//Resources. Output images count as read after the frame and are left in finalLayout
+	RenderGraphResource CreateImage(const std::string& name, const RenderGraphImageDescription& description);
+	RenderGraphResource ImportImage(const std::string& name, VkFormat format, VkSampleCountFlagBits samples, VkImageLayout finalLayout,
+		VkPipelineStageFlags readyStage, bool output);
+	RenderGraphResource ImportBuffer(const std::string& name);
+	void BindBuffer(RenderGraphResource resource, VkBuffer buffer);
+
+	//Passes, recorded in the order they are added. Graphics passes need at least one attachment
+	RenderGraphPass AddGraphicsPass(const std::string& name, VkSubpassContents contents, std::function<void(VkCommandBuffer)> record);
+	RenderGraphPass AddComputePass(const std::string& name, std::function<void(VkCommandBuffer)> record);
+	void SetSideEffects(RenderGraphPass pass);
+
+	//Attachments. Without a clear value the previous contents are loaded when there are any.
+	//Resolve attachments pair up with the color attachments in the order both were added
+	void WriteColor(RenderGraphPass pass, RenderGraphResource resource);
+	void WriteColor(RenderGraphPass pass, RenderGraphResource resource, const VkClearColorValue& clear);
+	void WriteDepth(RenderGraphPass pass, RenderGraphResource resource);
+	void WriteDepth(RenderGraphPass pass, RenderGraphResource resource, const VkClearDepthStencilValue& clear);
+	void WriteResolve(RenderGraphPass pass, RenderGraphResource resource);
+
+	//Shader and transfer accesses
+	void ReadImage(RenderGraphPass pass, RenderGraphResource resource, VkPipelineStageFlags stages);
+	void ReadBuffer(RenderGraphPass pass, RenderGraphResource resource, VkPipelineStageFlags stages, VkAccessFlags access);
+	void WriteBuffer(RenderGraphPass pass, RenderGraphResource resource, VkPipelineStageFlags stages, VkAccessFlags access);
+
+	//Call once everything is declared, before anything below
+	void Compile();
+
+	//importedImages[variant] holds the images of every imported image resource, in the order they were imported
+	RenderGraphTargets CreateTargets(VkExtent2D extent, const std::vector<std::vector<RenderGraphImportedImage>>& importedImages);
+	void DestroyTargets(RenderGraphTargets& targets);
+
+	void Execute(VkCommandBuffer commandBuffer, const RenderGraphTargets& targets, uint32_t variant, const RenderGraphMarkers& markers = RenderGraphMarkers()) const;
+
+	//For pipelines and secondary command buffers. VK_NULL_HANDLE when the pass was culled
+	VkRenderPass GetRenderPass(RenderGraphPass pass) const;
+	uint32_t GetSubpass(RenderGraphPass pass) const;
+	VkFramebuffer GetFramebuffer(const RenderGraphTargets& targets, RenderGraphPass pass, uint32_t variant) const;
+	bool IsCulled(RenderGraphPass pass) const { return !passes[pass].alive; }
+
+	//Passes culled, barriers per frame, and what the owned images cost with and without aliasing
+	void PrintReport(const RenderGraphTargets& targets, std::ostream& out) const;
+
+private:
+	enum class UsageKind
+	{
+		Color,
+		Depth,
+		Resolve,
+		Image,
+		Buffer
+	};
+
+	struct Usage
+	{
+		RenderGraphResource resource;
+		UsageKind kind;
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		VkImageLayout layout;				//VK_IMAGE_LAYOUT_UNDEFINED for buffers
+		bool write;
+		bool clear;
+		VkClearValue clearValue;
+	};
+
+	struct Resource
+	{
+		std::string name;
+		bool image;
+		bool imported;
+		bool output;
+		RenderGraphImageDescription description;
+		VkImageLayout finalLayout;			//Imported images
+		VkPipelineStageFlags readyStage;	//Imported images, where the frame's wait for them happens
+		uint32_t importIndex;				//Among the imported images
+		VkBuffer buffer;
+		VkImageUsageFlags usage;			//Derived from the declared uses
+		bool transient;						//Only ever an attachment of one render pass, and never stored
+		uint32_t firstStep;					//Lifetime within the frame, invalidIndex when no alive pass uses it
+		uint32_t lastStep;
+		uint32_t slot;						//Memory slot of owned images
+		uint32_t previousInSlot;			//Owned image that used the slot's memory last, possibly in the previous frame
+	};
+
+	struct Pass
+	{
+		std::string name;
+		bool graphics;
+		VkSubpassContents contents;
+		std::function<void(VkCommandBuffer)> record;
+		std::vector<Usage> usages;
+		bool sideEffects;
+		bool alive;
+		uint32_t step;						//Step recording the pass
+		uint32_t subpass;
+	};
+
+	//Access state of a resource while the frame is replayed at compile time
+	struct State
+	{
+		VkImageLayout layout;
+		VkPipelineStageFlags writeStages;	//Of the last write, or of the layout transition
+		VkAccessFlags writeAccess;
+		VkPipelineStageFlags readStages;	//Reads since then, which the next write has to wait for
+		VkPipelineStageFlags visibleStages;	//Stages and accesses the last write has been made visible to
+		VkAccessFlags visibleAccess;
+		bool defined;						//Holds contents written this frame, or kept from an earlier one
+		uint32_t step;						//Step of the last access, and subpass when it was inside a render pass
+		uint32_t subpass;
+	};
+
+	struct Barrier
+	{
+		RenderGraphResource resource;
+		VkPipelineStageFlags srcStages;
+		VkAccessFlags srcAccess;
+		VkPipelineStageFlags dstStages;
+		VkAccessFlags dstAccess;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+	};
+
+	//A render pass, or a single pass recorded outside one. Barriers are recorded before it begins
+	struct Step
+	{
+		std::string name;					//Of its passes
+		std::vector<uint32_t> passes;
+		std::vector<Barrier> barriers;
+		VkRenderPass renderPass;
+		uint32_t renderPassIndex;			//Into RenderGraphTargets::framebuffers
+		std::vector<RenderGraphResource> attachments;
+		std::vector<VkClearValue> clearValues;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	std::vector<Step> steps;
+	uint32_t importedImageCount = 0;
+	uint32_t slotCount = 0;
+	uint32_t renderPassCount = 0;
+	uint32_t culledPassCount = 0;
+	uint32_t barrierCount = 0;
+
+	void AddUsage(RenderGraphPass pass, RenderGraphResource resource, UsageKind kind, VkPipelineStageFlags stages, VkAccessFlags access,
+		VkImageLayout layout, bool write, const VkClearValue* clear);
+
+	void CullPasses();
+	void BuildSteps();
+	void AssignLifetimes();
+	void AssignSlots();
+	void DeriveSynchronization();
+	void CreateRenderPass(uint32_t stepIndex, std::vector<State>& states);
+	State InitialState(RenderGraphResource resource) const;
+	const Usage* FindNextUsage(RenderGraphResource resource, uint32_t afterStep) const;
+	bool IsAttachment(const Usage& usage) const { return usage.kind == UsageKind::Color || usage.kind == UsageKind::Depth || usage.kind == UsageKind::Resolve; }
+	static bool NeedsBarrier(const State& state, const Usage& usage, bool image);
+	static Barrier MakeBarrier(RenderGraphResource resource, const State& state, const Usage& usage);
+	static void Access(State& state, const Usage& usage, uint32_t step, uint32_t subpass);
+};
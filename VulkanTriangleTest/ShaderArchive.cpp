@@ -0,0 +1,196 @@
+#include "ShaderArchive.h"
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <stdexcept>
+#include <cstring>
+
+
+ShaderArchive::ShaderArchive()
+{
+}
+
+
+ShaderArchive::~ShaderArchive()
+{
+	Close();
+}
+
+void ShaderArchive::Open(const std::string & filename)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("failed to open shader archive " + filename);
+	}
+	fileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		Close();
+		throw std::runtime_error("failed to read the size of shader archive " + filename);
+	}
+
+	mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void* view = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (view == nullptr)
+	{
+		Close();
+		throw std::runtime_error("failed to map shader archive " + filename);
+	}
+
+	size = (size_t)fileSize.QuadPart;
+	data = static_cast<const uint8_t*>(view);
+#else
+	fileDescriptor = open(filename.c_str(), O_RDONLY);
+	if (fileDescriptor < 0)
+	{
+		throw std::runtime_error("failed to open shader archive " + filename);
+	}
+
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		Close();
+		throw std::runtime_error("failed to read the size of shader archive " + filename);
+	}
+
+	void* view = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+	if (view == MAP_FAILED)
+	{
+		Close();
+		throw std::runtime_error("failed to map shader archive " + filename);
+	}
+
+	size = (size_t)fileStat.st_size;
+	data = static_cast<const uint8_t*>(view);
+#endif
+
+	Validate();
+}
+
+void ShaderArchive::OpenMemory(const void * archiveData, size_t archiveSize)
+{
+	Close();
+
+	data = static_cast<const uint8_t*>(archiveData);
+	size = archiveSize;
+
+	Validate();
+}
+
+void ShaderArchive::Close()
+{
+#ifdef _WIN32
+	if (mappingHandle != nullptr)
+	{
+		if (data != nullptr)
+			UnmapViewOfFile(data);
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle != nullptr)
+		CloseHandle(fileHandle);
+
+	fileHandle = nullptr;
+	mappingHandle = nullptr;
+#else
+	if (fileDescriptor >= 0)
+	{
+		if (data != nullptr)
+			munmap(const_cast<uint8_t*>(data), size);
+		close(fileDescriptor);
+	}
+
+	fileDescriptor = -1;
+#endif
+
+	data = nullptr;
+	size = 0;
+	table = nullptr;
+	tableMask = 0;
+}
+
+ShaderCode ShaderArchive::Find(const char * name) const
+{
+	uint64_t nameHash = HashName(name);
+
+	//Open addressing with linear probing. An all zero entry ends the probe sequence
+	for (uint32_t slot = (uint32_t)nameHash & tableMask;; slot = (slot + 1) & tableMask)
+	{
+		const Entry& entry = table[slot];
+
+		if (entry.nameHash == nameHash)
+		{
+			ShaderCode shader;
+			shader.code = reinterpret_cast<const uint32_t*>(data + entry.offset);
+			shader.size = entry.size;
+			return shader;
+		}
+
+		if (entry.nameHash == 0)
+		{
+			throw std::runtime_error(std::string("shader not found in archive: ") + name);
+		}
+	}
+}
+
+void ShaderArchive::Validate()
+{
+	const uint32_t spirvMagic = 0x07230203;
+
+	Header header;
+	if (size < sizeof(Header))
+	{
+		Close();
+		throw std::runtime_error("shader archive is truncated");
+	}
+	memcpy(&header, data, sizeof(Header));
+
+	//The table size must be a power of two. Its entry count is only a first check, the free slot is counted below
+	if (memcmp(header.magic, "SPVA", 4) != 0 || header.version != 1 ||
+		header.tableSize == 0 || (header.tableSize & (header.tableSize - 1)) != 0 || header.entryCount >= header.tableSize ||
+		sizeof(Header) + (size_t)header.tableSize * sizeof(Entry) > size)
+	{
+		Close();
+		throw std::runtime_error("shader archive header is invalid");
+	}
+
+	table = reinterpret_cast<const Entry*>(data + sizeof(Header));
+	tableMask = header.tableSize - 1;
+
+	uint32_t usedSlots = 0;
+	for (uint32_t i = 0; i < header.tableSize; i++)
+	{
+		const Entry& entry = table[i];
+		if (entry.nameHash == 0)
+			continue;
+
+		usedSlots++;
+
+		//vkCreateShaderModule needs 4 byte aligned code made of whole words, starting with the SPIR-V magic number
+		if (entry.offset % 4 != 0 || entry.size < 4 || entry.size % 4 != 0 || (size_t)entry.offset + entry.size > size ||
+			*reinterpret_cast<const uint32_t*>(data + entry.offset) != spirvMagic)
+		{
+			Close();
+			throw std::runtime_error("shader archive entry is invalid");
+		}
+	}
+
+	//Without an empty slot to end the probe sequence, looking up a missing name would never terminate
+	if (usedSlots >= header.tableSize)
+	{
+		Close();
+		throw std::runtime_error("shader archive table has no free slot");
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+//A SPIR-V module inside the archive. The pointer refers straight into the mapped (or embedded) archive
+struct ShaderCode
+{
+	const uint32_t* code = nullptr;
+	size_t size = 0;						//Size in bytes
+};
+
+//Read-only view of the archive written by Shaders/pack_shaders.py.
+//The file is memory mapped once and modules are handed out in place, without copying or allocating.
+class ShaderArchive
+{
+public:
+	ShaderArchive();
+	~ShaderArchive();
+
+	ShaderArchive(const ShaderArchive&) = delete;
+	ShaderArchive& operator=(const ShaderArchive&) = delete;
+
+	//Maps an archive file
+	void Open(const std::string& filename);
+
+	//Uses an archive that is already in memory, e.g. the constexpr data from ShaderArchiveData.h. The memory must outlive the archive
+	void OpenMemory(const void* archiveData, size_t archiveSize);
+
+	void Close();
+
+	//Returns the module packed under the given file name, e.g. "vert.spv". Throws if it is not in the archive
+	ShaderCode Find(const char* name) const;
+
+	//64 bit FNV-1a, must match fnv1a64() in pack_shaders.py
+	static constexpr uint64_t HashName(const char* name)
+	{
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (; *name; name++)
+		{
+			hash ^= (uint8_t)*name;
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+private:
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t entryCount;
+		uint32_t tableSize;
+	};
+
+	struct Entry
+	{
+		uint64_t nameHash;
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	const Entry* table = nullptr;
+	uint32_t tableMask = 0;
+
+	//Platform mapping handles, only set when the archive was opened from a file
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#else
+	int fileDescriptor = -1;
+#endif
+
+	//Checks the header and every table entry so Find() can trust the offsets
+	void Validate();
+};
@@ -0,0 +1,42 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(set = 0, binding = 0) uniform FrameUniforms {
+    mat4 transform;
+    mat4 viewProjection;
+} frame;
+
+//The descriptor heap, see DescriptorHeap.h. Both views alias the storage buffer array of binding 0
+layout(std430, set = 1, binding = 0) readonly buffer InstanceTransforms { vec4 transforms[]; } transformBuffers[];
+layout(std430, set = 1, binding = 0) readonly buffer InstanceColors { uint colors[]; } colorBuffers[];
+
+//Must match DrawHandles in TriangleApplication.h
+layout(push_constant) uniform DrawHandles {
+    uint transformBuffer;
+    uint colorBuffer;
+} handles;
+
+//Per vertex
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    //Same as instanced.vert, with the instance data read from the heap slots of this draw
+    vec4 instanceTransform = transformBuffers[handles.transformBuffer].transforms[gl_InstanceIndex];
+    vec4 instanceColor = unpackUnorm4x8(colorBuffers[handles.colorBuffer].colors[gl_InstanceIndex]);
+
+    vec2 position = (frame.transform * vec4(inPosition, 0.0, 1.0)).xy;
+    float c = cos(instanceTransform.w);
+    float s = sin(instanceTransform.w);
+    position = mat2(c, s, -s, c) * position * instanceTransform.z + instanceTransform.xy;
+
+    gl_Position = frame.viewProjection * vec4(position, 0.0, 1.0);
+    fragColor = inColor * instanceColor.rgb;
+}
\ No newline at end of file
@@ -1,3 +1,10 @@
-C:/VulkanSDK/1.1.70.1/Bin32/glslangValidator.exe -V C:/Users/ruchi/Desktop/Graphics/VulkanTriangleTest/Shaders/shader.vert
-C:/VulkanSDK/1.1.70.1/Bin32/glslangValidator.exe -V C:/Users/ruchi/Desktop/Graphics/VulkanTriangleTest/Shaders/shaders.frag
-pause
\ No newline at end of file
+cd /d %~dp0
+C:/VulkanSDK/1.1.77.0/Bin32/glslangValidator.exe -V shader.vert
+C:/VulkanSDK/1.1.77.0/Bin32/glslangValidator.exe -V -DDRAW_UNIFORMS shader.vert -o vert_uniforms.spv
+C:/VulkanSDK/1.1.77.0/Bin32/glslangValidator.exe -V shaders.frag
+C:/VulkanSDK/1.1.77.0/Bin32/glslangValidator.exe -V textured.frag -o textured.spv
+C:/VulkanSDK/1.1.77.0/Bin32/glslangValidator.exe -V instanced.vert -o instanced.spv
+C:/VulkanSDK/1.1.77.0/Bin32/glslangValidator.exe -V cull.comp -o cull.spv
+C:/VulkanSDK/1.1.77.0/Bin32/glslangValidator.exe -V bindless.vert -o bindless.spv
+python pack_shaders.py shaders.pak --header ShaderArchiveData.h vert.spv vert_uniforms.spv frag.spv instanced.spv cull.spv bindless.spv textured.spv
+pause
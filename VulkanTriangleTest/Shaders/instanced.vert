@@ -0,0 +1,32 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(set = 0, binding = 0) uniform FrameUniforms {
+    mat4 transform;
+    mat4 viewProjection;
+} frame;
+
+//Per vertex
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+//Per instance, each from its own array
+layout(location = 2) in vec4 instanceTransform;    //xy offset, z scale, w rotation in radians
+layout(location = 3) in vec4 instanceColor;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    //Spin every instance in place, then rotate, scale and move it to its spot
+    vec2 position = (frame.transform * vec4(inPosition, 0.0, 1.0)).xy;
+    float c = cos(instanceTransform.w);
+    float s = sin(instanceTransform.w);
+    position = mat2(c, s, -s, c) * position * instanceTransform.z + instanceTransform.xy;
+
+    gl_Position = frame.viewProjection * vec4(position, 0.0, 1.0);
+    fragColor = inColor * instanceColor.rgb;
+}
\ No newline at end of file
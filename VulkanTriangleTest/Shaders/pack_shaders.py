@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+# Packs compiled SPIR-V modules into a single archive that ShaderArchive maps at runtime.
+#
+# Layout (little endian):
+#   header  : char magic[4] = "SPVA", uint32 version, uint32 entryCount, uint32 tableSize (power of two)
+#   table   : tableSize x { uint64 nameHash, uint32 offset, uint32 size }, open addressing with linear probing,
+#             empty slots are all zero
+#   modules : SPIR-V words, each module starting on a 16 byte boundary
+#
+# Modules are looked up by the 64 bit FNV-1a hash of their file name, e.g. "vert.spv".
+#
+# usage: pack_shaders.py output.pak [--header ShaderArchiveData.h] module.spv...
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b"SPVA"
+VERSION = 1
+HEADER_SIZE = 16
+ENTRY_SIZE = 16
+MODULE_ALIGNMENT = 16
+SPIRV_MAGIC = 0x07230203
+
+
+def fnv1a64(name):
+    h = 0xcbf29ce484222325
+    for byte in name.encode("utf-8"):
+        h ^= byte
+        h = (h * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+
+def align(value, alignment):
+    return (value + alignment - 1) & ~(alignment - 1)
+
+
+def pack(paths):
+    modules = []
+    for path in paths:
+        with open(path, "rb") as f:
+            code = f.read()
+        if len(code) < 4 or len(code) % 4 != 0 or struct.unpack_from("<I", code)[0] != SPIRV_MAGIC:
+            sys.exit("%s is not a SPIR-V module" % path)
+        modules.append((os.path.basename(path), code))
+
+    table_size = 1
+    while table_size < 2 * len(modules):
+        table_size *= 2
+
+    table = [(0, 0, 0)] * table_size
+    blobs = bytearray()
+    offset = align(HEADER_SIZE + table_size * ENTRY_SIZE, MODULE_ALIGNMENT)
+
+    for name, code in modules:
+        name_hash = fnv1a64(name)
+        slot = name_hash & (table_size - 1)
+        while table[slot][0] != 0:
+            if table[slot][0] == name_hash:
+                sys.exit("duplicate or colliding shader name %s" % name)
+            slot = (slot + 1) & (table_size - 1)
+
+        table[slot] = (name_hash, offset + len(blobs), len(code))
+        blobs += code
+        blobs += b"\0" * (align(len(blobs), MODULE_ALIGNMENT) - len(blobs))
+
+    archive = bytearray(MAGIC + struct.pack("<III", VERSION, len(modules), table_size))
+    for entry in table:
+        archive += struct.pack("<QII", *entry)
+    archive += b"\0" * (offset - len(archive))
+    archive += blobs
+    return bytes(archive)
+
+
+def write_header(path, archive):
+    words = struct.unpack("<%dI" % (len(archive) // 4), archive)
+    with open(path, "w") as f:
+        f.write("#pragma once\n")
+        f.write("//Generated by pack_shaders.py - do not edit. Compiled in when EMBED_SHADER_ARCHIVE is defined\n")
+        f.write("#include <cstdint>\n\n")
+        f.write("alignas(16) constexpr uint32_t SHADER_ARCHIVE_DATA[] = {\n")
+        for i in range(0, len(words), 8):
+            f.write("\t" + ", ".join("0x%08x" % w for w in words[i:i + 8]) + ",\n")
+        f.write("};\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pack SPIR-V modules into a shader archive")
+    parser.add_argument("output")
+    parser.add_argument("--header", help="also emit the archive as constexpr data for embedding")
+    parser.add_argument("modules", nargs="+")
+    args = parser.parse_args()
+
+    archive = pack(args.modules)
+    with open(args.output, "wb") as f:
+        f.write(archive)
+    if args.header:
+        write_header(args.header, archive)
+
+
+if __name__ == "__main__":
+    main()
@@ -5,21 +5,45 @@ out gl_PerVertex {
     vec4 gl_Position;
 };
 
-layout(location = 0) out vec3 fragColor;
+layout(set = 0, binding = 0) uniform FrameUniforms {
+    mat4 transform;
+    mat4 viewProjection;
+} frame;
+
+//Must match DrawParameters in TriangleApplication.h. Pushed with every draw, or read through a dynamic uniform offset
+//when compiled with -DDRAW_UNIFORMS
+#ifdef DRAW_UNIFORMS
+layout(set = 0, binding = 1) uniform DrawParameters {
+#else
+layout(push_constant) uniform DrawParameters {
+#endif
+    vec2 offset;
+    float scale;
+    float rotation;
+    uint texture;
+    uint textureSampler;
+} draw;
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTexture;
+layout(location = 3) flat out uint fragSampler;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    //Spin the triangle, then place it in the draw's grid cell
+    vec4 position = frame.transform * vec4(inPosition, 0.0, 1.0);
+    float c = cos(draw.rotation);
+    float s = sin(draw.rotation);
+    position.xy = mat2(c, s, -s, c) * position.xy * draw.scale + draw.offset;
+
+    gl_Position = position;
+    fragColor = inColor;
+
+    //The triangle spans -0.5 to 0.5, so it covers the texture once
+    fragTexCoord = inPosition + 0.5;
+    fragTexture = draw.texture;
+    fragSampler = draw.textureSampler;
 }
\ No newline at end of file
@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+//The descriptor heap, see DescriptorHeap.h
+layout(set = 1, binding = 1) uniform texture2D textures[];
+layout(set = 1, binding = 2) uniform sampler samplers[];
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragTexture;
+layout(location = 3) flat in uint fragSampler;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    //0xffffffff until the texture's mip tail is resident. Both indices are the same for the whole draw
+    if (fragTexture == 0xffffffffu) {
+        outColor = vec4(fragColor, 1.0);
+        return;
+    }
+
+    vec4 texel = texture(sampler2D(textures[fragTexture], samplers[fragSampler]), fragTexCoord);
+    outColor = vec4(fragColor * texel.rgb, 1.0);
+}
\ No newline at end of file
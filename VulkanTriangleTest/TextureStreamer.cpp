@@ -0,0 +1,556 @@
+#include "TextureStreamer.h"
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cctype>
+
+static const VkFormat textureFormat = VK_FORMAT_R8G8B8A8_UNORM;
+static const uint32_t texelSize = 4;
+
+static VkDeviceSize LevelBytes(uint32_t width, uint32_t height, uint32_t level)
+{
+	return (VkDeviceSize)std::max(width >> level, 1u) * std::max(height >> level, 1u) * texelSize;
+}
+
+
+TextureStreamer::TextureStreamer()
+{
+}
+
+
+TextureStreamer::~TextureStreamer()
+{
+	Destroy();
+}
+
+void TextureStreamer::Initialize(VkDevice device, MemoryAllocator& allocator, AsyncQueue& transferQueue, uint32_t graphicsFamily, ThreadPool& decodePool,
+	DescriptorHeap& heap, uint32_t framesInFlight, VkDeviceSize bytesPerFrame)
+{
+	this->device = device;
+	this->allocator = &allocator;
+	this->transferQueue = &transferQueue;
+	this->graphicsFamily = graphicsFamily;
+	this->decodePool = &decodePool;
+	this->heap = &heap;
+	this->framesInFlight = framesInFlight;
+	this->bytesPerFrame = bytesPerFrame;
+
+	//Shared by every texture. LODs are relative to a view's base level, so a partly resident texture samples like a smaller one
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create texture sampler");
+	}
+
+	samplerSlot = heap.AllocateSampler(sampler);
+	statistics = TextureStreamerStatistics();
+}
+
+void TextureStreamer::Destroy()
+{
+	if (device == VK_NULL_HANDLE)
+		return;
+
+	//Uploads still in flight are dropped. Their semaphores belong to the transfer queue, which destroys them
+	for (auto& texture : textures)
+	{
+		if (texture->slot != invalidSlot)
+			heap->Free(DescriptorKind::SampledImage, texture->slot, 0);
+
+		vkDestroyImageView(device, texture->view, nullptr);
+		vkDestroyImage(device, texture->image, nullptr);
+		allocator->Free(texture->memory);
+	}
+
+	for (const auto& retired : retiredViews)
+	{
+		vkDestroyImageView(device, retired.view, nullptr);
+	}
+
+	heap->Free(DescriptorKind::Sampler, samplerSlot, 0);
+	vkDestroySampler(device, sampler, nullptr);
+
+	textures.clear();
+	retiredViews.clear();
+	sampler = VK_NULL_HANDLE;
+	samplerSlot = invalidSlot;
+	device = VK_NULL_HANDLE;
+}
+
+uint32_t TextureStreamer::Load(const std::string& path)
+{
+	std::unique_ptr<Texture> texture(new Texture());
+	texture->path = path;
+	texture->decoding = decodePool->Submit([path]()
+	{
+		return Decode(path);
+	});
+
+	textures.push_back(std::move(texture));
+	statistics.textures++;
+	return (uint32_t)textures.size() - 1;
+}
+
+std::vector<AsyncWork> TextureStreamer::Update(uint64_t frameCount)
+{
+	//Views replaced by wider ones are no longer read once the frames in flight at the time have finished
+	for (size_t i = 0; i < retiredViews.size();)
+	{
+		if (frameCount < retiredViews[i].retireFrame)
+		{
+			i++;
+			continue;
+		}
+
+		vkDestroyImageView(device, retiredViews[i].view, nullptr);
+		retiredViews[i] = retiredViews.back();
+		retiredViews.pop_back();
+	}
+
+	std::vector<AsyncWork> completed;
+
+	for (auto& texture : textures)
+	{
+		//Decoding failures are rethrown here
+		if (texture->decoding.valid() && texture->decoding.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			texture->decoded = texture->decoding.get();
+			CreateImage(*texture);
+		}
+
+		//Uploads of one texture are submitted coarse to fine on one queue, so they complete in that order
+		uint32_t residentLevel = texture->residentLevel;
+		while (!texture->uploads.empty() && texture->uploads.front().completion->completed)
+		{
+			Upload& upload = texture->uploads.front();
+
+			statistics.uploads++;
+			statistics.uploadedBytes += upload.bytes;
+			statistics.uploadLatencySeconds += std::chrono::duration<double>(upload.completion->time - upload.submitTime).count();
+			statistics.streamingSeconds = std::chrono::duration<double>(upload.completion->time - firstSubmitTime).count();
+
+			residentLevel = upload.baseLevel;
+			completed.push_back(upload.work);
+			texture->uploads.erase(texture->uploads.begin());
+		}
+
+		if (residentLevel != texture->residentLevel)
+			MakeResident(*texture, residentLevel, frameCount);
+	}
+
+	//Every tail goes out before any finer level, then the finer levels until the budget runs out.
+	//The first upload of a frame is always allowed, so a budget smaller than a level only slows streaming down
+	VkDeviceSize submittedBytes = 0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (auto& texture : textures)
+		{
+			if (texture->image == VK_NULL_HANDLE || texture->requestedLevel == 0)
+				continue;
+
+			bool tail = texture->requestedLevel == texture->levelCount;
+			if (pass == 0 && !tail)
+				continue;
+
+			while (texture->requestedLevel > 0)
+			{
+				uint32_t endLevel = texture->requestedLevel;
+				uint32_t firstLevel = endLevel - 1;
+
+				if (endLevel == texture->levelCount)
+				{
+					while (firstLevel > 0 && std::max(texture->decoded.width >> (firstLevel - 1), texture->decoded.height >> (firstLevel - 1)) <= tailSize)
+						firstLevel--;
+				}
+
+				VkDeviceSize bytes = 0;
+				for (uint32_t level = firstLevel; level < endLevel; level++)
+				{
+					bytes += LevelBytes(texture->decoded.width, texture->decoded.height, level);
+				}
+
+				if (bytesPerFrame > 0 && submittedBytes > 0 && submittedBytes + bytes > bytesPerFrame)
+				{
+					statistics.budgetLimitedFrames++;
+					return completed;
+				}
+
+				SubmitUpload(*texture, firstLevel, endLevel, bytes);
+				submittedBytes += bytes;
+
+				//The tail pass only submits tails
+				if (pass == 0)
+					break;
+			}
+		}
+	}
+
+	return completed;
+}
+
+uint32_t TextureStreamer::GetSlot(uint32_t texture) const
+{
+	return textures[texture]->slot;
+}
+
+TextureStreamerStatistics TextureStreamer::GetStatistics() const
+{
+	TextureStreamerStatistics result = statistics;
+
+	for (const auto& texture : textures)
+	{
+		if (texture->image == VK_NULL_HANDLE)
+			continue;
+
+		for (uint32_t level = 0; level < texture->levelCount; level++)
+		{
+			VkDeviceSize bytes = LevelBytes(texture->decoded.width, texture->decoded.height, level);
+			result.totalBytes += bytes;
+			if (level >= texture->residentLevel)
+				result.residentBytes += bytes;
+		}
+
+		if (texture->residentLevel == 0)
+			result.fullyResident++;
+	}
+
+	return result;
+}
+
+void TextureStreamer::PrintStatistics(std::ostream& out) const
+{
+	TextureStreamerStatistics stats = GetStatistics();
+
+	out << "Texture streaming: " << stats.fullyResident << "/" << stats.textures << " textures fully resident, "
+		<< stats.residentBytes / 1024 << "/" << stats.totalBytes / 1024 << " KiB resident" << std::endl;
+
+	if (stats.uploads == 0)
+		return;
+
+	double bandwidth = stats.streamingSeconds > 0.0 ? stats.uploadedBytes / stats.streamingSeconds / (1024.0 * 1024.0) : 0.0;
+	out << "  " << stats.uploads << " uploads, " << stats.uploadedBytes / 1024 << " KiB in " << stats.streamingSeconds * 1000.0 << " ms ("
+		<< bandwidth << " MiB/s), " << stats.uploadLatencySeconds * 1000.0 / stats.uploads << " ms average latency, "
+		<< stats.budgetLimitedFrames << " frames limited by the budget" << std::endl;
+}
+
+//Runs on a worker thread
+DecodedTexture TextureStreamer::Decode(const std::string& path)
+{
+	DecodedTexture texture;
+
+	if (path == "checker")
+		GenerateChecker(texture);
+	else
+		ReadPpm(path, texture);
+
+	BuildMipChain(texture);
+	return texture;
+}
+
+//Binary PPM (P6) with 8 bits per channel, expanded to RGBA
+void TextureStreamer::ReadPpm(const std::string& path, DecodedTexture& texture)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	if (!file.is_open())
+	{
+		throw std::runtime_error("failed to open texture " + path);
+	}
+
+	//Header fields are separated by whitespace, and # starts a comment that runs to the end of the line
+	auto readField = [&file]()
+	{
+		std::string field;
+		char c;
+		while (file.get(c))
+		{
+			if (c == '#')
+			{
+				std::string comment;
+				std::getline(file, comment);
+			}
+			else if (std::isspace((unsigned char)c))
+			{
+				if (!field.empty())
+					break;
+			}
+			else
+			{
+				field += c;
+			}
+		}
+		return field;
+	};
+
+	std::string magic = readField();
+	std::string width = readField();
+	std::string height = readField();
+	std::string maxValue = readField();
+
+	if (magic != "P6" || maxValue != "255" || width.empty() || height.empty())
+	{
+		throw std::runtime_error("unsupported texture " + path + ", expected a binary PPM with 8 bits per channel");
+	}
+
+	texture.width = (uint32_t)std::stoul(width);
+	texture.height = (uint32_t)std::stoul(height);
+
+	if (texture.width == 0 || texture.height == 0)
+	{
+		throw std::runtime_error("texture " + path + " is empty");
+	}
+
+	size_t texelCount = (size_t)texture.width * texture.height;
+	std::vector<uint8_t> rgb(texelCount * 3);
+	if (!file.read(reinterpret_cast<char*>(rgb.data()), rgb.size()))
+	{
+		throw std::runtime_error("texture " + path + " is truncated");
+	}
+
+	texture.levels.resize(1);
+	texture.levels[0].resize(texelCount * texelSize);
+	for (size_t i = 0; i < texelCount; i++)
+	{
+		texture.levels[0][i * 4 + 0] = rgb[i * 3 + 0];
+		texture.levels[0][i * 4 + 1] = rgb[i * 3 + 1];
+		texture.levels[0][i * 4 + 2] = rgb[i * 3 + 2];
+		texture.levels[0][i * 4 + 3] = 255;
+	}
+}
+
+//2048x2048 checkerboard of 32 texel squares. The coarse levels average out to grey, so finer levels arriving are easy to see
+void TextureStreamer::GenerateChecker(DecodedTexture& texture)
+{
+	const uint32_t size = 2048;
+	const uint32_t square = 32;
+
+	texture.width = size;
+	texture.height = size;
+	texture.levels.resize(1);
+	texture.levels[0].resize((size_t)size * size * texelSize);
+
+	uint8_t* texel = texture.levels[0].data();
+	for (uint32_t y = 0; y < size; y++)
+	{
+		for (uint32_t x = 0; x < size; x++)
+		{
+			uint8_t value = ((x / square) + (y / square)) % 2 ? 255 : 32;
+			texel[0] = value;
+			texel[1] = value;
+			texel[2] = value;
+			texel[3] = 255;
+			texel += texelSize;
+		}
+	}
+}
+
+//Box filters each level down to the next, until 1x1. Odd edges repeat their last row or column
+void TextureStreamer::BuildMipChain(DecodedTexture& texture)
+{
+	uint32_t width = texture.width;
+	uint32_t height = texture.height;
+
+	while (width > 1 || height > 1)
+	{
+		uint32_t nextWidth = std::max(width / 2, 1u);
+		uint32_t nextHeight = std::max(height / 2, 1u);
+
+		const std::vector<uint8_t>& source = texture.levels.back();
+		std::vector<uint8_t> level((size_t)nextWidth * nextHeight * texelSize);
+
+		for (uint32_t y = 0; y < nextHeight; y++)
+		{
+			uint32_t y0 = std::min(y * 2, height - 1);
+			uint32_t y1 = std::min(y * 2 + 1, height - 1);
+
+			for (uint32_t x = 0; x < nextWidth; x++)
+			{
+				uint32_t x0 = std::min(x * 2, width - 1);
+				uint32_t x1 = std::min(x * 2 + 1, width - 1);
+
+				for (uint32_t channel = 0; channel < texelSize; channel++)
+				{
+					uint32_t sum = source[((size_t)y0 * width + x0) * texelSize + channel] + source[((size_t)y0 * width + x1) * texelSize + channel] +
+						source[((size_t)y1 * width + x0) * texelSize + channel] + source[((size_t)y1 * width + x1) * texelSize + channel];
+					level[((size_t)y * nextWidth + x) * texelSize + channel] = (uint8_t)((sum + 2) / 4);
+				}
+			}
+		}
+
+		texture.levels.push_back(std::move(level));
+		width = nextWidth;
+		height = nextHeight;
+	}
+}
+
+//Every level is allocated up front, only the uploads are streamed
+void TextureStreamer::CreateImage(Texture& texture)
+{
+	texture.levelCount = (uint32_t)texture.decoded.levels.size();
+	texture.residentLevel = texture.levelCount;
+	texture.requestedLevel = texture.levelCount;
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = textureFormat;
+	imageInfo.extent.width = texture.decoded.width;
+	imageInfo.extent.height = texture.decoded.height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = texture.levelCount;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(device, &imageInfo, nullptr, &texture.image) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create texture image for " + texture.path);
+	}
+
+	texture.memory = allocator->AllocateForImage(texture.image, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+//Copies levels [firstLevel, endLevel) through a staging buffer that is freed once the transfer queue is done with it
+void TextureStreamer::SubmitUpload(Texture& texture, uint32_t firstLevel, uint32_t endLevel, VkDeviceSize bytes)
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = bytes;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer stagingBuffer;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &stagingBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create texture staging buffer");
+	}
+
+	MemoryAllocation stagingMemory = allocator->AllocateForBuffer(stagingBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	//Levels are tightly packed, and every level is a whole number of texels, so each offset stays texel aligned.
+	//The decoded copy of a level is not needed once it has been staged
+	std::vector<VkBufferImageCopy> regions;
+	VkDeviceSize offset = 0;
+	for (uint32_t level = firstLevel; level < endLevel; level++)
+	{
+		std::vector<uint8_t>& data = texture.decoded.levels[level];
+		memcpy(static_cast<uint8_t*>(stagingMemory.mappedData) + offset, data.data(), data.size());
+
+		VkBufferImageCopy region = {};
+		region.bufferOffset = offset;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent.width = std::max(texture.decoded.width >> level, 1u);
+		region.imageExtent.height = std::max(texture.decoded.height >> level, 1u);
+		region.imageExtent.depth = 1;
+		regions.push_back(region);
+
+		offset += data.size();
+		std::vector<uint8_t>().swap(data);
+	}
+
+	VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, firstLevel, endLevel - firstLevel, 0, 1 };
+
+	VkCommandBuffer commandBuffer = transferQueue->Begin();
+
+	//The levels have never been written, so their contents can be discarded
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = texture.image;
+	barrier.subresourceRange = range;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+
+	ImageOwnershipTransfer transfer;
+	transfer.image = texture.image;
+	transfer.range = range;
+	transfer.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	transfer.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	transfer.srcFamily = transferQueue->GetFamilyIndex();
+	transfer.dstFamily = graphicsFamily;
+	transfer.srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	transfer.srcAccess = VK_ACCESS_TRANSFER_WRITE_BIT;
+	transfer.dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	transfer.dstAccess = VK_ACCESS_SHADER_READ_BIT;
+
+	Upload upload;
+	upload.baseLevel = firstLevel;
+	upload.bytes = bytes;
+	upload.submitTime = std::chrono::high_resolution_clock::now();
+	if (firstSubmitTime == std::chrono::high_resolution_clock::time_point())
+		firstSubmitTime = upload.submitTime;
+	upload.completion = std::make_shared<UploadCompletion>();
+
+	//The work is only handed to the graphics queue after this has run, so its wait on the semaphore never stalls a frame
+	VkDevice device = this->device;
+	MemoryAllocator* allocator = this->allocator;
+	std::shared_ptr<UploadCompletion> completion = upload.completion;
+
+	upload.work = transferQueue->Submit(commandBuffer, {}, {}, { transfer }, graphicsFamily, transfer.dstStage,
+		[device, allocator, stagingBuffer, stagingMemory, completion]() mutable
+	{
+		vkDestroyBuffer(device, stagingBuffer, nullptr);
+		allocator->Free(stagingMemory);
+		completion->completed = true;
+		completion->time = std::chrono::high_resolution_clock::now();
+	});
+
+	texture.uploads.push_back(upload);
+	texture.requestedLevel = firstLevel;
+}
+
+//Points the texture at a new slot whose view starts at level. The old slot and view stay valid for the frames still reading them
+void TextureStreamer::MakeResident(Texture& texture, uint32_t level, uint64_t frameCount)
+{
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = texture.image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = textureFormat;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = level;
+	viewInfo.subresourceRange.levelCount = texture.levelCount - level;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	VkImageView view;
+	if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create texture image view for " + texture.path);
+	}
+
+	uint32_t slot = heap->AllocateImage(view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	uint64_t retireFrame = frameCount + framesInFlight - 1;
+	if (texture.slot != invalidSlot)
+	{
+		heap->Free(DescriptorKind::SampledImage, texture.slot, retireFrame);
+		retiredViews.push_back({ texture.view, retireFrame });
+	}
+
+	texture.view = view;
+	texture.slot = slot;
+	texture.residentLevel = level;
+}
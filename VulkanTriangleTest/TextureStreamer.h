@@ -0,0 +1,141 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <ostream>
+#include "MemoryAllocator.h"
+#include "AsyncQueue.h"
+#include "DescriptorHeap.h"
+#include "ThreadPool.h"
+
+//Mip chain of an RGBA8 image, decoded and downsampled on a worker thread
+struct DecodedTexture
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<std::vector<uint8_t>> levels;	//Finest first, tightly packed rows
+};
+
+//Upload and residency counters since Initialize
+struct TextureStreamerStatistics
+{
+	uint32_t textures = 0;
+	uint32_t fullyResident = 0;
+	VkDeviceSize residentBytes = 0;			//Device memory holding uploaded levels
+	VkDeviceSize totalBytes = 0;			//Of every level of every decoded texture
+	VkDeviceSize uploadedBytes = 0;
+	uint32_t uploads = 0;					//Completed
+	double uploadLatencySeconds = 0.0;		//From submission until the completion was seen, summed over the uploads
+	double streamingSeconds = 0.0;			//From the first submission to the latest completion
+	uint32_t budgetLimitedFrames = 0;		//Frames that left uploads for later because of the budget
+};
+
+//Streams textures into device local images without ever stalling a frame:
+//- files are decoded and their mip chains built on the worker pool
+//- the mip tail, every level up to tailSize, is uploaded first in one go so something can be sampled early
+//- finer levels follow one at a time, at most bytesPerFrame each frame
+//- a level is only used once its upload has completed on the transfer queue, so the graphics queue's wait on it is free
+//Each texture is sampled through a descriptor heap slot holding a view of its resident levels. When a finer level arrives the
+//texture moves to a new slot with a wider view, and the old slot and view are released once frames in flight are done with them.
+//Not thread safe apart from the decoding, every call has to come from the thread that owns the transfer queue.
+class TextureStreamer
+{
+public:
+	static const uint32_t invalidSlot = ~0u;
+
+	TextureStreamer();
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	void Initialize(VkDevice device, MemoryAllocator& allocator, AsyncQueue& transferQueue, uint32_t graphicsFamily, ThreadPool& decodePool,
+		DescriptorHeap& heap, uint32_t framesInFlight, VkDeviceSize bytesPerFrame);
+
+	//The device has to be idle, or at least done with every frame that sampled a texture
+	void Destroy();
+
+	//Starts decoding in the background and returns the texture's ID. Binary PPM files, or "checker" for a generated image
+	uint32_t Load(const std::string& path);
+
+	//Call once per frame before recording: picks up decoded textures and finished uploads, and submits new uploads within
+	//the budget. Returns the work the graphics queue has to acquire before sampling the newly resident levels
+	std::vector<AsyncWork> Update(uint64_t frameCount);
+
+	//Heap slot of the sampled image to use this frame, invalidSlot while nothing is resident
+	uint32_t GetSlot(uint32_t texture) const;
+	uint32_t GetSamplerSlot() const { return samplerSlot; }
+
+	TextureStreamerStatistics GetStatistics() const;
+	void PrintStatistics(std::ostream& out) const;
+
+private:
+	//Levels whose size in either dimension is at most this are uploaded together as the tail
+	static const uint32_t tailSize = 64;
+
+	//Filled in by the transfer queue's completion callback
+	struct UploadCompletion
+	{
+		bool completed = false;
+		std::chrono::high_resolution_clock::time_point time;
+	};
+
+	struct Upload
+	{
+		uint32_t baseLevel;					//Finest level of the upload. It ends where the previous upload began
+		VkDeviceSize bytes;
+		std::chrono::high_resolution_clock::time_point submitTime;
+		std::shared_ptr<UploadCompletion> completion;
+		AsyncWork work;
+	};
+
+	struct Texture
+	{
+		std::string path;
+		std::future<DecodedTexture> decoding;
+		DecodedTexture decoded;				//Levels are released as they are uploaded
+		VkImage image = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		uint32_t levelCount = 0;
+		uint32_t residentLevel = 0;			//Finest level that can be sampled, levelCount while none can
+		uint32_t requestedLevel = 0;		//Finest level uploaded or being uploaded, levelCount while none is
+		std::vector<Upload> uploads;		//In flight on the transfer queue
+		VkImageView view = VK_NULL_HANDLE;	//Of residentLevel and coarser
+		uint32_t slot = invalidSlot;
+	};
+
+	struct RetiredView
+	{
+		VkImageView view;
+		uint64_t retireFrame;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+	AsyncQueue* transferQueue = nullptr;
+	uint32_t graphicsFamily = 0;
+	ThreadPool* decodePool = nullptr;
+	DescriptorHeap* heap = nullptr;
+	uint32_t framesInFlight = 1;
+	VkDeviceSize bytesPerFrame = 0;
+
+	VkSampler sampler = VK_NULL_HANDLE;
+	uint32_t samplerSlot = invalidSlot;
+
+	std::vector<std::unique_ptr<Texture>> textures;
+	std::vector<RetiredView> retiredViews;
+	TextureStreamerStatistics statistics;
+	std::chrono::high_resolution_clock::time_point firstSubmitTime;
+
+	static DecodedTexture Decode(const std::string& path);
+	static void ReadPpm(const std::string& path, DecodedTexture& texture);
+	static void GenerateChecker(DecodedTexture& texture);
+	static void BuildMipChain(DecodedTexture& texture);
+
+	void CreateImage(Texture& texture);
+	void SubmitUpload(Texture& texture, uint32_t firstLevel, uint32_t endLevel, VkDeviceSize bytes);
+	void MakeResident(Texture& texture, uint32_t level, uint64_t frameCount);
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+//Fixed set of worker threads pulling tasks from a shared queue.
+//Exceptions thrown by a task are stored in its future and rethrown by get().
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	template<typename Task>
+	auto Submit(Task&& task) -> std::future<decltype(task())>
+	{
+		//std::function must be copyable, so the move-only packaged_task is shared instead
+		auto packagedTask = std::make_shared<std::packaged_task<decltype(task())()>>(std::forward<Task>(task));
+		auto future = packagedTask->get_future();
+
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			tasks.emplace([packagedTask]() { (*packagedTask)(); });
+		}
+		queueCondition.notify_one();
+
+		return future;
+	}
+
+	size_t GetThreadCount() const { return workers.size(); }
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	bool stopping = false;
+
+	void WorkerLoop();
+};
@@ -1,10 +1,25 @@
 #include "TriangleApplication.h"
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
 #include <set>
 #include <algorithm>
 #include <fstream>
+#include <cstring>
+#include <limits>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <cctype>
+#include <thread>
 
+#ifdef EMBED_SHADER_ARCHIVE
+#include "Shaders/ShaderArchiveData.h"		//Generated by Shaders/pack_shaders.py --header
+#endif
 
-TriangleApplication::TriangleApplication()
+
+TriangleApplication::TriangleApplication(const ApplicationSettings& settings) : settings(settings)
 {
 }
 
@@ -17,8 +32,14 @@ TriangleApplication::~TriangleApplication()
 
 void TriangleApplication::Run()
 {
-	//Initialize GLFW and create a window
-	InitializeWindow();
+	startupStart = std::chrono::high_resolution_clock::now();
+
+	//Initialize GLFW and create a window. Headless runs never touch the window system
+	if (!settings.headless)
+	{
+		InitializeWindow();
+		EndStartupStage("Window", startupStart);
+	}
 
 	//Initialize the private objects for the vulkan triangle class
 	InitializeVulkan();
@@ -30,15 +51,83 @@ void TriangleApplication::Run()
 	CleanUp();
 }
 
+BenchmarkResult TriangleApplication::RunBenchmark(uint32_t warmUpFrames, uint32_t measuredFrames)
+{
+	BenchmarkResult result;
+	startupStart = std::chrono::high_resolution_clock::now();
+
+	if (!settings.headless)
+	{
+		InitializeWindow();
+		EndStartupStage("Window", startupStart);
+	}
+
+	InitializeVulkan();
+	result.deviceName = deviceInfo.properties.deviceName;
+
+	//The first frame waits for its pipelines, which is part of starting up
+	DrawFrame();
+	std::chrono::duration<double, std::milli> startupTime = std::chrono::high_resolution_clock::now() - startupStart;
+	result.startupTime = startupTime.count();
+
+	for (uint32_t frame = 1; frame < warmUpFrames; frame++)
+	{
+		if (!settings.headless)
+			glfwPollEvents();
+		DrawFrame();
+	}
+
+	//A frame's GPU time is read back when its slot comes round again, so the loop runs on until every measured frame has been read
+	uint32_t lag = (uint32_t)frames.size();
+	for (uint32_t frame = 0; frame < measuredFrames + lag; frame++)
+	{
+		if (!settings.headless)
+			glfwPollEvents();
+		DrawFrame();
+
+		if (frame < measuredFrames)
+			result.cpuFrameTimes.push_back(cpuFrameTime);
+
+		if (frame >= lag && profiler.AreTimestampsSupported())
+			result.gpuFrameTimes.push_back(gpuFrameTime);
+	}
+
+	vkDeviceWaitIdle(device);
+	CleanUp();
+
+	return result;
+}
+
 
 void TriangleApplication::InitializeWindow()
 {
 	glfwInit();												//Initialize window
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);			//Since by default glfw is created for OpenGl we need to tell not to create OpenGL context
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);				//No resizing
 
 	window = glfwCreateWindow(WIDTH, HEIGHT, "VULKAN DEMO", nullptr, nullptr);
+
+	//Resizes only flag the swap chain, it is recreated between frames
+	glfwSetWindowUserPointer(window, this);
+	glfwSetFramebufferSizeCallback(window, FramebufferResizeCallback);
+	glfwSetKeyCallback(window, KeyCallback);
+}
+
+void TriangleApplication::FramebufferResizeCallback(GLFWwindow* window, int width, int height)
+{
+	auto application = reinterpret_cast<TriangleApplication*>(glfwGetWindowUserPointer(window));
+	application->swapChainOutdated = true;
+}
+
+void TriangleApplication::KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	auto application = reinterpret_cast<TriangleApplication*>(glfwGetWindowUserPointer(window));
+
+	if (key == GLFW_KEY_F2 && action == GLFW_PRESS)
+	{
+		application->profiler.SetEnabled(!application->profiler.IsEnabled());
+		std::cout << "profiler " << (application->profiler.IsEnabled() ? "on" : "off") << std::endl;
+	}
 }
 
 void TriangleApplication::CreateInstance()
@@ -118,35 +207,56 @@ bool TriangleApplication::CheckValidationLayerSupport()
 //Returns the required list of extensions based on the valudation layer is enabled or not
 std::vector<const char*> TriangleApplication::GetRequiredExtensions()
 {
+	std::vector<const char*> extensions;
+
 	//Extension to create an interface between vulkan and window system and use that extension to send the debug messgae.
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	//Not needed when rendering headless, where GLFW is never initialized.
+	if (!settings.headless)
+	{
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
 
-	//Sets the callback to receive the debug messages
-	if (enableValidationLayers)
-		extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+	//Receives the validation messages, and lets objects and command buffer regions be named for the layers and capture tools.
+	//Names and labels are worth having without validation, for capture tools
+	debugUtilsEnabled = IsInstanceExtensionAvailable(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+	if (debugUtilsEnabled)
+		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+	else if (enableValidationLayers)
+		std::cerr << VK_EXT_DEBUG_UTILS_EXTENSION_NAME << " is not available, validation messages will not be shown" << std::endl;
+
+	//Extended feature and property queries, where descriptor indexing support is reported
+	physicalDeviceProperties2Enabled = IsInstanceExtensionAvailable(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+	if (physicalDeviceProperties2Enabled)
+		extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
 
 	return extensions;
 }
 
-void TriangleApplication::SetUpDebugCallBack()
+bool TriangleApplication::IsInstanceExtensionAvailable(const char* name)
 {
-	if (!enableValidationLayers)
-		return;
+	uint32_t extensionCount = 0;
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
 
-	//Structure for details of callback
-	VkDebugReportCallbackCreateInfoEXT debugInfo;
-	debugInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-	debugInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
-	debugInfo.pfnCallback = debugCallback;
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
 
-	if (CreateDebugReportCallbackEXT(instance, &debugInfo, nullptr, &callback) != VK_SUCCESS)
+	for (const auto& extension : extensions)
 	{
-		throw std::runtime_error("failed to set up debug callback");
+		if (strcmp(extension.extensionName, name) == 0)
+			return true;
 	}
+
+	return false;
+}
+
+void TriangleApplication::SetUpDebugCallBack()
+{
+	if (debugUtilsEnabled)
+		debugMessenger.Initialize(instance, enableValidationLayers);
 }
 
 void TriangleApplication::CreateSurface()
@@ -158,6 +268,8 @@ void TriangleApplication::CreateSurface()
 
 }
 
+//Probes every device once, ranks the suitable ones and picks the best. TRIANGLE_DEVICE overrides the choice with either
+//an index into the enumeration order or part of a device name, e.g. TRIANGLE_DEVICE=1 or TRIANGLE_DEVICE=nvidia
 void TriangleApplication::SelectPhysicalDevice()
 {
 	uint32_t deviceCount = 0;
@@ -171,87 +283,278 @@ void TriangleApplication::SelectPhysicalDevice()
 	std::vector<VkPhysicalDevice> devices(deviceCount);
 	vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
-	//Checks for a suitable device and assigns it to the physicaldevice
+	std::vector<PhysicalDeviceInfo> candidates;
 	for (const auto& device : devices)
 	{
-		if (isDeviceSuitable(device))
+		candidates.push_back(ProbePhysicalDevice(device));
+	}
+
+	int selected = -1;
+	const char* deviceOverride = std::getenv("TRIANGLE_DEVICE");
+
+	if (deviceOverride != nullptr && *deviceOverride != '\0')
+	{
+		//The <cctype> functions are only defined for values of unsigned char, so bytes outside ASCII are converted first
+		auto toLower = [](unsigned char c) { return (char)std::tolower(c); };
+		auto isDigit = [](unsigned char c) { return std::isdigit(c) != 0; };
+
+		std::string wanted = deviceOverride;
+		std::transform(wanted.begin(), wanted.end(), wanted.begin(), toLower);
+		bool isIndex = std::all_of(wanted.begin(), wanted.end(), isDigit);
+
+		//An index too long to parse cannot match any device either
+		size_t wantedIndex = isIndex && wanted.size() <= 9 ? std::stoul(wanted) : candidates.size();
+
+		for (size_t i = 0; i < candidates.size() && selected < 0; i++)
 		{
-			physicalDevice = device;
-			break;
+			std::string name = candidates[i].properties.deviceName;
+			std::transform(name.begin(), name.end(), name.begin(), toLower);
+
+			if (isIndex ? wantedIndex == i : name.find(wanted) != std::string::npos)
+				selected = (int)i;
+		}
+
+		if (selected < 0)
+			throw std::runtime_error(std::string("TRIANGLE_DEVICE=") + deviceOverride + " matches no GPU");
+
+		if (candidates[selected].score < 0)
+			throw std::runtime_error(std::string("TRIANGLE_DEVICE selects ") + candidates[selected].properties.deviceName + ", which " + candidates[selected].rejectReason);
+	}
+	else
+	{
+		//Ties go to the first device enumerated, which is usually the one the driver considers primary
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			if (candidates[i].score >= 0 && (selected < 0 || candidates[i].score > candidates[selected].score))
+				selected = (int)i;
 		}
 	}
 
-	if (physicalDevice == VK_NULL_HANDLE)
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+		std::cout << ((int)i == selected ? "* " : "  ") << i << ": " << candidates[i].properties.deviceName;
+		if (candidates[i].score >= 0)
+			std::cout << " (score " << candidates[i].score << ")" << std::endl;
+		else
+			std::cout << " (" << candidates[i].rejectReason << ")" << std::endl;
+	}
+
+	if (selected < 0)
 		throw std::runtime_error("failed to find suitable GPU");
 
+	deviceInfo = candidates[selected];
+	physicalDevice = deviceInfo.device;
+	queueFamilies = deviceInfo.queueFamilies;
 }
 
-//Evaluates the suitability of the device
-bool TriangleApplication::isDeviceSuitable(VkPhysicalDevice device)
+//Queries everything selection and initialization need to know about the device
+PhysicalDeviceInfo TriangleApplication::ProbePhysicalDevice(VkPhysicalDevice device)
 {
+	PhysicalDeviceInfo info;
+	info.device = device;
+
+	vkGetPhysicalDeviceProperties(device, &info.properties);
+	vkGetPhysicalDeviceFeatures(device, &info.features);
+	vkGetPhysicalDeviceMemoryProperties(device, &info.memoryProperties);
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+	info.queueFamilyProperties.resize(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, info.queueFamilyProperties.data());
+
+	info.queueFamilies = FindQueueFamilies(device, info.queueFamilyProperties);
+	info.extensionsSupported = CheckDeviceExtensionSupport(device);
+
+	//There is no swap chain in headless mode
+	if (info.extensionsSupported && !settings.headless)
+		info.swapChainSupport = QuerySwapChainSupport(device);
+
+	ProbeDescriptorIndexing(info);
 
-	//VkPhysicalDeviceProperties deviceProperties;
-	//VkPhysicalDeviceFeatures deviceFeatures;
+	for (uint32_t i = 0; i < info.memoryProperties.memoryHeapCount; i++)
+	{
+		if (info.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			info.deviceLocalBytes = std::max(info.deviceLocalBytes, info.memoryProperties.memoryHeaps[i].size);
+	}
 
-	//vkGetPhysicalDeviceProperties(device, &deviceProperties);
-	//vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+	if (isDeviceSuitable(info))
+		info.score = RateDevice(info);
 
-	////Check whether graphics card supports geometric shaders
-	//return deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU && deviceFeatures.geometryShader;
+	return info;
+}
 
+//Evaluates the suitability of the device, recording why it is rejected
+bool TriangleApplication::isDeviceSuitable(PhysicalDeviceInfo& info)
+{
 	//Checks for devices with suitable queue families supported
-	QueueFamilyIndices indices = FindQueueFamilies(device);
+	if (!info.queueFamilies.isComplete(!settings.headless))
+	{
+		info.rejectReason = "lacks a graphics and compute or present queue";
+		return false;
+	}
 
 	//Checks whether the required extensions are supported or not.
-	bool extensionSupported = CheckDeviceExtensionSupport(device);
+	if (!info.extensionsSupported)
+	{
+		info.rejectReason = "lacks a required device extension";
+		return false;
+	}
 
 	//Checks whether the swap chain is adequate enough or not
-	bool swapChainAdequate = false;
-	if (extensionSupported)
+	if (!settings.headless && (info.swapChainSupport.formats.empty() || info.swapChainSupport.presentModes.empty()))
 	{
-		SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(device);
-		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+		info.rejectReason = "cannot present to the window surface";
+		return false;
 	}
 
-	return indices.isComplete() && extensionSupported && swapChainAdequate;
+	return true;
+}
 
-	
+//Ranks a suitable device. Device type dominates, then memory, then the optional features and limits this application benefits from
+int64_t TriangleApplication::RateDevice(const PhysicalDeviceInfo& info)
+{
+	int64_t score = 0;
+
+	switch (info.properties.deviceType)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+		score += 100000;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+		score += 50000;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+		score += 20000;
+		break;
+	default:
+		//CPU implementations and unknown types come last
+		break;
+	}
+
+	//One point per 64 MiB of device local memory, capped so a big heap never outranks a better device type
+	score += std::min<int64_t>(info.deviceLocalBytes >> 26, 20000);
+
+	//Queues that run beside the graphics queue let uploads and culling overlap rendering
+	if (info.queueFamilies.computeFamily != info.queueFamilies.graphicsFamily)
+		score += 1000;
+	if (info.queueFamilies.transferFamily != info.queueFamilies.computeFamily)
+		score += 1000;
+
+	if (info.features.multiDrawIndirect)
+		score += 500;
+
+	if (info.queueFamilyProperties[info.queueFamilies.graphicsFamily].timestampValidBits > 0)
+		score += 250;
+
+	score += info.properties.limits.maxImageDimension2D / 1024;
+
+	return score;
 }
 
-//Find QueueFamilies supported by the device that supports the features we need
-QueueFamilyIndices TriangleApplication::FindQueueFamilies(VkPhysicalDevice device)
+//Checks for what the descriptor heap needs: the extensions, update after bind and partially bound arrays of buffers and images,
+//and dynamically uniform indexing into them. Only reported through VK_KHR_get_physical_device_properties2
+void TriangleApplication::ProbeDescriptorIndexing(PhysicalDeviceInfo& info)
 {
-	QueueFamilyIndices indices;
+	if (!physicalDeviceProperties2Enabled)
+		return;
 
-	uint32_t queueFamilyCount = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(info.device, nullptr, &extensionCount, nullptr);
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(info.device, nullptr, &extensionCount, availableExtensions.data());
+
+	std::set<std::string> requiredExtensions = { VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, VK_KHR_MAINTENANCE3_EXTENSION_NAME };
+	for (const auto& extension : availableExtensions)
+	{
+		requiredExtensions.erase(extension.extensionName);
+	}
+
+	if (!requiredExtensions.empty())
+		return;
+
+	auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+	auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+	if (getFeatures2 == nullptr || getProperties2 == nullptr)
+		return;
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+	VkPhysicalDeviceFeatures2KHR features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+	features.pNext = &indexingFeatures;
+	getFeatures2(info.device, &features);
+
+	info.descriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+	VkPhysicalDeviceProperties2KHR properties = {};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+	properties.pNext = &info.descriptorIndexingProperties;
+	getProperties2(info.device, &properties);
+	info.descriptorIndexingProperties.pNext = nullptr;
+
+	info.descriptorIndexingSupported = indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind &&
+		indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+		indexingFeatures.descriptorBindingUpdateUnusedWhilePending &&
+		indexingFeatures.descriptorBindingPartiallyBound &&
+		indexingFeatures.runtimeDescriptorArray &&
+		info.features.shaderStorageBufferArrayDynamicIndexing &&
+		info.features.shaderSampledImageArrayDynamicIndexing;
+}
 
-	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+//Find QueueFamilies supported by the device that supports the features we need
+QueueFamilyIndices TriangleApplication::FindQueueFamilies(VkPhysicalDevice device, const std::vector<VkQueueFamilyProperties>& queueFamilyProperties)
+{
+	QueueFamilyIndices indices;
 
 	int i = 0;
 
 	//Checks whether the queue families supported by physical device supports graphics
-	for (const auto& queueFamily : queueFamilies)
+	for (const auto& queueFamily : queueFamilyProperties)
 	{
-		if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		if (queueFamily.queueCount == 0)
 		{
-			indices.graphicsFamily = i;
+			i++;
+			continue;
 		}
 
-		//Checks whether the queue families supported by physical device supports window surface for rendering things
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		bool graphics = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		bool compute = (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+		bool transfer = (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) != 0;
+
+		//The culling pass can be recorded into the graphics command buffers, so the graphics family has to run compute too.
+		//Vulkan guarantees such a family whenever graphics is supported at all
+		if (indices.graphicsFamily < 0 && graphics && compute)
+			indices.graphicsFamily = i;
 
-		if (queueFamily.queueCount > 0 && presentSupport)
-			indices.presentFamily = i;
+		//Dedicated families run beside the graphics queue instead of queueing behind it
+		if (indices.computeFamily < 0 && compute && !graphics)
+			indices.computeFamily = i;
 
-		if (indices.isComplete())
-			break;
+		if (indices.transferFamily < 0 && transfer && !graphics && !compute)
+			indices.transferFamily = i;
+
+		//Checks whether the queue families supported by physical device supports window surface for rendering things
+		if (!settings.headless)
+		{
+			VkBool32 presentSupport = false;
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+
+			//Presenting from the graphics family avoids handing the image over between queues
+			if (presentSupport && (indices.presentFamily < 0 || i == indices.graphicsFamily))
+				indices.presentFamily = i;
+		}
 
 		i++;
 	}
 
+	//Graphics and compute queues can always transfer, even where the flag is not reported
+	if (indices.computeFamily < 0)
+		indices.computeFamily = indices.graphicsFamily;
+
+	if (indices.transferFamily < 0)
+		indices.transferFamily = indices.computeFamily;
 
 	return indices;
 }
@@ -259,10 +562,12 @@ QueueFamilyIndices TriangleApplication::FindQueueFamilies(VkPhysicalDevice devic
 void TriangleApplication::CreateLogicalDevice()
 {
 	//Describes the number of queues you want in your queue family
-	QueueFamilyIndices indices = FindQueueFamilies(physicalDevice);
+	const QueueFamilyIndices& indices = queueFamilies;
 
 	std::vector<VkDeviceQueueCreateInfo> queueInfos;
-	std::set<int> uniqueQueueFamilies = { indices.graphicsFamily, indices.presentFamily };
+	std::set<int> uniqueQueueFamilies = { indices.graphicsFamily, indices.computeFamily, indices.transferFamily };
+	if (!settings.headless)
+		uniqueQueueFamilies.insert(indices.presentFamily);
 
 	float queuePriority = 1.0f;
 
@@ -278,11 +583,40 @@ void TriangleApplication::CreateLogicalDevice()
 	}
 
 	//Get the device features 
+	const VkPhysicalDeviceFeatures& supportedFeatures = deviceInfo.features;
+
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 
+	//Lets a single indirect draw consume every command the culling pass wrote
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	multiDrawIndirectEnabled = deviceFeatures.multiDrawIndirect == VK_TRUE;
+
+	//The draws are recorded in secondaries, which may only run inside a statistics query with inheritedQueries
+	pipelineStatisticsEnabled = settings.pipelineStatistics && supportedFeatures.pipelineStatisticsQuery && supportedFeatures.inheritedQueries;
+	deviceFeatures.pipelineStatisticsQuery = pipelineStatisticsEnabled ? VK_TRUE : VK_FALSE;
+	deviceFeatures.inheritedQueries = pipelineStatisticsEnabled ? VK_TRUE : VK_FALSE;
+
+	//The descriptor heap. Shaders index its arrays with push constants, which are dynamically uniform
+	bindlessEnabled = settings.bindless && deviceInfo.descriptorIndexingSupported;
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+	if (bindlessEnabled)
+	{
+		deviceFeatures.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+		deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+		indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+		indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	}
+
 	//Create logical device
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = bindlessEnabled ? &indexingFeatures : nullptr;
 
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueInfos.size());
 	createInfo.pQueueCreateInfos = queueInfos.data();
@@ -290,8 +624,14 @@ void TriangleApplication::CreateLogicalDevice()
 	createInfo.pEnabledFeatures = &deviceFeatures;
 
 	//Set the swap chain supported extensions
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	auto extensions = GetRequiredDeviceExtensions();
+	if (bindlessEnabled)
+	{
+		extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+	}
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+	createInfo.ppEnabledExtensionNames = extensions.data();
 
 
 	if (enableValidationLayers)
@@ -349,10 +689,23 @@ void TriangleApplication::CreateLogicalDevice()
 	//	throw std::runtime_error("Failed to create logical device");
 	//}
 
-	//Create queue handles
+	//Create queue handles. Families that fell back to the graphics family share its queue
 	vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicsQueue);
-	vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue);
+	vkGetDeviceQueue(device, indices.computeFamily, 0, &computeQueue);
+	vkGetDeviceQueue(device, indices.transferFamily, 0, &transferQueue);
 
+	if (!settings.headless)
+		vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue);
+
+}
+
+//Returns the device extensions we depend on. Headless rendering never presents, so it needs no swap chain extension
+std::vector<const char*> TriangleApplication::GetRequiredDeviceExtensions()
+{
+	if (settings.headless)
+		return {};
+
+	return deviceExtensions;
 }
 
 //Iterates through all the extensions available for the device. Compares withe the Vulkan SDK extensions for the Swap chain.
@@ -365,6 +718,7 @@ bool TriangleApplication::CheckDeviceExtensionSupport(VkPhysicalDevice device)
 	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
+	auto deviceExtensions = GetRequiredDeviceExtensions();
 	std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 	for (const auto& extension : availableExtensions)
 	{
@@ -427,28 +781,52 @@ VkSurfaceFormatKHR TriangleApplication::ChooseSwapSurfaceFormat(const std::vecto
 	return availableFormats[0];
 }
 
-//Returns the best possible present mode
+//Returns the present mode the present policy prefers among the available ones. FIFO is the fallback every device supports
 VkPresentModeKHR TriangleApplication::ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
 {
-	//By default FIFO
-	VkPresentModeKHR bestPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	std::vector<VkPresentModeKHR> preferred;
 
-	for (const auto& availablePresentMode : availablePresentModes)
+	switch (settings.presentPolicy)
 	{
-		//Best if Mailbox, provides tripple buffering and avaoids tearing
-		if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
-		{
-			return availablePresentMode;
-		}
+	case PresentPolicy::Default:
+	case PresentPolicy::LowLatency:
+		//Mailbox replaces queued images, so what is shown is never older than one frame, and it does not tear
+		preferred = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+		break;
+	case PresentPolicy::MaxThroughput:
+		//Immediate never waits for vertical blank. Results in tearing though
+		preferred = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR };
+		break;
+	case PresentPolicy::PowerSaving:
+		//FIFO lets the CPU and GPU sleep until the display wants the next image
+		break;
+	}
 
-		//In case even FIFO is not found directly send for rendering. Results in tearimg though
-		else if(availablePresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR)
-		{
-			bestPresentMode = availablePresentMode;
-		}
+	for (auto mode : preferred)
+	{
+		if (std::find(availablePresentModes.begin(), availablePresentModes.end(), mode) != availablePresentModes.end())
+			return mode;
+	}
+
+	return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+//Fewer images mean less queueing ahead of the display, more mean the GPU is less likely to wait for a free one
+uint32_t TriangleApplication::ChooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilities)
+{
+	uint32_t imageCount = capabilities.minImageCount;
+
+	if (settings.presentPolicy == PresentPolicy::MaxThroughput)
+		imageCount += 2;
+	else if (settings.presentPolicy == PresentPolicy::Default || settings.presentPolicy == PresentPolicy::PowerSaving)
+		imageCount += 1;
+
+	if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount)
+	{
+		imageCount = capabilities.maxImageCount;
 	}
 
-	return bestPresentMode;
+	return imageCount;
 }
 
 //Sets the resolution of the swap chain
@@ -460,27 +838,29 @@ VkExtent2D TriangleApplication::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR
 		return capabilities.currentExtent;
 	}
 
-	VkExtent2D actualExtent = { WIDTH, HEIGHT };
+	//The surface takes its size from the swap chain, so use the window's size in pixels
+	int width, height;
+	glfwGetFramebufferSize(window, &width, &height);
+
+	VkExtent2D actualExtent = { (uint32_t)width, (uint32_t)height };
 	actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
 	actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
 
 	return actualExtent;
 }
 
+//Passing the current swap chain as oldSwapChain lets the presentation engine hand its resources over, and lets images
+//already acquired from it still be presented. The old one is released to the deletion queue once replaced
 void TriangleApplication::CreateSwapChain()
 {
-	SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(physicalDevice);
+	const SwapChainSupportDetails& swapChainSupport = deviceInfo.swapChainSupport;
 
 	VkSurfaceFormatKHR surfaceFormat = ChooseSwapSurfaceFormat(swapChainSupport.formats);
 	VkPresentModeKHR presentMode = ChooseSwapPresentMode(swapChainSupport.presentModes);
 	VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities);
 
 	//Set the queue length in swap chain = number of images in swap chain
-	uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-	if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
-	{
-		imageCount = swapChainSupport.capabilities.maxImageCount;
-	}
+	uint32_t imageCount = ChooseSwapImageCount(swapChainSupport.capabilities);
 
 	VkSwapchainCreateInfoKHR swapChainInfo = {};
 	swapChainInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -492,7 +872,7 @@ void TriangleApplication::CreateSwapChain()
 	swapChainInfo.imageArrayLayers = 1;
 	swapChainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
-	QueueFamilyIndices indices = FindQueueFamilies(physicalDevice);
+	const QueueFamilyIndices& indices = queueFamilies;
 	uint32_t queuFamilyIndices[] = { (uint32_t)indices.graphicsFamily, (uint32_t)indices.presentFamily };
 
 	if (indices.graphicsFamily != indices.presentFamily)
@@ -512,14 +892,16 @@ void TriangleApplication::CreateSwapChain()
 	swapChainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	swapChainInfo.presentMode = presentMode;
 	swapChainInfo.clipped = VK_TRUE;
-	swapChainInfo.oldSwapchain = VK_NULL_HANDLE;
+	swapChainInfo.oldSwapchain = swapChain;
 
-	
-	if (vkCreateSwapchainKHR(device, &swapChainInfo, NULL, &swapChain))
+	VkSwapchainKHR newSwapChain;
+	if (vkCreateSwapchainKHR(device, &swapChainInfo, NULL, &newSwapChain))
 	{
 		throw std::runtime_error("Failed to create a swap chain");
 	}
 
+	swapChain = deletionQueue.Own(newSwapChain, vkDestroySwapchainKHR);
+
 
 	//retrieve images 
 	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
@@ -530,12 +912,107 @@ void TriangleApplication::CreateSwapChain()
 	swapChainExtent = extent;
 }
 
+//Replaces the swap chain, its image views and render targets without waiting for the device. The render graph and pipelines
+//stay, since the surface format does not change and the viewport is dynamic. Returns false when the window is closing
+bool TriangleApplication::RecreateSwapChain()
+{
+	//A minimized window has no extent to create a swap chain with
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(window, &width, &height);
+	while ((width == 0 || height == 0) && !glfwWindowShouldClose(window))
+	{
+		glfwWaitEvents();
+		glfwGetFramebufferSize(window, &width, &height);
+	}
 
-void TriangleApplication::CreateImageView()
+	if (width == 0 || height == 0)
+		return false;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	//Only the capabilities change with the surface. Formats and present modes stay cached
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &deviceInfo.swapChainSupport.capabilities);
+
+	//Every frame started so far may have recorded against the current views and render targets. The deletion queue keeps them,
+	//and the old swap chain, until those frames have retired
+	swapChainImageViews.clear();
+	renderTargetsOwner.Reset();
+
+	CreateSwapChain();
+	CreateImageView();
+	CreateRenderTargets();
+
+	//Waits on the old images' fences are covered by the frame slot fences
+	imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+	swapChainOutdated = false;
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	swapChainRecreations++;
+	worstRecreationTime = std::max(worstRecreationTime, elapsed.count());
+
+	std::cout << "swap chain recreated at " << swapChainExtent.width << "x" << swapChainExtent.height << " in " << elapsed.count() << " ms ("
+		<< swapChainRecreations << " so far, worst " << worstRecreationTime << " ms)" << std::endl;
+
+	return true;
+}
+
+//The render pass only needs the format, so it and the pipelines can be set up before the swap chain exists
+VkFormat TriangleApplication::ChooseColorFormat()
+{
+	if (settings.headless)
+		return VK_FORMAT_B8G8R8A8_UNORM;
+
+	return ChooseSwapSurfaceFormat(deviceInfo.swapChainSupport.formats).format;
+}
+
+//Creates the ring of device-owned images that headless mode renders into in place of the swap chain images
+void TriangleApplication::CreateOffscreenImages()
 {
+	swapChainImageFormat = ChooseColorFormat();
+	swapChainExtent = { WIDTH, HEIGHT };
+
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, swapChainImageFormat, &formatProperties);
+
+	if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT))
+	{
+		throw std::runtime_error("Offscreen image format is not supported as a color attachment");
+	}
+
+	swapChainImages.resize(settings.offscreenImageCount);
+
+	for (size_t i = 0; i < swapChainImages.size(); i++)
+	{
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = swapChainImageFormat;
+		imageInfo.extent = { swapChainExtent.width, swapChainExtent.height, 1 };
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		if (vkCreateImage(device, &imageInfo, nullptr, &swapChainImages[i]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create an offscreen image");
+		}
 
-	swapChainImageViews.resize(swapChainImages.size());
+		VkImage image = swapChainImages[i];
+		MemoryAllocation memory = memoryAllocator.AllocateForImage(image, imageInfo.tiling, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		offscreenImageOwners.push_back(deletionQueue.Own([this, image, memory]() mutable
+		{
+			vkDestroyImage(device, image, nullptr);
+			memoryAllocator.Free(memory);
+		}));
+	}
+}
 
+void TriangleApplication::CreateImageView()
+{
 	for (size_t i = 0; i < swapChainImages.size(); i++)
 	{
 		VkImageViewCreateInfo imageViewInfo = {};
@@ -555,305 +1032,1973 @@ void TriangleApplication::CreateImageView()
 		imageViewInfo.subresourceRange.baseArrayLayer = 0;
 		imageViewInfo.subresourceRange.layerCount = 1;
 
-		if (vkCreateImageView(device, &imageViewInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS) 
+		VkImageView imageView;
+		if (vkCreateImageView(device, &imageViewInfo, nullptr, &imageView) != VK_SUCCESS) 
 		{
 			throw std::runtime_error("failed to create image views!");
 		}
 
-
+		swapChainImageViews.push_back(deletionQueue.Own(imageView, vkDestroyImageView));
 	}
 }
 
-void TriangleApplication::CreateGraphicsPipeline()
+//Creates the pipeline cache, seeded from disk when the saved data was produced by this exact device and driver
+//Only touches the file, so it can run before there is a device to check the data against
+std::vector<char> TriangleApplication::ReadPipelineCacheFile()
 {
-	//call the readFile() to load the bytecode of the two shader files
-	auto vertShaderCode = readFile("Shaders/shader.vert");
-	auto fragShaderCode = readFile("Shaders/shaders.frag");
-
-	//Create the shader module to wrap the shaders before passing them to the pipeline
-	VkShaderModule vertShaderModule = CreateShaderModule(vertShaderCode);
-	VkShaderModule fragShaderModule = CreateShaderModule(fragShaderCode);
-
-	//Creates the shader int the pipeline
-	VkPipelineShaderStageCreateInfo vertShaderInfo = {};
-	vertShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertShaderInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderInfo.module = vertShaderModule;
-	vertShaderInfo.pName = "main";
-
-	VkPipelineShaderStageCreateInfo fragShaderInfo = {};
-	fragShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;;
-	fragShaderInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderInfo.module = fragShaderModule;
-	fragShaderInfo.pName = "main";
-
-	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderInfo, fragShaderInfo };
-
-	//Vertex input creation - type of data passed to the vertex shader
-	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 0;
-	//vertexInputInfo.pVertexBindingDescriptions = nullptr;
-	vertexInputInfo.vertexAttributeDescriptionCount = 0;
-	//vertexInputInfo.pVertexAttributeDescriptions = nullptr;
-
-	//Input Assembly - specifies the primitives
-	VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo;
-	inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
-
-	//Viewport - region of the framebuffer the output will be rendered to
-	//Scissors - region in the viewport the pixels will be stored
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)swapChainExtent.width;
-	viewport.height = (float)swapChainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
+	std::vector<char> cacheData;
 
-	VkRect2D scissor = {};
-	scissor.offset = { 0, 0 };
-	scissor.extent = swapChainExtent;
+	if (settings.pipelineCachePath.empty())
+		return cacheData;
 
-	VkPipelineViewportStateCreateInfo viewportInfo = {};
-	viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportInfo.viewportCount = 1;
-	viewportInfo.pViewports = &viewport;
-	viewportInfo.scissorCount = 1;
-	viewportInfo.pScissors = &scissor;
-
-	//Rasterizer - Takes the vertices from the vertex shader and converts them into fragments.
-	VkPipelineRasterizationStateCreateInfo rasterizerInfo = {};
-	rasterizerInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizerInfo.depthClampEnable = VK_FALSE;
-	rasterizerInfo.rasterizerDiscardEnable = VK_FALSE;
-	rasterizerInfo.polygonMode = VK_POLYGON_MODE_FILL;
-	rasterizerInfo.lineWidth = 1.0f;
-	rasterizerInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-	rasterizerInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
-	rasterizerInfo.depthBiasEnable = VK_FALSE;
-	rasterizerInfo.depthBiasConstantFactor = 0.0f;
-	rasterizerInfo.depthBiasClamp = 0.0f;
-	rasterizerInfo.depthBiasSlopeFactor = 0.0f;
-
-	//Multisampling - Performs anti-aliasing.
-	//Combines the fragment shader output that maps to the same pixel.
-	VkPipelineMultisampleStateCreateInfo multiSampleInfo = {};
-	multiSampleInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multiSampleInfo.sampleShadingEnable = VK_FALSE;
-	multiSampleInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-	//multiSampleInfo.minSampleShading = 1.0f;
-	//multiSampleInfo.pSampleMask = nullptr;
-	//multiSampleInfo.alphaToCoverageEnable = VK_FALSE;
-	//multiSampleInfo.alphaToOneEnable = VK_FALSE;
-
-	//Color blending - after the fragment shader returns the color it needs to be combined with the old color.
-	VkPipelineColorBlendAttachmentState colorBlendAttachmentInfo = {};
-	colorBlendAttachmentInfo.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachmentInfo.blendEnable = VK_FALSE;
-	//colorBlendAttachmentInfo.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-	//colorBlendAttachmentInfo.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-	//colorBlendAttachmentInfo.colorBlendOp = VK_BLEND_OP_ADD;
-	//colorBlendAttachmentInfo.srcAlphaBlendFactor - VK_BLEND_FACTOR_ONE;
-	//colorBlendAttachmentInfo.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-	//colorBlendAttachmentInfo.alphaBlendOp = VK_BLEND_OP_ADD;
-
-	VkPipelineColorBlendStateCreateInfo colorBlendInfo = {};
-	colorBlendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlendInfo.logicOpEnable = VK_FALSE;
-	colorBlendInfo.logicOp = VK_LOGIC_OP_COPY;
-	colorBlendInfo.attachmentCount = 1;
-	colorBlendInfo.pAttachments = &colorBlendAttachmentInfo;
-	colorBlendInfo.blendConstants[0] = 0.0f;
-	colorBlendInfo.blendConstants[1] = 0.0f;
-	colorBlendInfo.blendConstants[2] = 0.0f;
-	colorBlendInfo.blendConstants[3] = 0.0f;
-
-	//Pipeline layout - use to specify values that need to be passed to the shaders
-	VkPipelineLayoutCreateInfo layoutInfo = {};
-	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	layoutInfo.setLayoutCount = 0;
-	//layoutInfo.pSetLayouts = nullptr;
-	layoutInfo.pushConstantRangeCount = 0;
-	//layoutInfo.pPushConstantRanges = nullptr;
+	std::ifstream file(settings.pipelineCachePath, std::ios::ate | std::ios::binary);
 
-	if (vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+	//A missing file just means a cold start
+	if (file.is_open())
 	{
-		throw std::runtime_error("failed to create pipeline layout");
-	}
-
-	//Create Graphics pipeline
-	VkGraphicsPipelineCreateInfo graphicsPipelineInfo = {};
-	graphicsPipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	graphicsPipelineInfo.stageCount = 2;
-	graphicsPipelineInfo.pStages = shaderStages;
-	graphicsPipelineInfo.pVertexInputState = &vertexInputInfo;
-	graphicsPipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
-	graphicsPipelineInfo.pViewportState = &viewportInfo;
-	graphicsPipelineInfo.pRasterizationState = &rasterizerInfo;
-	graphicsPipelineInfo.pMultisampleState = &multiSampleInfo;
-	graphicsPipelineInfo.pColorBlendState = &colorBlendInfo;
-	graphicsPipelineInfo.layout = pipelineLayout;
-	graphicsPipelineInfo.renderPass = renderPass;
-	graphicsPipelineInfo.subpass = 0;
-	graphicsPipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+		cacheData.resize((size_t)file.tellg());
+		file.seekg(0);
+		file.read(cacheData.data(), cacheData.size());
 
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphicsPipelineInfo, nullptr, &graphicsPipelines) != VK_SUCCESS)
-	{
-		throw std::runtime_error("failed to create Graphics Pipeline");
+		if (!file)
+			cacheData.clear();
 	}
 
-	//Delete the modules	
-	vkDestroyShaderModule(device, fragShaderModule, nullptr);
-	vkDestroyShaderModule(device, vertShaderModule, nullptr);
+	return cacheData;
 }
 
-VkShaderModule TriangleApplication::CreateShaderModule(std::vector<char>& code)
+void TriangleApplication::CreatePipelineCache(std::vector<char> cacheData)
 {
-	VkShaderModuleCreateInfo shaderModuleInfo;
-	shaderModuleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	shaderModuleInfo.codeSize = code.size();
-	shaderModuleInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-
-	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(device, &shaderModuleInfo, nullptr, &shaderModule) != VK_SUCCESS)
+	if (!cacheData.empty() && !IsPipelineCacheCompatible(cacheData))
 	{
-		throw std::runtime_error("failed to create a shader module");
+		std::cerr << "Discarding stale or corrupt pipeline cache " << settings.pipelineCachePath << std::endl;
+		cacheData.clear();
 	}
 
-	return shaderModule;
-}
-
-void TriangleApplication::CreateRenderPass()
-{
-	VkAttachmentDescription colorAttachment = {};
-	colorAttachment.format = swapChainImageFormat;
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-	//Subpass - subsequent rendering operations that depend on the content of framebuffers in previous passes
-	VkAttachmentReference colorAttachmentRef = {};
-	colorAttachmentRef.attachment = 0;
-	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = cacheData.size();
+	cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
 
-	VkSubpassDescription subPassInfo = {};
-	subPassInfo.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subPassInfo.colorAttachmentCount = 1;
-	subPassInfo.pColorAttachments = &colorAttachmentRef;
+	VkPipelineCache cache;
+	VkResult result = vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache);
 
-	//Create render pass
-	VkRenderPassCreateInfo renderPassInfo = {};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = 1;
-	renderPassInfo.pAttachments = &colorAttachment;
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subPassInfo;
+	//The driver can still reject data that passed the header checks. Fall back to an empty cache rather than failing
+	if (result != VK_SUCCESS && !cacheData.empty())
+	{
+		std::cerr << "Driver rejected pipeline cache " << settings.pipelineCachePath << ", starting empty" << std::endl;
+		cacheInfo.initialDataSize = 0;
+		cacheInfo.pInitialData = nullptr;
+		result = vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache);
+	}
 
-	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
+	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create render pass");
+		throw std::runtime_error("Failed to create pipeline cache");
 	}
 
+	pipelineCache = deletionQueue.Own(cache, vkDestroyPipelineCache);
 }
 
-void TriangleApplication::InitializeVulkan()
+//Checks the VkPipelineCacheHeaderVersionOne header against the vendor, device and cache UUID of the selected device
+bool TriangleApplication::IsPipelineCacheCompatible(const std::vector<char>& cacheData)
 {
-	//Create a connection between your application and Vulkan library.
-	CreateInstance();
-	SetUpDebugCallBack();
-
-	//Create a window surface that is used to render things on the screen. Created a connection between Vulkan and window system
-	CreateSurface();
-
-	//Selects a graphics card that supports the features we need.
-	SelectPhysicalDevice();
+	const size_t headerSize = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
 
-	//Creates a logical device that interfaces with the Physical device
-	CreateLogicalDevice();
+	if (cacheData.size() < headerSize)
+		return false;
 
-	//Creates Swap Chain that handles the queue of images that are waiting to be rendered on the screen
-	CreateSwapChain();
+	uint32_t headerLength, headerVersion, vendorID, deviceID;
+	uint8_t cacheUUID[VK_UUID_SIZE];
+	memcpy(&headerLength, cacheData.data(), sizeof(uint32_t));
+	memcpy(&headerVersion, cacheData.data() + 4, sizeof(uint32_t));
+	memcpy(&vendorID, cacheData.data() + 8, sizeof(uint32_t));
+	memcpy(&deviceID, cacheData.data() + 12, sizeof(uint32_t));
+	memcpy(cacheUUID, cacheData.data() + 16, VK_UUID_SIZE);
 
-	//Use to view an image. Specifies how to access an image and what part of the image should be accessed
-	CreateImageView();
+	if (headerLength < headerSize || headerLength > cacheData.size() || headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+		return false;
 
-	//Tells the Vulkan about the framebuffer attachments that will be used while rendering.
-	//Specifies how many depth and color buffers, how many samples to handle each and how their contents should be handled
-	CreateRenderPass();
+	const VkPhysicalDeviceProperties& deviceProperties = deviceInfo.properties;
 
-	//Creates the Graphics Pipeline
-	CreateGraphicsPipeline();
+	return vendorID == deviceProperties.vendorID && deviceID == deviceProperties.deviceID &&
+		memcmp(cacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
 }
 
-void TriangleApplication::MainLoop()
+//Writes the pipeline cache back to disk so the next launch can skip shader compilation
+void TriangleApplication::SavePipelineCache()
 {
-	while (!glfwWindowShouldClose(window))
-	{
-		glfwPollEvents();								//Checks for events such as button clicks till the window is closed
-	}
-}
+	if (pipelineCache == VK_NULL_HANDLE || settings.pipelineCachePath.empty())
+		return;
 
-void TriangleApplication::CleanUp()
-{
-	vkDestroyPipeline(device, graphicsPipelines, nullptr);
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+		return;
 
-	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	std::vector<char> cacheData(dataSize);
+	if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, cacheData.data()) != VK_SUCCESS)
+		return;
 
-	vkDestroyRenderPass(device, renderPass, nullptr);
+	cacheData.resize(dataSize);
 
-	for (auto imageView : swapChainImageViews)
+	//Failing to save only costs the next launch a cold start, so do not let it abort shutdown
+	try
 	{
-		vkDestroyImageView(device, imageView, nullptr);
+		writeFileAtomic(settings.pipelineCachePath, cacheData);
+	}
+	catch (const std::runtime_error& err)
+	{
+		std::cerr << err.what() << std::endl;
 	}
- 
-	vkDestroySwapchainKHR(device, swapChain, nullptr);
-
-	vkDestroyDevice(device, nullptr);
-
-	if (enableValidationLayers)
-		DestroyDebugReportCallbackEXT(instance, callback, nullptr);
-
-	vkDestroySurfaceKHR(instance, surface, nullptr);
-	vkDestroyInstance(instance, nullptr);
-
-	glfwDestroyWindow(window);
-	glfwTerminate();
 }
 
-VKAPI_ATTR VkBool32 VKAPI_CALL TriangleApplication::debugCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objType, uint64_t obj, size_t location, int32_t code, const char * layerPrefix, const char * msg, void * userData)
+//Maps the packed SPIR-V archive, or points at the copy compiled into the executable
+void TriangleApplication::LoadShaderArchive()
 {
-	std::cerr << "validation layer: " << msg << std::endl;
-
-	return VK_FALSE;
+#ifdef EMBED_SHADER_ARCHIVE
+	shaderArchive.OpenMemory(SHADER_ARCHIVE_DATA, sizeof(SHADER_ARCHIVE_DATA));
+#else
+	shaderArchive.Open(settings.shaderArchivePath);
+#endif
 }
 
-std::vector<char> TriangleApplication::readFile(const std::string & filename)
+//Creates the pipeline layout and queues the pipeline builds on the worker pool. Only the main pipeline is waited for, by the first frame
+void TriangleApplication::CreateGraphicsPipeline()
 {
+	//Pipeline layout - use to specify values that need to be passed to the shaders.
+	//Set 0 holds the frame uniforms, set 1 the descriptor heap. The push constants carry either a single draw's parameters or
+	//the heap handles of an instanced draw's arrays
+	VkDescriptorSetLayout setLayouts[] = { descriptorSetLayout, descriptorHeap.GetLayout() };
+	VkPushConstantRange pushConstantRange = PushConstantRange<DrawParameters, DrawHandles>(VK_SHADER_STAGE_VERTEX_BIT);
 
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
-	
-	if (!file.is_open())
+	VkPipelineLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layoutInfo.setLayoutCount = bindlessEnabled ? 2 : 1;
+	layoutInfo.pSetLayouts = setLayouts;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	VkPipelineLayout layout;
+	if (vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline layout");
+	}
+	pipelineLayout = deletionQueue.Own(layout, vkDestroyPipelineLayout);
+
+	pipelineBuilder.Initialize(device, pipelineCache, &shaderArchive, workerPool.get());
+	deletionQueue.OwnUntilShutdown([this]()
+	{
+		pipelineBuilder.DestroyPipelines();
+	});
+
+	PipelineDescription description;
+	description.vertexShader = settings.drawParameters == DrawParameterSource::DynamicUniforms ? "vert_uniforms.spv" : "vert.spv";
+	description.fragmentShader = texturingEnabled ? "textured.spv" : "frag.spv";
+	description.layout = pipelineLayout;
+	description.renderPass = renderGraph.GetRenderPass(mainPass);
+	description.subpass = renderGraph.GetSubpass(mainPass);
+	description.vertexBindings = Vertex::GetBindingDescriptions();
+	description.vertexAttributes = Vertex::GetAttributeDescriptions();
+	description.samples = sampleCount;
+	description.depthTest = depthFormat != VK_FORMAT_UNDEFINED;
+	description.depthWrite = description.depthTest;
+
+	//The main pipeline is queued first so it is picked up ahead of the variants
+	graphicsPipelineFuture = pipelineBuilder.Request(description);
+
+	if (instanceCapacity > 0)
+		instancedPipelineFuture = pipelineBuilder.Request(GetInstancedPipelineDescription(description));
+	pipelineVariants = pipelineBuilder.RequestBatch(GetPipelineVariants(description, settings.pipelineVariantCount));
+}
+
+//Same state as base, fed from the per-vertex binding plus one instance rate binding per instance array, or from the heap
+PipelineDescription TriangleApplication::GetInstancedPipelineDescription(const PipelineDescription& base)
+{
+	PipelineDescription description = base;
+	description.vertexShader = "instanced.spv";
+	description.fragmentShader = "frag.spv";
+
+	//The instance arrays come from the descriptor heap, only the vertices are vertex inputs
+	if (bindlessInstances)
+	{
+		description.vertexShader = "bindless.spv";
+		return description;
+	}
+
+	VkVertexInputBindingDescription transformBinding = {};
+	transformBinding.binding = 1;
+	transformBinding.stride = sizeof(InstanceTransform);
+	transformBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+	VkVertexInputBindingDescription colorBinding = {};
+	colorBinding.binding = 2;
+	colorBinding.stride = sizeof(InstanceColor);
+	colorBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+	description.vertexBindings.push_back(transformBinding);
+	description.vertexBindings.push_back(colorBinding);
+
+	VkVertexInputAttributeDescription transformAttribute = {};
+	transformAttribute.binding = 1;
+	transformAttribute.location = 2;
+	transformAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	transformAttribute.offset = 0;
+
+	VkVertexInputAttributeDescription colorAttribute = {};
+	colorAttribute.binding = 2;
+	colorAttribute.location = 3;
+	colorAttribute.format = VK_FORMAT_R8G8B8A8_UNORM;
+	colorAttribute.offset = 0;
+
+	description.vertexAttributes.push_back(transformAttribute);
+	description.vertexAttributes.push_back(colorAttribute);
+
+	return description;
+}
+
+//Cycles through the blend, cull, winding, topology and depth test combinations a real workload switches between.
+//Every variant is a distinct state, so each one is a real compile rather than a hit on an earlier request
+std::vector<PipelineDescription> TriangleApplication::GetPipelineVariants(const PipelineDescription& base, uint32_t count)
+{
+	const VkCullModeFlags cullModes[] = { VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_BIT };
+	const VkFrontFace frontFaces[] = { VK_FRONT_FACE_CLOCKWISE, VK_FRONT_FACE_COUNTER_CLOCKWISE };
+	const VkPrimitiveTopology topologies[] = { VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP };
+	const bool blendModes[] = { false, true };
+	const VkCompareOp depthCompareOps[] = { VK_COMPARE_OP_LESS, VK_COMPARE_OP_GREATER_OR_EQUAL, VK_COMPARE_OP_ALWAYS };
+
+	//The depth compare ops all differ from the base pipeline's, so no variant is the main pipeline again
+	const uint32_t distinctCount = 3 * 2 * 2 * 2 * 3;
+	if (count > distinctCount)
+	{
+		std::cout << "pipeline variants clamped from " << count << " to the " << distinctCount << " distinct states" << std::endl;
+		count = distinctCount;
+	}
+
+	std::vector<PipelineDescription> variants(count, base);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		variants[i].cullMode = cullModes[i % 3];
+		variants[i].frontFace = frontFaces[(i / 3) % 2];
+		variants[i].topology = topologies[(i / 6) % 2];
+		variants[i].blendEnable = blendModes[(i / 12) % 2];
+		variants[i].depthCompareOp = depthCompareOps[(i / 24) % 3];
+	}
+
+	return variants;
+}
+
+void TriangleApplication::CreateUploadRing()
+{
+	VkDeviceSize bytesPerFrame = settings.uploadRingSize;
+
+	//Dynamic offsets have to be aligned, so every draw's parameters take up a whole alignment unit
+	if (settings.drawParameters == DrawParameterSource::DynamicUniforms)
+	{
+		VkDeviceSize alignment = deviceInfo.properties.limits.minUniformBufferOffsetAlignment;
+		drawParameterStride = (sizeof(DrawParameters) + alignment - 1) & ~(alignment - 1);
+		bytesPerFrame += drawParameterStride * drawParameters.size();
+	}
+
+	uploadRing.Initialize(device, memoryAllocator, deviceInfo.properties.limits, bytesPerFrame, settings.framesInFlight);
+	deletionQueue.OwnUntilShutdown([this]()
+	{
+		uploadRing.Destroy();
+	});
+}
+
+void TriangleApplication::CreateDescriptorSetLayout()
+{
+	//A dynamic uniform buffer lets every frame point the same descriptor set at its own region of the ring
+	VkDescriptorSetLayoutBinding uniformBinding = {};
+	uniformBinding.binding = 0;
+	uniformBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	uniformBinding.descriptorCount = 1;
+	uniformBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	//DrawParameters, for the dynamic uniform source. Pipelines that take them as push constants leave it unused
+	VkDescriptorSetLayoutBinding drawBinding = uniformBinding;
+	drawBinding.binding = 1;
+
+	VkDescriptorSetLayoutBinding bindings[] = { uniformBinding, drawBinding };
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = bindings;
+
+	VkDescriptorSetLayout setLayout;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor set layout");
+	}
+	descriptorSetLayout = deletionQueue.Own(setLayout, vkDestroyDescriptorSetLayout);
+}
+
+void TriangleApplication::CreateDescriptorSet()
+{
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSize.descriptorCount = 2;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create descriptor pool");
+	}
+	descriptorPool = deletionQueue.Own(pool, vkDestroyDescriptorPool);
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = descriptorSetLayout.GetAddress();
+
+	if (vkAllocateDescriptorSets(device, &allocInfo, &uniformDescriptorSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate descriptor set");
+	}
+
+	//Written once. Frames and draws only change the dynamic offsets when binding
+	VkDescriptorBufferInfo bufferInfos[2] = {};
+	bufferInfos[0].buffer = uploadRing.GetBuffer();
+	bufferInfos[0].offset = 0;
+	bufferInfos[0].range = sizeof(FrameUniforms);
+	bufferInfos[1].buffer = uploadRing.GetBuffer();
+	bufferInfos[1].offset = 0;
+	bufferInfos[1].range = sizeof(DrawParameters);
+
+	VkWriteDescriptorSet descriptorWrites[2] = {};
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = uniformDescriptorSet;
+		descriptorWrites[i].dstBinding = i;
+		descriptorWrites[i].dstArrayElement = 0;
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets(device, 2, descriptorWrites, 0, nullptr);
+}
+
+//Lays the single draws out on a square grid over the view. One draw covers the view the way the triangle always has
+void TriangleApplication::CreateDrawParameters()
+{
+	uint32_t drawCount = std::max(settings.drawCount, 1u);
+	uint32_t gridSize = (uint32_t)std::ceil(std::sqrt((double)drawCount));
+	float cellSize = 2.0f / gridSize;
+
+	drawParameters.resize(drawCount);
+	for (uint32_t i = 0; i < drawCount; i++)
+	{
+		drawParameters[i].offset[0] = -1.0f + cellSize * ((i % gridSize) + 0.5f);
+		drawParameters[i].offset[1] = -1.0f + cellSize * ((i / gridSize) + 0.5f);
+		drawParameters[i].scale = cellSize * 0.5f;
+		drawParameters[i].rotation = 0.0f;
+		drawParameters[i].texture = TextureStreamer::invalidSlot;
+		drawParameters[i].sampler = 0;
+	}
+}
+
+//Room for every buffer, image and sampler the application will register, bound as set 1 of every graphics pipeline
+void TriangleApplication::CreateDescriptorHeap()
+{
+	if (!bindlessEnabled)
+		return;
+
+	descriptorHeap.Initialize(device, deviceInfo.descriptorIndexingProperties, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+		65536, 65536, 1024);
+	debugMessenger.SetObjectName(device, VK_OBJECT_TYPE_DESCRIPTOR_SET, (uint64_t)descriptorHeap.GetSet(), "Descriptor heap");
+	deletionQueue.OwnUntilShutdown([this]()
+	{
+		descriptorHeap.Destroy();
+	});
+}
+
+//Starts decoding the texture on the worker pool. The draws sample it from the first frame that finds its mip tail resident
+void TriangleApplication::CreateTextureStreamer()
+{
+	if (settings.texturePath.empty())
+		return;
+
+	//Streamed levels are published through heap slots, which the fragment shader indexes
+	if (!bindlessEnabled)
+	{
+		std::cout << "Texturing needs the descriptor heap, drawing untextured" << std::endl;
+		return;
+	}
+
+	textureStreamer.Initialize(device, memoryAllocator, asyncTransferQueue, queueFamilies.graphicsFamily, *workerPool, descriptorHeap,
+		settings.framesInFlight, settings.textureUploadBudget);
+	deletionQueue.OwnUntilShutdown([this]()
+	{
+		textureStreamer.Destroy();
+	});
+	texture = textureStreamer.Load(settings.texturePath);
+	texturingEnabled = true;
+}
+
+//Submits this frame's share of the texture uploads and points the draws at the texture's latest slot.
+//Finished uploads are queued for the graphics queue to acquire before this frame samples them
+void TriangleApplication::UpdateTextures()
+{
+	if (!texturingEnabled)
+		return;
+
+	std::vector<AsyncWork> completed = textureStreamer.Update(frameCount);
+	pendingAsyncWork.insert(pendingAsyncWork.end(), completed.begin(), completed.end());
+
+	uint32_t slot = textureStreamer.GetSlot(texture);
+	if (slot == textureSlot)
+		return;
+
+	//Only when a finer level has arrived. Recording reads drawParameters, and has not started yet
+	for (auto& parameters : drawParameters)
+	{
+		parameters.texture = slot;
+		parameters.sampler = textureStreamer.GetSamplerSlot();
+	}
+	textureSlot = slot;
+}
+
+//Writes this frame's uniforms and vertices straight into its region of the mapped ring
+void TriangleApplication::UpdateFrameData(FrameData& frame)
+{
+	const Vertex vertices[] = {
+		{ { 0.0f, -0.5f }, { 1.0f, 0.0f, 0.0f } },
+		{ { 0.5f, 0.5f }, { 0.0f, 1.0f, 0.0f } },
+		{ { -0.5f, 0.5f }, { 0.0f, 0.0f, 1.0f } }
+	};
+
+	const uint16_t indices[] = { 0, 1, 2 };
+
+	UploadAllocation vertexAllocation = uploadRing.AllocateVertices(sizeof(vertices));
+	memcpy(vertexAllocation.data, vertices, sizeof(vertices));
+	frame.vertexOffset = vertexAllocation.offset;
+
+	UploadAllocation indexAllocation = uploadRing.Allocate(sizeof(indices), sizeof(uint32_t));
+	memcpy(indexAllocation.data, indices, sizeof(indices));
+	frame.indexOffset = indexAllocation.offset;
+
+	//Spin the triangle around the z axis
+	float angle = frameCount * 0.01f;
+	float c = std::cos(angle);
+	float s = std::sin(angle);
+
+	FrameUniforms uniforms = {};
+	uniforms.transform[0] = c;
+	uniforms.transform[1] = s;
+	uniforms.transform[4] = -s;
+	uniforms.transform[5] = c;
+	uniforms.transform[10] = 1.0f;
+	uniforms.transform[15] = 1.0f;
+
+	//Slowly zoom in and out over the instances, so part of them leaves the view and gets culled
+	float zoom = 1.75f + 0.75f * std::sin(frameCount * 0.005f);
+	uniforms.viewProjection[0] = zoom;
+	uniforms.viewProjection[5] = zoom;
+	uniforms.viewProjection[10] = 1.0f;
+	uniforms.viewProjection[15] = 1.0f;
+
+	//Frustum planes straight from the rows of the view projection matrix, z from 0 to 1 as in Vulkan
+	const float* m = uniforms.viewProjection;
+	for (int plane = 0; plane < 6; plane++)
+	{
+		int row = plane / 2;
+		float sign = (plane % 2 == 0) ? 1.0f : -1.0f;
+		float* p = frame.cullParameters.frustumPlanes[plane];
+
+		for (int column = 0; column < 4; column++)
+		{
+			//The near plane is row 2 on its own, the others are row 3 plus or minus row 0, 1 or 2
+			float rowValue = m[column * 4 + row];
+			p[column] = (plane == 4) ? rowValue : m[column * 4 + 3] + sign * rowValue;
+		}
+
+		float length = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+		for (int component = 0; component < 4; component++)
+		{
+			p[component] /= length;
+		}
+	}
+
+	//The triangle's corners are at most sqrt(0.5) from its center
+	frame.cullParameters.instanceCount = activeInstanceCount;
+	frame.cullParameters.boundingRadius = 0.7072f;
+
+	UploadAllocation uniformAllocation = uploadRing.AllocateUniform(sizeof(uniforms));
+	memcpy(uniformAllocation.data, &uniforms, sizeof(uniforms));
+	frame.uniformOffset = (uint32_t)uniformAllocation.offset;
+}
+
+VkBuffer TriangleApplication::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, MemoryAllocation& allocation)
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create buffer");
+	}
+
+	allocation = memoryAllocator.AllocateForBuffer(buffer, required);
+	return buffer;
+}
+
+//For buffers that live as long as the application. Destroyed together with their memory at shutdown
+void TriangleApplication::OwnBuffer(VkBuffer buffer, MemoryAllocation allocation)
+{
+	deletionQueue.OwnUntilShutdown([this, buffer, allocation]() mutable
+	{
+		vkDestroyBuffer(device, buffer, nullptr);
+		memoryAllocator.Free(allocation);
+	});
+}
+
+void TriangleApplication::CreateAsyncQueues()
+{
+	asyncComputeQueue.Initialize(device, computeQueue, queueFamilies.computeFamily);
+	asyncTransferQueue.Initialize(device, transferQueue, queueFamilies.transferFamily);
+
+	//Destroyed after everything created later. Runs the callbacks still pending, which free staging buffers
+	deletionQueue.OwnUntilShutdown([this]()
+	{
+		asyncComputeQueue.Destroy();
+		asyncTransferQueue.Destroy();
+		pendingAsyncWork.clear();
+	});
+}
+
+//Removes and returns the pending async work meant for the given family. Its consumer has to acquire the transfers and wait on the semaphores
+std::vector<AsyncWork> TriangleApplication::TakePendingAsyncWork(uint32_t dstFamily)
+{
+	std::vector<AsyncWork> taken;
+
+	for (size_t i = 0; i < pendingAsyncWork.size();)
+	{
+		if (pendingAsyncWork[i].dstFamily == dstFamily)
+		{
+			taken.push_back(pendingAsyncWork[i]);
+			pendingAsyncWork.erase(pendingAsyncWork.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	return taken;
+}
+
+//Lays the instances out on a grid covering the screen and uploads them once through a staging buffer on the transfer queue
+void TriangleApplication::CreateInstanceBuffer(uint32_t capacity)
+{
+	instanceCapacity = capacity;
+
+	//The color array starts on a boundary any minStorageBufferOffsetAlignment divides, so the culling pass can bind it
+	instanceColorOffset = ((VkDeviceSize)capacity * sizeof(InstanceTransform) + 255) & ~(VkDeviceSize)255;
+	VkDeviceSize bufferSize = instanceColorOffset + (VkDeviceSize)capacity * sizeof(InstanceColor);
+
+	MemoryAllocation stagingMemory;
+	VkBuffer stagingBuffer = CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingMemory);
+
+	InstanceTransform* transforms = static_cast<InstanceTransform*>(stagingMemory.mappedData);
+	InstanceColor* colors = reinterpret_cast<InstanceColor*>(static_cast<uint8_t*>(stagingMemory.mappedData) + instanceColorOffset);
+
+	uint32_t gridSize = (uint32_t)std::ceil(std::sqrt((double)capacity));
+	float cellSize = 2.0f / gridSize;
+
+	for (uint32_t i = 0; i < capacity; i++)
+	{
+		//Cheap integer hash so neighbouring instances get unrelated rotations and colors
+		uint32_t hash = i * 2654435761u;
+		hash ^= hash >> 15;
+
+		transforms[i].offset[0] = -1.0f + cellSize * ((i % gridSize) + 0.5f);
+		transforms[i].offset[1] = -1.0f + cellSize * ((i / gridSize) + 0.5f);
+		transforms[i].scale = cellSize * 0.9f;
+		transforms[i].rotation = (hash & 0xffff) * (6.2831853f / 65536.0f);
+		colors[i] = hash | 0xff000000u;
+	}
+
+	instanceBuffer = CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceMemory);
+	OwnBuffer(instanceBuffer, instanceMemory);
+	debugMessenger.SetObjectName(device, VK_OBJECT_TYPE_BUFFER, (uint64_t)instanceBuffer, "Instance buffer");
+
+	if (bindlessInstances)
+	{
+		instanceHandles.transformBuffer = descriptorHeap.AllocateBuffer(instanceBuffer, 0, (VkDeviceSize)capacity * sizeof(InstanceTransform));
+		instanceHandles.colorBuffer = descriptorHeap.AllocateBuffer(instanceBuffer, instanceColorOffset, (VkDeviceSize)capacity * sizeof(InstanceColor));
+	}
+
+	VkCommandBuffer commandBuffer = asyncTransferQueue.Begin();
+
+	VkBufferCopy copyRegion = {};
+	copyRegion.size = bufferSize;
+	vkCmdCopyBuffer(commandBuffer, stagingBuffer, instanceBuffer, 1, &copyRegion);
+
+	//Hand the buffer over to the queue that reads it first: the async culling pass, or else the draws
+	bool computeReadsFirst = settings.gpuCulling && settings.asyncCompute;
+
+	BufferOwnershipTransfer transfer;
+	transfer.buffer = instanceBuffer;
+	transfer.srcFamily = queueFamilies.transferFamily;
+	transfer.dstFamily = computeReadsFirst ? queueFamilies.computeFamily : queueFamilies.graphicsFamily;
+	transfer.srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	transfer.srcAccess = VK_ACCESS_TRANSFER_WRITE_BIT;
+	transfer.dstStage = computeReadsFirst ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT :
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	transfer.dstAccess = computeReadsFirst ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+	//The staging buffer lives until the copy has finished, the first frame does not wait for that on the CPU
+	pendingAsyncWork.push_back(asyncTransferQueue.Submit(commandBuffer, {}, { transfer }, transfer.dstFamily, transfer.dstStage,
+		[this, stagingBuffer, stagingMemory]() mutable
+	{
+		vkDestroyBuffer(device, stagingBuffer, nullptr);
+		memoryAllocator.Free(stagingMemory);
+	}));
+}
+
+//Output buffers, descriptors and pipeline of the compute pass that culls the instance buffer
+void TriangleApplication::CreateCullResources()
+{
+	VkDeviceSize instanceBufferSize = instanceColorOffset + (VkDeviceSize)instanceCapacity * sizeof(InstanceColor);
+	VkDeviceSize indirectBufferSize = indirectCommandCount * sizeof(VkDrawIndexedIndirectCommand);
+
+	culledInstanceBuffer = CreateBuffer(instanceBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, culledInstanceMemory);
+	indirectBuffer = CreateBuffer(indirectBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirectMemory);
+	OwnBuffer(culledInstanceBuffer, culledInstanceMemory);
+	OwnBuffer(indirectBuffer, indirectMemory);
+	debugMessenger.SetObjectName(device, VK_OBJECT_TYPE_BUFFER, (uint64_t)culledInstanceBuffer, "Culled instance buffer");
+	debugMessenger.SetObjectName(device, VK_OBJECT_TYPE_BUFFER, (uint64_t)indirectBuffer, "Indirect draw buffer");
+
+	if (bindlessInstances)
+	{
+		culledInstanceHandles.transformBuffer = descriptorHeap.AllocateBuffer(culledInstanceBuffer, 0, (VkDeviceSize)instanceCapacity * sizeof(InstanceTransform));
+		culledInstanceHandles.colorBuffer = descriptorHeap.AllocateBuffer(culledInstanceBuffer, instanceColorOffset, (VkDeviceSize)instanceCapacity * sizeof(InstanceColor));
+	}
+
+	//Input transforms and colors, compacted transforms and colors, draw commands
+	const uint32_t bindingCount = 5;
+
+	VkDescriptorSetLayoutBinding bindings[bindingCount] = {};
+	for (uint32_t i = 0; i < bindingCount; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = bindingCount;
+	layoutInfo.pBindings = bindings;
+
+	VkDescriptorSetLayout setLayout;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling descriptor set layout");
+	}
+	cullDescriptorSetLayout = deletionQueue.Own(setLayout, vkDestroyDescriptorSetLayout);
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = bindingCount;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling descriptor pool");
+	}
+	cullDescriptorPool = deletionQueue.Own(pool, vkDestroyDescriptorPool);
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = cullDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = cullDescriptorSetLayout.GetAddress();
+
+	if (vkAllocateDescriptorSets(device, &allocInfo, &cullDescriptorSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate culling descriptor set");
+	}
+
+	VkDeviceSize transformSize = (VkDeviceSize)instanceCapacity * sizeof(InstanceTransform);
+	VkDeviceSize colorSize = (VkDeviceSize)instanceCapacity * sizeof(InstanceColor);
+
+	VkDescriptorBufferInfo bufferInfos[bindingCount] = {
+		{ instanceBuffer, 0, transformSize },
+		{ instanceBuffer, instanceColorOffset, colorSize },
+		{ culledInstanceBuffer, 0, transformSize },
+		{ culledInstanceBuffer, instanceColorOffset, colorSize },
+		{ indirectBuffer, 0, indirectBufferSize }
+	};
+
+	VkWriteDescriptorSet descriptorWrites[bindingCount] = {};
+	for (uint32_t i = 0; i < bindingCount; i++)
+	{
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = cullDescriptorSet;
+		descriptorWrites[i].dstBinding = i;
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets(device, bindingCount, descriptorWrites, 0, nullptr);
+
+	VkPushConstantRange pushConstantRange = PushConstantRange<CullParameters>(VK_SHADER_STAGE_COMPUTE_BIT);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = cullDescriptorSetLayout.GetAddress();
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	VkPipelineLayout layout;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling pipeline layout");
+	}
+	cullPipelineLayout = deletionQueue.Own(layout, vkDestroyPipelineLayout);
+
+	cullPipelineFuture = pipelineBuilder.RequestCompute("cull.spv", cullPipelineLayout);
+}
+
+//Culls the active instances against this frame's frustum. On the graphics queue it is a pass of the render graph, which orders it
+//after the previous frame's draws and before this frame's. On the compute queue semaphores do that instead
+void TriangleApplication::RecordCullPass(FrameData& frame, VkCommandBuffer commandBuffer)
+{
+	//Every mesh starts the frame with no visible instances
+	std::vector<VkDrawIndexedIndirectCommand> commands(indirectCommandCount);
+	for (auto& command : commands)
+	{
+		command.indexCount = 3;
+		command.instanceCount = 0;
+		command.firstIndex = 0;
+		command.vertexOffset = 0;
+		command.firstInstance = 0;
+	}
+	vkCmdUpdateBuffer(commandBuffer, indirectBuffer, 0, commands.size() * sizeof(VkDrawIndexedIndirectCommand), commands.data());
+
+	VkMemoryBarrier resetBarrier = {};
+	resetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &resetBarrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptorSet, 0, nullptr);
+	PushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, frame.cullParameters);
+
+	//64 instances per group. Spill into y once x reaches the 65535 groups every device supports
+	const uint32_t groupSize = 64;
+	const uint32_t maxGroupsX = 65535;
+	uint32_t groupCount = (activeInstanceCount + groupSize - 1) / groupSize;
+	uint32_t groupsX = std::min(groupCount, maxGroupsX);
+	uint32_t groupsY = (groupCount + groupsX - 1) / groupsX;
+
+	vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+}
+
+//Culls on the compute queue while the graphics queue may still be drawing the previous frame.
+//The frame's draws wait on the returned semaphore and acquire the compacted buffers
+void TriangleApplication::SubmitAsyncCullPass(FrameData& frame)
+{
+	std::vector<AsyncWork> waitFor = TakePendingAsyncWork(queueFamilies.computeFamily);
+
+	//The previous frame's draws have to be done reading before the outputs are overwritten
+	if (pendingCullReadSemaphore != VK_NULL_HANDLE)
+	{
+		AsyncWork previousFrame;
+		previousFrame.semaphore = pendingCullReadSemaphore;
+		previousFrame.waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		waitFor.push_back(previousFrame);
+		pendingCullReadSemaphore = VK_NULL_HANDLE;
+	}
+
+	VkCommandBuffer commandBuffer = asyncComputeQueue.Begin();
+	asyncComputeQueue.AcquireAll(commandBuffer, waitFor);
+	debugMessenger.BeginLabel(commandBuffer, "Async cull pass");
+	RecordCullPass(frame, commandBuffer);
+	debugMessenger.EndLabel(commandBuffer);
+
+	std::vector<BufferOwnershipTransfer> transfers(2);
+	transfers[0].buffer = culledInstanceBuffer;
+	transfers[0].dstAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	transfers[1].buffer = indirectBuffer;
+	transfers[1].dstAccess = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+	for (auto& transfer : transfers)
+	{
+		transfer.srcFamily = queueFamilies.computeFamily;
+		transfer.dstFamily = queueFamilies.graphicsFamily;
+		transfer.srcStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		transfer.srcAccess = VK_ACCESS_SHADER_WRITE_BIT;
+		transfer.dstStage = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+	}
+
+	frame.asyncWork.push_back(asyncComputeQueue.Submit(commandBuffer, waitFor, transfers, queueFamilies.graphicsFamily,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT));
+}
+
+//Picks the sample count and depth format the render pass, render targets and pipelines are built with
+void TriangleApplication::ChooseRenderTargetFormats()
+{
+	//Both attachments have to support the count, so take the highest one up to the requested count that both do
+	const VkPhysicalDeviceLimits& limits = deviceInfo.properties.limits;
+	VkSampleCountFlags supportedCounts = limits.framebufferColorSampleCounts;
+	if (settings.depthBuffer)
+		supportedCounts &= limits.framebufferDepthSampleCounts;
+
+	sampleCount = VK_SAMPLE_COUNT_1_BIT;
+	for (uint32_t count = VK_SAMPLE_COUNT_64_BIT; count > VK_SAMPLE_COUNT_1_BIT; count /= 2)
+	{
+		if (count <= settings.sampleCount && (supportedCounts & count))
+		{
+			sampleCount = (VkSampleCountFlagBits)count;
+			break;
+		}
+	}
+
+	if ((uint32_t)sampleCount != settings.sampleCount)
+		std::cout << settings.sampleCount << "x MSAA is not supported, using " << (uint32_t)sampleCount << "x" << std::endl;
+
+	depthFormat = VK_FORMAT_UNDEFINED;
+	if (!settings.depthBuffer)
+		return;
+
+	//Nothing uses stencil, so formats without it come first. D16 support is guaranteed
+	const VkFormat depthFormats[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D16_UNORM };
+
+	for (VkFormat format : depthFormats)
+	{
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+
+		if (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+		{
+			depthFormat = format;
+			return;
+		}
+	}
+
+	throw std::runtime_error("Failed to find a supported depth format");
+}
+
+//Declares the frame: culling on the graphics queue when enabled, then the draws into the back buffer, with depth and with
+//multisampled color resolved into the back buffer. Only the formats are needed, so it is built ahead of the swap chain
+void TriangleApplication::BuildRenderGraph()
+{
+	bool multisampled = sampleCount != VK_SAMPLE_COUNT_1_BIT;
+	renderGraph.Initialize(device, memoryAllocator);
+
+	//PRESENT_SRC belongs to the swap chain extension, which is not enabled headless. Leave offscreen images ready to be read back instead.
+	//The image is only ready once the acquire semaphore has been waited on at the color output stage
+	backBuffer = renderGraph.ImportImage("back buffer", swapChainImageFormat, VK_SAMPLE_COUNT_1_BIT,
+		settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, true);
+
+	//The compute pass compacts the visible instances and fills the indirect commands the draws read
+	if (settings.gpuCulling && !settings.asyncCompute && instanceCapacity > 0)
+	{
+		culledInstances = renderGraph.ImportBuffer("culled instances");
+		indirectCommands = renderGraph.ImportBuffer("indirect commands");
+
+		cullPass = renderGraph.AddComputePass("Cull pass", [this](VkCommandBuffer commandBuffer)
+		{
+			if (activeInstanceCount > 0)
+				RecordCullPass(*recordingFrame, commandBuffer);
+		});
+		renderGraph.WriteBuffer(cullPass, indirectCommands, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		renderGraph.WriteBuffer(cullPass, culledInstances, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+	}
+
+	//The draws are recorded into secondary command buffers by the recording threads, and only executed here
+	mainPass = renderGraph.AddGraphicsPass("Render pass", VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS, [this](VkCommandBuffer commandBuffer)
+	{
+		//get() also rethrows anything a recording thread threw
+		{
+			ProfileScope scope(profiler, "Wait for recording threads");
+			for (auto& recording : recordingFrame->recordings)
+			{
+				recording.get();
+			}
+			recordingFrame->recordings.clear();
+		}
+
+		vkCmdExecuteCommands(commandBuffer, recordingFrame->recordingThreadCount, recordingFrame->secondaryCommandBuffers.data());
+	});
+
+	//Depth and multisampled color are cleared on load and never stored, so they need not leave tile memory.
+	//The samples are resolved into the back buffer at the end of the subpass, without a separate pass over memory
+	VkClearColorValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+	if (multisampled)
+	{
+		RenderGraphImageDescription colorDescription;
+		colorDescription.format = swapChainImageFormat;
+		colorDescription.samples = sampleCount;
+		colorDescription.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+
+		RenderGraphResource multisampledColor = renderGraph.CreateImage("multisampled color", colorDescription);
+		renderGraph.WriteColor(mainPass, multisampledColor, clearColor);
+		renderGraph.WriteResolve(mainPass, backBuffer);
+	}
+	else
+	{
+		renderGraph.WriteColor(mainPass, backBuffer, clearColor);
+	}
+
+	if (depthFormat != VK_FORMAT_UNDEFINED)
+	{
+		RenderGraphImageDescription depthDescription;
+		depthDescription.format = depthFormat;
+		depthDescription.samples = sampleCount;
+		depthDescription.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+		RenderGraphResource depth = renderGraph.CreateImage("depth", depthDescription);
+		renderGraph.WriteDepth(mainPass, depth, { 1.0f, 0 });
+	}
+
+	if (cullPass != RenderGraph::invalidIndex)
+	{
+		renderGraph.ReadBuffer(mainPass, indirectCommands, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+		renderGraph.ReadBuffer(mainPass, culledInstances, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+	}
+
+	renderGraph.Compile();
+	deletionQueue.OwnUntilShutdown([this]()
+	{
+		renderGraph.Destroy();
+	});
+}
+
+//Depth, multisampled color and the framebuffers of every swap chain (or offscreen) image at the current extent.
+//Called again whenever the swap chain is recreated
+void TriangleApplication::CreateRenderTargets()
+{
+	std::vector<std::vector<RenderGraphImportedImage>> importedImages(swapChainImages.size());
+	for (size_t i = 0; i < swapChainImages.size(); i++)
+	{
+		RenderGraphImportedImage image;
+		image.image = swapChainImages[i];
+		image.view = swapChainImageViews[i];
+		importedImages[i].push_back(image);
+	}
+
+	renderTargets = renderGraph.CreateTargets(swapChainExtent, importedImages);
+	renderTargetsOwner = deletionQueue.Own([this, targets = renderTargets]() mutable
+	{
+		renderGraph.DestroyTargets(targets);
+	});
+}
+
+void TriangleApplication::CreateFrameResources()
+{
+	const QueueFamilyIndices& indices = queueFamilies;
+
+	frames.resize(settings.framesInFlight);
+	imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+
+	//GPU frame times need timestamp support on the graphics queue
+	VkQueryPipelineStatisticFlags statistics = 0;
+	if (pipelineStatisticsEnabled)
+	{
+		statistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT | VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+	}
+
+	profiler.Initialize(device, settings.framesInFlight, deviceInfo.queueFamilyProperties[indices.graphicsFamily].timestampValidBits,
+		deviceInfo.properties.limits.timestampPeriod, statistics);
+	profiler.SetEnabled(settings.profile);
+	deletionQueue.OwnUntilShutdown([this]()
+	{
+		profiler.Destroy();
+	});
+
+	for (auto& frame : frames)
+	{
+		//Each frame slot owns its pool, so resetting it never touches command buffers still executing for other slots
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.queueFamilyIndex = indices.graphicsFamily;
+
+		if (vkCreateCommandPool(device, &poolInfo, nullptr, &frame.commandPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create command pool");
+		}
+
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = frame.commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(device, &allocInfo, &frame.commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate command buffers");
+		}
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		//Fences are created signaled so the first use of every frame slot does not block
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+		//Every recording thread gets its own pool and secondary command buffer in every frame slot
+		frame.recordingCommandPools.resize(settings.recordingThreadCount);
+		frame.secondaryCommandBuffers.resize(settings.recordingThreadCount);
+
+		for (uint32_t thread = 0; thread < settings.recordingThreadCount; thread++)
+		{
+			if (vkCreateCommandPool(device, &poolInfo, nullptr, &frame.recordingCommandPools[thread]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create recording command pool");
+			}
+
+			VkCommandBufferAllocateInfo secondaryInfo = {};
+			secondaryInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			secondaryInfo.commandPool = frame.recordingCommandPools[thread];
+			secondaryInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			secondaryInfo.commandBufferCount = 1;
+
+			if (vkAllocateCommandBuffers(device, &secondaryInfo, &frame.secondaryCommandBuffers[thread]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to allocate secondary command buffers");
+			}
+		}
+
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.imageAvailableSemaphore) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.renderFinishedSemaphore) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.cullReadFinishedSemaphore) != VK_SUCCESS ||
+			vkCreateFence(device, &fenceInfo, nullptr, &frame.inFlightFence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create frame synchronization objects");
+		}
+
+		//The slot is reused every frame for the lifetime of the application, and frames is never resized
+		FrameData* slot = &frame;
+		deletionQueue.OwnUntilShutdown([this, slot]()
+		{
+			vkDestroyFence(device, slot->inFlightFence, nullptr);
+			vkDestroySemaphore(device, slot->renderFinishedSemaphore, nullptr);
+			vkDestroySemaphore(device, slot->cullReadFinishedSemaphore, nullptr);
+			vkDestroySemaphore(device, slot->imageAvailableSemaphore, nullptr);
+			vkDestroyCommandPool(device, slot->commandPool, nullptr);
+
+			for (auto pool : slot->recordingCommandPools)
+			{
+				vkDestroyCommandPool(device, pool, nullptr);
+			}
+		});
+	}
+
+	//Validation messages and capture tools refer to the objects by these names
+	for (size_t slot = 0; slot < frames.size(); slot++)
+	{
+		std::string prefix = "Frame slot " + std::to_string(slot);
+		debugMessenger.SetObjectName(device, VK_OBJECT_TYPE_COMMAND_BUFFER, (uint64_t)frames[slot].commandBuffer, (prefix + " command buffer").c_str());
+		debugMessenger.SetObjectName(device, VK_OBJECT_TYPE_FENCE, (uint64_t)frames[slot].inFlightFence, (prefix + " fence").c_str());
+	}
+}
+
+//Records the commands that clear the image and draw the triangles. The draws are split evenly over threadCount threads,
+//each recording a secondary command buffer, and the primary command buffer only begins the render pass and executes them.
+//Must only be called once the frame slot's fence has signaled, since it resets all of the slot's pools.
+void TriangleApplication::RecordCommandBuffer(FrameData& frame, uint32_t imageIndex, uint32_t threadCount)
+{
+	//Hand all but the first share of the draws to the recording threads, then record the first share here
+	std::vector<std::future<void>> recordings;
+	recordings.reserve(threadCount - 1);
+
+	for (uint32_t thread = 1; thread < threadCount; thread++)
+	{
+		uint32_t firstDraw = (uint32_t)((uint64_t)settings.drawCount * thread / threadCount);
+		uint32_t lastDraw = (uint32_t)((uint64_t)settings.drawCount * (thread + 1) / threadCount);
+
+		recordings.push_back(recordingPool->Submit([this, &frame, thread, imageIndex, firstDraw, lastDraw]()
+		{
+			RecordSecondaryCommandBuffer(frame, thread, imageIndex, firstDraw, lastDraw - firstDraw);
+		}));
+	}
+
+	RecordSecondaryCommandBuffer(frame, 0, imageIndex, 0, (uint32_t)((uint64_t)settings.drawCount / threadCount));
+
+	//Record the primary command buffer while the threads are busy. Secondaries can be executed once they have ended
+	vkResetCommandPool(device, frame.commandPool, 0);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(frame.commandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to begin recording command buffer");
+	}
+
+	profiler.BeginCommandBuffer(frame.commandBuffer);
+
+	//Work from the other queues is only usable once this queue has acquired it
+	for (const auto& work : frame.asyncWork)
+	{
+		work.RecordAcquires(frame.commandBuffer);
+	}
+
+	//Counts the culling pass when it runs on this queue, and the draws
+	profiler.BeginStatistics(frame.commandBuffer);
+
+	//Each render pass and each pass outside one gets a GPU timing scope and a debug label
+	std::vector<uint32_t> scopes;
+	RenderGraphMarkers markers;
+	markers.begin = [this, &scopes](VkCommandBuffer commandBuffer, const char* name)
+	{
+		scopes.push_back(profiler.BeginScope(commandBuffer, name));
+		debugMessenger.BeginLabel(commandBuffer, name);
+	};
+	markers.end = [this, &scopes](VkCommandBuffer commandBuffer)
+	{
+		debugMessenger.EndLabel(commandBuffer);
+		profiler.EndScope(commandBuffer, scopes.back());
+		scopes.pop_back();
+	};
+
+	//The recording threads are waited for inside the render pass
+	frame.recordings = std::move(recordings);
+	frame.recordingThreadCount = threadCount;
+	recordingFrame = &frame;
+	renderGraph.Execute(frame.commandBuffer, renderTargets, imageIndex, markers);
+	recordingFrame = nullptr;
+
+	profiler.EndStatistics(frame.commandBuffer);
+	profiler.EndCommandBuffer(frame.commandBuffer);
+
+	if (vkEndCommandBuffer(frame.commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record command buffer");
+	}
+}
+
+//Records draws [firstDraw, firstDraw + drawCount) into the given thread's secondary command buffer. Only touches that thread's pool
+void TriangleApplication::RecordSecondaryCommandBuffer(FrameData& frame, uint32_t thread, uint32_t imageIndex, uint32_t firstDraw, uint32_t drawCount)
+{
+	ProfileScope scope(profiler, "Record secondary command buffer");
+	VkCommandBuffer commandBuffer = frame.secondaryCommandBuffers[thread];
+
+	vkResetCommandPool(device, frame.recordingCommandPools[thread], 0);
+
+	//Secondaries executed inside a render pass inherit it, and the framebuffer when known
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = renderGraph.GetRenderPass(mainPass);
+	inheritanceInfo.subpass = renderGraph.GetSubpass(mainPass);
+	inheritanceInfo.framebuffer = renderGraph.GetFramebuffer(renderTargets, mainPass, imageIndex);
+	inheritanceInfo.pipelineStatistics = profiler.GetFrameStatistics();
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to begin recording secondary command buffer");
+	}
+
+	//Dynamic state is not inherited from the primary either
+	VkViewport viewport = {};
+	viewport.width = (float)swapChainExtent.width;
+	viewport.height = (float)swapChainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = {};
+	scissor.extent = swapChainExtent;
+
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	//Secondaries inherit no bound state, so every one binds this frame's region of the upload ring itself.
+	//The descriptor heap goes along with it, so draws only push the handles of what they read
+	VkBuffer vertexBuffer = uploadRing.GetBuffer();
+	VkDescriptorSet descriptorSets[] = { uniformDescriptorSet, descriptorHeap.GetSet() };
+	uint32_t descriptorSetCount = bindlessEnabled ? 2 : 1;
+	uint32_t dynamicOffsets[] = { frame.uniformOffset, 0 };	//Frame uniforms, then draw parameters
+
+	if (activeInstanceCount > 0)
+	{
+		//One draw covers every instance, so only the first thread has anything to record
+		if (thread == 0 && settings.gpuCulling)
+		{
+			//The culling pass wrote the surviving instances and their draw commands. The CPU cost no longer depends on the instance count
+			VkBuffer vertexBuffers[] = { vertexBuffer, culledInstanceBuffer, culledInstanceBuffer };
+			VkDeviceSize offsets[] = { frame.vertexOffset, 0, instanceColorOffset };
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, instancedPipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, descriptorSetCount, descriptorSets, 2, dynamicOffsets);
+
+			if (bindlessInstances)
+				PushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, culledInstanceHandles);
+
+			vkCmdBindVertexBuffers(commandBuffer, 0, bindlessInstances ? 1 : 3, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, vertexBuffer, frame.indexOffset, VK_INDEX_TYPE_UINT16);
+
+			if (multiDrawIndirectEnabled)
+			{
+				vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, 0, indirectCommandCount, sizeof(VkDrawIndexedIndirectCommand));
+			}
+			else
+			{
+				for (uint32_t command = 0; command < indirectCommandCount; command++)
+				{
+					vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, command * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+				}
+			}
+		}
+		else if (thread == 0)
+		{
+			VkBuffer vertexBuffers[] = { vertexBuffer, instanceBuffer, instanceBuffer };
+			VkDeviceSize offsets[] = { frame.vertexOffset, 0, instanceColorOffset };
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, instancedPipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, descriptorSetCount, descriptorSets, 2, dynamicOffsets);
+
+			if (bindlessInstances)
+				PushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, instanceHandles);
+
+			vkCmdBindVertexBuffers(commandBuffer, 0, bindlessInstances ? 1 : 3, vertexBuffers, offsets);
+			vkCmdDraw(commandBuffer, 3, activeInstanceCount, 0, 0);
+		}
+	}
+	else
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelines);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, descriptorSetCount, descriptorSets, 2, dynamicOffsets);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &frame.vertexOffset);
+
+		if (settings.drawParameters == DrawParameterSource::PushConstants)
+		{
+			//Recorded straight into the command buffer, nothing to write or bind
+			for (uint32_t draw = firstDraw; draw < firstDraw + drawCount; draw++)
+			{
+				PushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, drawParameters[draw]);
+				vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+			}
+		}
+		else if (drawCount > 0)
+		{
+			//One allocation for the thread's share, then a rebind with a new dynamic offset per draw
+			UploadAllocation allocation = uploadRing.Allocate(drawParameterStride * drawCount, uploadRing.GetMaxAlignment());
+
+			for (uint32_t draw = 0; draw < drawCount; draw++)
+			{
+				memcpy(static_cast<uint8_t*>(allocation.data) + draw * drawParameterStride, &drawParameters[firstDraw + draw], sizeof(DrawParameters));
+				dynamicOffsets[1] = (uint32_t)(allocation.offset + draw * drawParameterStride);
+
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &uniformDescriptorSet, 2, dynamicOffsets);
+				vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+			}
+		}
+	}
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record secondary command buffer");
+	}
+}
+
+void TriangleApplication::RunRecordingBenchmark()
+{
+	const uint32_t iterations = 200;
+
+	//Recording needs the pipeline, and nothing may be executing from the frame slot being rerecorded
+	graphicsPipelines = graphicsPipelineFuture.get();
+	if (activeInstanceCount > 0)
+		instancedPipeline = instancedPipelineFuture.get();
+	if (activeInstanceCount > 0 && settings.gpuCulling)
+		cullPipeline = cullPipelineFuture.get();
+	vkDeviceWaitIdle(device);
+
+	FrameData& frame = frames[0];
+	double singleThreadTime = 0.0;
+
+	//Recording may take draw parameters from the upload ring, so every recording starts the slot's region over like a frame would
+	auto recordFrame = [&](uint32_t threadCount)
+	{
+		uploadRing.BeginFrame(0);
+		UpdateFrameData(frame);
+		RecordCommandBuffer(frame, 0, threadCount);
+	};
+
+	std::cout << "recording benchmark: " << settings.drawCount << " draws per frame, parameters in "
+		<< (settings.drawParameters == DrawParameterSource::PushConstants ? "push constants" : "dynamic uniforms") << std::endl;
+
+	for (uint32_t threadCount = 1; threadCount <= settings.recordingThreadCount; threadCount++)
+	{
+		//Warm up the pools so their first growth is not counted
+		recordFrame(threadCount);
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (uint32_t i = 0; i < iterations; i++)
+		{
+			recordFrame(threadCount);
+		}
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		double frameTime = elapsed.count() / iterations;
+
+		if (threadCount == 1)
+			singleThreadTime = frameTime;
+
+		std::cout << "  " << threadCount << " thread(s): " << frameTime << " ms per frame, speedup " << singleThreadTime / frameTime << "x" << std::endl;
+	}
+}
+
+void TriangleApplication::RunInstancingBenchmark()
+{
+	const uint32_t warmUpFrames = 10;
+	const uint32_t measuredFrames = 100;
+
+	std::cout << "instancing benchmark: " << measuredFrames << " frames per step" << std::endl;
+
+	//Closing the window ends the sweep, the step it interrupts is not reported
+	auto windowClosed = [this]()
+	{
+		if (settings.headless)
+			return false;
+
+		glfwPollEvents();
+		return glfwWindowShouldClose(window) != 0;
+	};
+
+	for (uint64_t count = 1; count <= instanceCapacity; count *= 10)
+	{
+		activeInstanceCount = (uint32_t)count;
+
+		//Lets the frames still in flight with the previous count drain out of the GPU timings
+		bool closed = false;
+		for (uint32_t frame = 0; frame < warmUpFrames; frame++)
+		{
+			closed = windowClosed();
+			if (closed)
+				break;
+			DrawFrame();
+		}
+
+		double cpuTotal = 0.0;
+		double gpuTotal = 0.0;
+
+		for (uint32_t frame = 0; frame < measuredFrames && !closed; frame++)
+		{
+			closed = windowClosed();
+			if (closed)
+				break;
+			DrawFrame();
+
+			cpuTotal += cpuFrameTime;
+			gpuTotal += gpuFrameTime;
+		}
+
+		if (closed)
+			break;
+
+		std::cout << "  " << count << " instances: CPU " << cpuTotal / measuredFrames << " ms";
+		if (profiler.AreTimestampsSupported())
+			std::cout << ", GPU " << gpuTotal / measuredFrames << " ms";
+		std::cout << std::endl;
+	}
+
+	vkDeviceWaitIdle(device);
+}
+
+void TriangleApplication::DrawFrame()
+{
+	PaceFrame();
+	auto frameStart = std::chrono::high_resolution_clock::now();
+
+	FrameData& frame = frames[currentFrame];
+
+	ProfileScope frameScope(profiler, "Frame");
+
+	//Wait until the GPU is done with the last frame submitted from this slot. The other slots keep the GPU busy meanwhile
+	{
+		ProfileScope scope(profiler, "Wait for frame slot");
+		vkWaitForFences(device, 1, &frame.inFlightFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+
+	//The slot's previous frame has finished, so its queries are ready and reading them never stalls
+	profiler.BeginFrame((uint32_t)currentFrame);
+	gpuFrameTime = profiler.GetFrameTime();
+
+	//The slot's waits on the other queues have completed as well, so their semaphores can be reused
+	for (auto& work : frame.asyncWork)
+	{
+		if (work.queue)
+			work.queue->RecycleSemaphore(work.semaphore);
+	}
+	frame.asyncWork.clear();
+
+	asyncComputeQueue.Collect();
+	asyncTransferQueue.Collect();
+
+	//Frames older than this slot's last one have retired, possibly the last users of a replaced swap chain or of freed heap slots
+	deletionQueue.Collect(frameCount);
+	descriptorHeap.Recycle(frameCount);
+
+	{
+		ProfileScope scope(profiler, "Stream textures");
+		UpdateTextures();
+	}
+
+	//Pick the image to render into. Headless runs walk the offscreen ring instead of asking the presentation engine
+	uint32_t imageIndex;
+	if (settings.headless)
+	{
+		imageIndex = (uint32_t)(frameCount % swapChainImages.size());
+	}
+	else
+	{
+		if (swapChainOutdated && !RecreateSwapChain())
+			return;
+
+		ProfileScope scope(profiler, "Acquire image");
+		VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+
+		//The semaphore is left unsignaled when the acquire fails, so it can be used again right away
+		while (result == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			if (!RecreateSwapChain())
+				return;
+
+			result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+		}
+
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+		{
+			throw std::runtime_error("Failed to acquire swap chain image");
+		}
+	}
+
+	//The image may still be in use by an older frame from a different slot when there are fewer images than frames in flight
+	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE)
+	{
+		vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+	imagesInFlight[imageIndex] = frame.inFlightFence;
+
+	auto cpuStart = std::chrono::high_resolution_clock::now();
+
+	//The first frame is the only one that can find its pipeline still compiling
+	if (graphicsPipelines == VK_NULL_HANDLE)
+	{
+		auto waitStart = std::chrono::high_resolution_clock::now();
+		graphicsPipelines = graphicsPipelineFuture.get();
+		EndStartupStage("Wait for pipeline", waitStart);
+	}
+
+	if (activeInstanceCount > 0 && instancedPipeline == VK_NULL_HANDLE)
+		instancedPipeline = instancedPipelineFuture.get();
+
+	if (activeInstanceCount > 0 && settings.gpuCulling && cullPipeline == VK_NULL_HANDLE)
+		cullPipeline = cullPipelineFuture.get();
+
+	//The slot's region of the upload ring is free again as well
+	{
+		ProfileScope scope(profiler, "Update frame data");
+		uploadRing.BeginFrame((uint32_t)currentFrame);
+		UpdateFrameData(frame);
+	}
+
+	//Culling runs on the compute queue and this frame's draws wait for it, along with any uploads meant for them
+	bool asyncCull = settings.asyncCompute && settings.gpuCulling && activeInstanceCount > 0;
+	if (asyncCull)
+		SubmitAsyncCullPass(frame);
+
+	std::vector<AsyncWork> graphicsWork = TakePendingAsyncWork(queueFamilies.graphicsFamily);
+	frame.asyncWork.insert(frame.asyncWork.end(), graphicsWork.begin(), graphicsWork.end());
+
+	//Everything recorded from this slot has retired, so its pools can be recycled in one call each
+	{
+		ProfileScope scope(profiler, "Record");
+		RecordCommandBuffer(frame, imageIndex, settings.recordingThreadCount);
+		uploadRing.Flush();
+	}
+
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<VkPipelineStageFlags> waitStages;
+	std::vector<VkSemaphore> signalSemaphores;
+
+	for (const auto& work : frame.asyncWork)
+	{
+		waitSemaphores.push_back(work.semaphore);
+		waitStages.push_back(work.waitStage);
+	}
+
+	if (!settings.headless)
+	{
+		waitSemaphores.push_back(frame.imageAvailableSemaphore);
+		waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		signalSemaphores.push_back(frame.renderFinishedSemaphore);
+	}
+
+	//Tells the next culling pass when these draws are done reading its outputs
+	if (asyncCull)
+	{
+		signalSemaphores.push_back(frame.cullReadFinishedSemaphore);
+		pendingCullReadSemaphore = frame.cullReadFinishedSemaphore;
+	}
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &frame.commandBuffer;
+	submitInfo.waitSemaphoreCount = (uint32_t)waitSemaphores.size();
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
+	submitInfo.signalSemaphoreCount = (uint32_t)signalSemaphores.size();
+	submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+	vkResetFences(device, 1, &frame.inFlightFence);
+
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, frame.inFlightFence) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to submit draw command buffer");
+	}
+
+	profiler.MarkSubmitted();
+
+	if (frameCount == 0)
+	{
+		EndStartupStage("First frame", frameStart);
+		PrintStartupReport();
+	}
+
+	if (!settings.headless)
+	{
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &frame.renderFinishedSemaphore;
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = swapChain.GetAddress();
+		presentInfo.pImageIndices = &imageIndex;
+
+		ProfileScope scope(profiler, "Present");
+		VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
+
+		//Recreated before the next acquire, after this frame has been counted
+		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+		{
+			swapChainOutdated = true;
+		}
+		else if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to present swap chain image");
+		}
+	}
+
+	auto presented = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double, std::milli> cpuElapsed = presented - cpuStart;
+	cpuFrameTime = cpuElapsed.count();
+
+	//Headless frames count as presented once submitted
+	std::chrono::duration<double, std::milli> presentLatency = presented - frameStart;
+	presentLatencyTotal += presentLatency.count();
+	presentLatencyWorst = std::max(presentLatencyWorst, presentLatency.count());
+	presentLatencySamples++;
+
+	currentFrame = (currentFrame + 1) % frames.size();
+	frameCount++;
+}
+
+void TriangleApplication::PaceFrame()
+{
+	//Starting while the previous frame is still queued only makes this frame wait behind it, seeing older input
+	if (settings.presentPolicy == PresentPolicy::LowLatency && frameCount > 0)
+	{
+		FrameData& previous = frames[(currentFrame + frames.size() - 1) % frames.size()];
+		vkWaitForFences(device, 1, &previous.inFlightFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+
+	uint32_t frameRateLimit = settings.frameRateLimit;
+	if (frameRateLimit == 0 && settings.presentPolicy == PresentPolicy::PowerSaving)
+		frameRateLimit = 30;
+
+	if (frameRateLimit == 0)
+		return;
+
+	//Frames that start late do not bank time to catch up with afterwards
+	auto now = std::chrono::high_resolution_clock::now();
+	if (nextFrameStart > now)
+	{
+		std::this_thread::sleep_until(nextFrameStart);
+		now = nextFrameStart;
+	}
+
+	nextFrameStart = now + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<double>(1.0 / frameRateLimit));
+}
+
+void TriangleApplication::PrintPresentLatency()
+{
+	if (presentLatencySamples == 0)
+		return;
+
+	//Spelled like the --present-policy values
+	const char* policyName = "default";
+	switch (settings.presentPolicy)
+	{
+	case PresentPolicy::Default:
+		policyName = "default";
+		break;
+	case PresentPolicy::LowLatency:
+		policyName = "low-latency";
+		break;
+	case PresentPolicy::MaxThroughput:
+		policyName = "max-throughput";
+		break;
+	case PresentPolicy::PowerSaving:
+		policyName = "power-saving";
+		break;
+	}
+
+	std::cout << "present policy " << policyName << ": frame start to present " << presentLatencyTotal / presentLatencySamples
+		<< " ms mean, " << presentLatencyWorst << " ms worst over " << presentLatencySamples << " frames" << std::endl;
+}
+
+void TriangleApplication::AddStartupStage(const char* name, std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end, bool background)
+{
+	StartupStage stage;
+	stage.name = name;
+	stage.start = std::chrono::duration<double, std::milli>(start - startupStart).count();
+	stage.duration = std::chrono::duration<double, std::milli>(end - start).count();
+	stage.background = background;
+	startupStages.push_back(stage);
+}
+
+//Returns the end of the stage, which is where the next one on the main thread starts
+std::chrono::high_resolution_clock::time_point TriangleApplication::EndStartupStage(const char* name, std::chrono::high_resolution_clock::time_point start)
+{
+	auto end = std::chrono::high_resolution_clock::now();
+	AddStartupStage(name, start, end, false);
+	return end;
+}
+
+void TriangleApplication::PrintStartupReport()
+{
+	std::sort(startupStages.begin(), startupStages.end(), [](const StartupStage& a, const StartupStage& b) { return a.start < b.start; });
+
+	double firstFrame = 0.0;
+	for (const auto& stage : startupStages)
+	{
+		firstFrame = std::max(firstFrame, stage.start + stage.duration);
+	}
+
+	std::cout << "startup: " << firstFrame << " ms to the first frame" << std::endl;
+	for (const auto& stage : startupStages)
+	{
+		std::cout << "  " << stage.name << ": " << stage.duration << " ms at " << stage.start << " ms" << (stage.background ? " (background)" : "") << std::endl;
+	}
+}
+
+//Work that does not depend on the device overlaps the steps that create it: the shader archive and the pipeline cache file
+//are read on the worker pool, and the pipelines compile there while the swap chain and the frame resources are created
+void TriangleApplication::InitializeVulkan()
+{
+	auto stageStart = std::chrono::high_resolution_clock::now();
+
+	//Worker threads for background jobs such as pipeline compilation
+	workerPool.reset(new ThreadPool(settings.workerThreadCount ? settings.workerThreadCount : std::thread::hardware_concurrency()));
+
+	//Start and end of each background step. Shared with the task, since an exception here can unwind this frame while it still runs
+	typedef std::pair<std::chrono::high_resolution_clock::time_point, std::chrono::high_resolution_clock::time_point> StepTiming;
+	auto shaderTiming = std::make_shared<StepTiming>();
+	auto cacheTiming = std::make_shared<StepTiming>();
+
+	//Maps the compiled shaders
+	std::future<void> shaderArchiveLoaded = workerPool->Submit([this, shaderTiming]()
+	{
+		shaderTiming->first = std::chrono::high_resolution_clock::now();
+		LoadShaderArchive();
+		shaderTiming->second = std::chrono::high_resolution_clock::now();
+	});
+
+	//Reads the pipeline cache saved by the previous run. It is checked against the device once there is one
+	std::future<std::vector<char>> pipelineCacheData = workerPool->Submit([this, cacheTiming]()
+	{
+		cacheTiming->first = std::chrono::high_resolution_clock::now();
+		std::vector<char> cacheData = ReadPipelineCacheFile();
+		cacheTiming->second = std::chrono::high_resolution_clock::now();
+		return cacheData;
+	});
+
+	//Create a connection between your application and Vulkan library.
+	CreateInstance();
+	SetUpDebugCallBack();
+
+	//Create a window surface that is used to render things on the screen. Created a connection between Vulkan and window system
+	if (!settings.headless)
+		CreateSurface();
+	stageStart = EndStartupStage("Instance", stageStart);
+
+	//Selects a graphics card that supports the features we need.
+	SelectPhysicalDevice();
+	stageStart = EndStartupStage("Select physical device", stageStart);
+
+	//Creates a logical device that interfaces with the Physical device
+	CreateLogicalDevice();
+
+	//Sub-allocates buffers and images from large pooled device memory blocks
+	memoryAllocator.Initialize(physicalDevice, device);
+
+	//Everything created on the device from here on is destroyed through the deletion queue
+	deletionQueue.Initialize(device, settings.framesInFlight);
+
+	//Submits uploads and compute work on dedicated queues where the device has them
+	CreateAsyncQueues();
+	stageStart = EndStartupStage("Logical device", stageStart);
+
+	//Persistently mapped ring that streams each frame's uniforms and vertices, and the descriptor set that reads from it.
+	//Sized for the draw parameters as well when they go through it
+	CreateDrawParameters();
+	CreateUploadRing();
+	CreateDescriptorSetLayout();
+	CreateDescriptorSet();
+	stageStart = EndStartupStage("Upload ring", stageStart);
+
+	//Global set of buffers, images and samplers that shaders index into
+	CreateDescriptorHeap();
+
+	//Textures decode on the worker pool while the rest of the setup runs
+	CreateTextureStreamer();
+
+	//The pipeline builds need the shaders and the cache, so this is where the main thread catches up with the background reads.
+	//get() rethrows anything they failed with
+	std::vector<char> cacheData = pipelineCacheData.get();
+	shaderArchiveLoaded.get();
+	stageStart = EndStartupStage("Wait for shaders and cache file", stageStart);
+	AddStartupStage("Load shader archive", shaderTiming->first, shaderTiming->second, true);
+	AddStartupStage("Read pipeline cache file", cacheTiming->first, cacheTiming->second, true);
+
+	//Lets pipeline creation skip compilation for anything the previous run built
+	CreatePipelineCache(std::move(cacheData));
+	stageStart = EndStartupStage("Pipeline cache", stageStart);
+
+	//The instanced pipeline and instance buffer are only built when something draws instances
+	instanceCapacity = settings.instancingBenchmark ? std::max(settings.instanceCount, settings.instancingBenchmarkMax) : settings.instanceCount;
+
+	//A heap slot covers a whole instance array, which has to fit in the range of one storage buffer descriptor.
+	//The benchmark stays within it, so every step is measured on the same path
+	uint32_t bindlessCapacity = deviceInfo.properties.limits.maxStorageBufferRange / sizeof(InstanceTransform);
+	if (settings.instancingBenchmark && bindlessEnabled && instanceCapacity > bindlessCapacity)
+	{
+		std::cout << "instancing benchmark limited to " << bindlessCapacity << " instances by maxStorageBufferRange" << std::endl;
+		instanceCapacity = bindlessCapacity;
+	}
+	bindlessInstances = bindlessEnabled && instanceCapacity <= bindlessCapacity;
+
+	//Tells the Vulkan about the passes of a frame and the attachments and buffers they use. The render pass, its load and store
+	//ops and every barrier are derived from that. Only the image formats are needed, so it is built ahead of the swap chain
+	swapChainImageFormat = ChooseColorFormat();
+	ChooseRenderTargetFormats();
+	BuildRenderGraph();
+
+	//Queues the Graphics Pipeline builds. They compile in the background while the rest of the setup runs
+	CreateGraphicsPipeline();
+	stageStart = EndStartupStage("Queue pipeline builds", stageStart);
+
+	//The main thread records one share of every frame itself, so it needs one helper less than there are recording threads
+	if (settings.recordingThreadCount > 1)
+		recordingPool.reset(new ThreadPool(settings.recordingThreadCount - 1));
+
+	//Creates Swap Chain that handles the queue of images that are waiting to be rendered on the screen.
+	//Headless runs render into a ring of device-owned images instead.
+	if (settings.headless)
+		CreateOffscreenImages();
+	else
+		CreateSwapChain();
+
+	//Use to view an image. Specifies how to access an image and what part of the image should be accessed
+	CreateImageView();
+
+	//Transient depth and multisampled color sized like the swap chain, and the framebuffers
+	CreateRenderTargets();
+
+	//The per frame slot resources used to draw into them
+	CreateFrameResources();
+	stageStart = EndStartupStage("Swap chain and frame resources", stageStart);
+
+	//Instance data for the instanced path, sized for the largest step of the benchmark
+	if (instanceCapacity > 0)
 	{
-		throw std::runtime_error("failed to load file");
+		CreateInstanceBuffer(instanceCapacity);
+		activeInstanceCount = settings.instanceCount;
+
+		if (settings.gpuCulling)
+			CreateCullResources();
+
+		if (cullPass != RenderGraph::invalidIndex)
+		{
+			renderGraph.BindBuffer(culledInstances, culledInstanceBuffer);
+			renderGraph.BindBuffer(indirectCommands, indirectBuffer);
+		}
+		stageStart = EndStartupStage("Instance buffer", stageStart);
+	}
+}
+
+void TriangleApplication::MainLoop()
+{
+	if (settings.recordingBenchmark)
+	{
+		RunRecordingBenchmark();
+		return;
+	}
+
+	if (settings.instancingBenchmark)
+	{
+		RunInstancingBenchmark();
+		return;
+	}
+
+	if (settings.headless)
+	{
+		//Render a fixed number of frames round-robin over the offscreen ring and report the raw throughput
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (uint32_t frame = 0; frame < settings.headlessFrameCount; frame++)
+		{
+			DrawFrame();
+		}
+
+		vkDeviceWaitIdle(device);
+
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		std::cout << "headless: " << settings.headlessFrameCount << " frames in " << elapsed.count() << " s ("
+			<< settings.headlessFrameCount / elapsed.count() << " frames/s)" << std::endl;
+		PrintPresentLatency();
+		memoryAllocator.PrintStatistics(std::cout);
+		renderGraph.PrintReport(renderTargets, std::cout);
+		return;
+	}
+
+	while (!glfwWindowShouldClose(window))
+	{
+		glfwPollEvents();								//Checks for events such as button clicks till the window is closed
+		DrawFrame();
+	}
+
+	//Frames may still be in flight when the window closes
+	vkDeviceWaitIdle(device);
+	PrintPresentLatency();
+	renderGraph.PrintReport(renderTargets, std::cout);
+}
+
+void TriangleApplication::CleanUp()
+{
+	if (texturingEnabled)
+		textureStreamer.PrintStatistics(std::cout);
+
+	//The device is idle, so the frames still in flight at exit can be read back too
+	profiler.ReadAll();
+	if (profiler.HasEvents())
+		profiler.WriteTrace(settings.tracePath);
+
+	recordingPool.reset();
+
+	PipelineBuilderStatistics builderStatistics = pipelineBuilder.GetStatistics();
+	std::cout << "pipelines: " << builderStatistics.requests << " requested, " << builderStatistics.builds << " built, "
+		<< builderStatistics.HitRate() * 100.0f << "% served from earlier requests" << std::endl;
+
+	//The pool finishes its queue before its threads exit, so the variants still compiling are in the saved cache
+	workerPool.reset();
+
+	SavePipelineCache();
+	shaderArchive.Close();
+
+	//Everything the application created on the device, helpers included, newest first. Swap chains replaced at runtime are
+	//usually gone already
+	deletionQueue.Flush();
+
+	memoryAllocator.Destroy();
+
+	vkDestroyDevice(device, nullptr);
+
+	debugMessenger.Destroy();
+
+	if (!settings.headless)
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+
+	vkDestroyInstance(instance, nullptr);
+
+	if (!settings.headless)
+	{
+		glfwDestroyWindow(window);
+		glfwTerminate();
 	}
+}
+
+void TriangleApplication::writeFileAtomic(const std::string & filename, const std::vector<char>& data)
+{
+	std::string tempFilename = filename + ".tmp";
+
+	std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
 
-	//gets the size of the file, and creates a vector for storing the contents
-	size_t fileSize = (size_t)file.tellg();
-	std::vector<char> buffer(fileSize);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("failed to open " + tempFilename);
+	}
 
-	//We seek back to begining of the file and start reading the file in buffer
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
+	file.write(data.data(), data.size());
 	file.close();
 
-	return buffer;
+	if (!file)
+	{
+		std::remove(tempFilename.c_str());
+		throw std::runtime_error("failed to write " + tempFilename);
+	}
+
+	//Replace the old file in a single step. std::rename refuses to overwrite an existing file on Windows
+#ifdef _WIN32
+	bool renamed = MoveFileExA(tempFilename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	bool renamed = std::rename(tempFilename.c_str(), filename.c_str()) == 0;
+#endif
+
+	if (!renamed)
+	{
+		std::remove(tempFilename.c_str());
+		throw std::runtime_error("failed to replace " + filename);
+	}
 }
 
 
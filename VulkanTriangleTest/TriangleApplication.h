@@ -1,11 +1,29 @@
 #pragma once
 #define GLFW_INCLUDE_VULKAN					//will automatically include all the vulkan stuff
-#include <GLFW\glfw3.h>
+#include <GLFW/glfw3.h>
 #include <stdexcept>
 #include <iostream>
 #include <functional>
 #include <cstdlib>
+#include <cstddef>
 #include <vector>
+#include <string>
+#include <memory>
+#include <future>
+#include <chrono>
+#include "ShaderArchive.h"
+#include "ThreadPool.h"
+#include "PipelineBuilder.h"
+#include "MemoryAllocator.h"
+#include "UploadRing.h"
+#include "AsyncQueue.h"
+#include "GpuProfiler.h"
+#include "DebugMessenger.h"
+#include "DescriptorHeap.h"
+#include "PushConstants.h"
+#include "TextureStreamer.h"
+#include "RenderGraph.h"
+#include "DeletionQueue.h"
 
 const int WIDTH = 800;
 const int HEIGHT = 600;
@@ -20,31 +38,18 @@ const bool enableValidationLayers = true;
 #endif // !NDEBUG
 
 
-//Since the SetUpCallBack() is an extension function, it is not automatically loaded. We need to address it ourselves.
-VkResult CreateDebugReportCallbackEXT(VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugReportCallbackEXT* pCallback) {
-	auto func = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT");
-	if (func != nullptr) {
-		return func(instance, pCreateInfo, pAllocator, pCallback);
-	}
-	else {
-		return VK_ERROR_EXTENSION_NOT_PRESENT;
-	}
-}
-
-void DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT callback, const VkAllocationCallbacks* pAllocator) {
-	auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT");
-	if (func != nullptr) {
-		func(instance, callback, pAllocator);
-	}
-}
-
 struct QueueFamilyIndices
 {
 	int graphicsFamily = -1;
 	int presentFamily = -1;
-	bool isComplete()
+	int computeFamily = -1;					//A compute family without graphics when the device has one, else the graphics family
+	int transferFamily = -1;				//A transfer-only family when the device has one, else the compute family
+
+	//A headless run has no surface to present to, so only the graphics queue is required.
+	//Compute and transfer always fall back to the graphics family, which has to support compute as well
+	bool isComplete(bool needsPresent = true)
 	{
-		return graphicsFamily >= 0 && presentFamily >= 0;
+		return graphicsFamily >= 0 && computeFamily >= 0 && transferFamily >= 0 && (!needsPresent || presentFamily >= 0);
 	}
 };
 
@@ -55,51 +60,352 @@ struct SwapChainSupportDetails
 	std::vector<VkPresentModeKHR> presentModes;
 };
 
+//How frames are queued for presentation. Picks the present mode and swap chain image count, and paces frame starts
+enum class PresentPolicy
+{
+	Default,								//MAILBOX, else IMMEDIATE, with one image over the minimum and no pacing
+	LowLatency,								//Fewest images, and a frame only starts once the previous one has finished on the GPU
+	MaxThroughput,							//Never blocks on the display: IMMEDIATE or MAILBOX with an extra image
+	PowerSaving								//FIFO, limited to 30 frames per second unless frameRateLimit says otherwise
+};
+
+//Everything device selection learns about a physical device, queried once and reused for the rest of initialization
+struct PhysicalDeviceInfo
+{
+	VkPhysicalDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties properties;
+	VkPhysicalDeviceFeatures features;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	std::vector<VkQueueFamilyProperties> queueFamilyProperties;
+	QueueFamilyIndices queueFamilies;
+	bool extensionsSupported = false;
+	SwapChainSupportDetails swapChainSupport;	//Empty in headless mode
+	VkDeviceSize deviceLocalBytes = 0;			//Size of the largest DEVICE_LOCAL heap
+	bool descriptorIndexingSupported = false;	//Everything the descriptor heap needs from VK_EXT_descriptor_indexing
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties = {};
+	int64_t score = -1;							//Higher is better, negative when the device cannot run the application
+	std::string rejectReason;					//Why the score is negative
+};
+
+//Where the single draws read their DrawParameters from
+enum class DrawParameterSource
+{
+	PushConstants,							//Pushed with every draw
+	DynamicUniforms							//Written to the upload ring, every draw rebinds set 0 with its own dynamic offset
+};
+
+//Runtime options, filled from the command line in main()
+struct ApplicationSettings
+{
+	bool headless = false;					//Render into offscreen images, without GLFW, a surface or a swap chain
+	uint32_t headlessFrameCount = 1000;		//Number of frames rendered before a headless run exits
+	uint32_t offscreenImageCount = 3;		//Size of the offscreen image ring used in headless mode
+	uint32_t framesInFlight = 2;			//Number of frames the CPU may record ahead of the GPU
+	std::string pipelineCachePath = "pipeline_cache.bin";	//Pipeline cache loaded at startup and written back at shutdown. Empty disables it
+	std::string shaderArchivePath = "Shaders/shaders.pak";	//Packed SPIR-V, ignored when the archive is embedded with EMBED_SHADER_ARCHIVE
+	unsigned workerThreadCount = 0;			//Threads in the worker pool, 0 uses one per hardware thread
+	uint32_t pipelineVariantCount = 0;		//Extra distinct pipeline states compiled in the background at startup, at most 72
+	uint32_t drawCount = 1;					//Draws recorded per frame
+	DrawParameterSource drawParameters = DrawParameterSource::PushConstants;
+	uint32_t recordingThreadCount = 1;		//Threads that record a frame's draws into secondary command buffers
+	bool recordingBenchmark = false;		//Time command recording from 1 to recordingThreadCount threads instead of running normally
+	uint32_t uploadRingSize = 1024 * 1024;	//Bytes of per-frame uniform and vertex data each frame in flight can stream
+	uint32_t instanceCount = 0;				//Draw this many triangles with one instanced draw instead of drawCount single draws. 0 disables
+	bool instancingBenchmark = false;		//Sweep the instance count by powers of ten and report CPU and GPU frame times instead of running normally
+	uint32_t instancingBenchmarkMax = 1000000;	//Largest count of the sweep, lowered to what one storage buffer descriptor can cover
+	bool gpuCulling = false;				//Frustum cull the instances in a compute pass and draw the survivors with indirect draws
+	bool asyncCompute = false;				//Run the culling pass on the compute queue, overlapping the previous frame's graphics work
+	PresentPolicy presentPolicy = PresentPolicy::Default;
+	uint32_t frameRateLimit = 0;			//Frames per second the CPU may start. 0 uses the policy's default
+	bool profile = false;					//Start with the profiler on. F2 toggles it in windowed mode
+	bool pipelineStatistics = false;		//Have the profiler count pipeline statistics, where the device supports it
+	std::string tracePath = "trace.json";	//Chrome about:tracing file written at exit when anything was profiled
+	bool depthBuffer = true;				//Depth test against a transient depth attachment
+	uint32_t sampleCount = 1;				//MSAA samples per pixel, lowered to what the device supports. 1 renders straight into the swap chain image
+	bool bindless = true;					//Read instances through the descriptor heap where the device supports descriptor indexing
+	std::string texturePath;				//Binary PPM, or "checker", streamed in and sampled by the single draws. Needs the descriptor heap
+	uint32_t textureUploadBudget = 256 * 1024;	//Bytes of texture data uploaded per frame at most, beyond the first upload. 0 is unlimited
+};
+
+//Vertex layout streamed through the upload ring, matching the inputs of Shaders/shader.vert
+struct Vertex
+{
+	float position[2];
+	float color[3];
+
+	static std::vector<VkVertexInputBindingDescription> GetBindingDescriptions()
+	{
+		VkVertexInputBindingDescription binding = {};
+		binding.binding = 0;
+		binding.stride = sizeof(Vertex);
+		binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return { binding };
+	}
+
+	static std::vector<VkVertexInputAttributeDescription> GetAttributeDescriptions()
+	{
+		std::vector<VkVertexInputAttributeDescription> attributes(2);
+		attributes[0].binding = 0;
+		attributes[0].location = 0;
+		attributes[0].format = VK_FORMAT_R32G32_SFLOAT;
+		attributes[0].offset = offsetof(Vertex, position);
+		attributes[1].binding = 0;
+		attributes[1].location = 1;
+		attributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributes[1].offset = offsetof(Vertex, color);
+		return attributes;
+	}
+};
+
+//Per instance data, stored as structure of arrays: one array of transforms and one of colors in the instance buffer,
+//each read through its own VK_VERTEX_INPUT_RATE_INSTANCE binding. Matches the instance inputs of Shaders/instanced.vert
+struct InstanceTransform
+{
+	float offset[2];
+	float scale;
+	float rotation;							//Radians
+};
+
+typedef uint32_t InstanceColor;				//R8G8B8A8_UNORM
+
+//Placement of one of the single draws, matching DrawParameters in Shaders/shader.vert
+struct DrawParameters
+{
+	float offset[2];
+	float scale;
+	float rotation;							//Radians
+	uint32_t texture;						//Descriptor heap slots sampled by Shaders/textured.frag. TextureStreamer::invalidSlot draws untextured
+	uint32_t sampler;
+};
+
+//Push constants of Shaders/bindless.vert: descriptor heap slots of the instance arrays the draw reads
+struct DrawHandles
+{
+	uint32_t transformBuffer;
+	uint32_t colorBuffer;
+};
+
+//Per frame uniform block, matching FrameUniforms in Shaders/shader.vert
+struct FrameUniforms
+{
+	float transform[16];					//Column major
+	float viewProjection[16];				//Column major, applied to instances after their own transform
+};
+
+//Push constants of Shaders/cull.comp
+struct CullParameters
+{
+	float frustumPlanes[6][4];				//xyz normal pointing inwards, w distance
+	uint32_t instanceCount;
+	float boundingRadius;					//Of the mesh at scale 1
+};
+
+//Everything needed to record and submit one frame while earlier frames are still executing on the GPU
+struct FrameData
+{
+	VkCommandPool commandPool;				//Reset as a whole once the frame's fence has signaled
+	VkCommandBuffer commandBuffer;
+	std::vector<VkCommandPool> recordingCommandPools;		//One per recording thread, command pools must not be shared between threads
+	std::vector<VkCommandBuffer> secondaryCommandBuffers;	//Recorded inside the render pass by the recording threads
+	VkSemaphore imageAvailableSemaphore;	//Signaled by the presentation engine when the acquired image can be rendered to
+	VkSemaphore renderFinishedSemaphore;	//Signaled by the graphics queue when the image can be presented
+	VkFence inFlightFence;					//Signaled when the GPU has finished with this frame slot
+	uint32_t uniformOffset = 0;				//Dynamic offset of this frame's FrameUniforms in the upload ring
+	VkDeviceSize vertexOffset = 0;			//Offset of this frame's vertices in the upload ring
+	VkDeviceSize indexOffset = 0;			//Offset of this frame's indices in the upload ring
+	CullParameters cullParameters = {};		//Frustum of this frame, for the culling pass
+	std::vector<AsyncWork> asyncWork;		//Work from other queues this frame's submit waits for. The semaphores are recycled once the fence signals
+	VkSemaphore cullReadFinishedSemaphore = VK_NULL_HANDLE;	//Signaled when the frame's draws have read the culling output, for the next async culling pass
+	std::vector<std::future<void>> recordings;	//Secondary command buffers still being recorded by the helper threads
+	uint32_t recordingThreadCount = 0;		//Secondary command buffers executed this frame
+};
+
+//Measurements of one benchmark run, times in milliseconds
+struct BenchmarkResult
+{
+	std::string deviceName;
+	double startupTime = 0.0;				//From the start of initialization until the first frame has been submitted
+	std::vector<double> cpuFrameTimes;		//Recording and submission of each measured frame
+	std::vector<double> gpuFrameTimes;		//GPU work of each measured frame. Empty when the graphics queue has no timestamps
+};
+
+//One timed step of getting to the first frame
+struct StartupStage
+{
+	const char* name;
+	double start;							//Milliseconds since startup began
+	double duration;
+	bool background;						//Ran on a worker thread, overlapping the stages of the main thread
+};
+
 
 class TriangleApplication
 {
 public:
-	TriangleApplication();
+	TriangleApplication(const ApplicationSettings& settings = ApplicationSettings());
 	~TriangleApplication();
 	void Run();
 
+	//Initializes, renders warmUpFrames unmeasured frames and then measuredFrames measured ones, and cleans up
+	BenchmarkResult RunBenchmark(uint32_t warmUpFrames, uint32_t measuredFrames);
+
 private:
 
+	ApplicationSettings settings;
+
 	//GLFW stuff
 	GLFWwindow* window;
 
 	//Instance stuff
 	VkInstance instance;
-	VkDebugReportCallbackEXT callback;
+	DebugMessenger debugMessenger;
+	bool debugUtilsEnabled = false;		//VK_EXT_debug_utils is enabled on the instance, for names and labels even without validation
 
 	//Window Surface creation stuff
 	VkSurfaceKHR surface;
 
 	//Physical Device Stuff
 	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	PhysicalDeviceInfo deviceInfo;			//Probe results of physicalDevice, so initialization never queries them twice
 
 	//Logical Device stuff
 	VkDevice device;
 
+	//Destruction stuff - every device object below is owned through the queue, declared first so it outlives their owners
+	DeletionQueue deletionQueue;
+
+	//Memory stuff
+	MemoryAllocator memoryAllocator;
+
 	//Queue stuff
+	QueueFamilyIndices queueFamilies;		//Of the selected physical device
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
+	VkQueue computeQueue;
+	VkQueue transferQueue;
+	AsyncQueue asyncComputeQueue;
+	AsyncQueue asyncTransferQueue;
+	std::vector<AsyncWork> pendingAsyncWork;	//Submitted to the async queues, not yet claimed by the queue that consumes it
+	VkSemaphore pendingCullReadSemaphore = VK_NULL_HANDLE;	//Signaled by the last frame, waited on by the next async culling pass
 
 	//Swap Chain stuff
-	VkSwapchainKHR swapChain;
+	VulkanHandle<VkSwapchainKHR> swapChain;
 	std::vector<VkImage> swapChainImages;
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
 
-	//Image View stuff
-	std::vector<VkImageView> swapChainImageViews;
+	//Swap chain recreation stuff - frames already in flight keep using the old swap chain's views and render targets,
+	//so those are released to the deletion queue rather than destroyed
+	bool swapChainOutdated = false;			//Set by resizes and suboptimal presents, handled before the next acquire
+	uint32_t swapChainRecreations = 0;
+	double worstRecreationTime = 0.0;		//Milliseconds
 
-	//Render Pass stuff
-	VkRenderPass renderPass;
+	//Image View stuff
+	std::vector<VulkanHandle<VkImageView>> swapChainImageViews;
+
+	//Offscreen stuff - in headless mode the swapChain* members describe these images instead of swap chain images
+	std::vector<DeviceObject> offscreenImageOwners;	//Each image with its memory
+
+	//Render graph stuff - the frame's passes and what they access. The render passes, framebuffers and barriers are derived from it
+	RenderGraph renderGraph;
+	RenderGraphTargets renderTargets;				//Depth, multisampled color and the framebuffers at the swap chain extent
+	DeviceObject renderTargetsOwner;
+	RenderGraphPass mainPass = RenderGraph::invalidIndex;
+	RenderGraphPass cullPass = RenderGraph::invalidIndex;	//Only when culling on the graphics queue
+	RenderGraphResource backBuffer = RenderGraph::invalidIndex;
+	RenderGraphResource culledInstances = RenderGraph::invalidIndex;
+	RenderGraphResource indirectCommands = RenderGraph::invalidIndex;
+	FrameData* recordingFrame = nullptr;			//Frame the graph is executed for, used by the pass callbacks
+
+	//Render target stuff - depth and multisampled color are shared by every frame, the graph orders consecutive frames' accesses
+	VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT;
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;		//Undefined when rendering without depth
+
+	//Shader stuff
+	ShaderArchive shaderArchive;
+
+	//Worker threads shared by the background jobs
+	std::unique_ptr<ThreadPool> workerPool;
+
+	//Threads that help the main thread record each frame. Kept apart from workerPool so background jobs never delay a frame
+	std::unique_ptr<ThreadPool> recordingPool;
+
+	//Per frame upload stuff
+	UploadRing uploadRing;
+	VulkanHandle<VkDescriptorSetLayout> descriptorSetLayout;
+	VulkanHandle<VkDescriptorPool> descriptorPool;
+	VkDescriptorSet uniformDescriptorSet = VK_NULL_HANDLE;	//Dynamic uniform buffer over the whole ring, pointed at a frame's data by its offset
+
+	//Descriptor heap stuff - set 1 of pipelineLayout, bound once per command buffer. Draws pick their resources with DrawHandles
+	DescriptorHeap descriptorHeap;
+	bool physicalDeviceProperties2Enabled = false;	//VK_KHR_get_physical_device_properties2, to query descriptor indexing support
+	bool bindlessEnabled = false;
+
+	//Per draw stuff - one entry per single draw, in a grid that covers the view
+	std::vector<DrawParameters> drawParameters;
+	VkDeviceSize drawParameterStride = 0;	//Of DrawParameters in the upload ring, with the dynamic uniform source
+
+	//Texture stuff - decoded on workerPool, uploaded on asyncTransferQueue and sampled through the descriptor heap
+	TextureStreamer textureStreamer;
+	bool texturingEnabled = false;
+	uint32_t texture = 0;					//Streamer ID of settings.texturePath
+	uint32_t textureSlot = TextureStreamer::invalidSlot;	//Heap slot currently written into drawParameters
 
 	//Graphics Pipeline stuff
-	VkPipelineLayout pipelineLayout;
-	VkPipeline graphicsPipelines;
+	VulkanHandle<VkPipelineCache> pipelineCache;
+	VulkanHandle<VkPipelineLayout> pipelineLayout;
+	PipelineBuilder pipelineBuilder;
+	std::shared_future<VkPipeline> graphicsPipelineFuture;			//Resolved by the first frame, the only pipeline it has to wait for
+	VkPipeline graphicsPipelines = VK_NULL_HANDLE;
+	std::vector<std::shared_future<VkPipeline>> pipelineVariants;	//Still compiling on the worker pool when rendering starts
+
+	//Instancing stuff - the transform and color arrays share one device local buffer
+	VkBuffer instanceBuffer = VK_NULL_HANDLE;
+	MemoryAllocation instanceMemory;
+	VkDeviceSize instanceColorOffset = 0;
+	uint32_t instanceCapacity = 0;
+	uint32_t activeInstanceCount = 0;
+	bool bindlessInstances = false;			//Instanced draws read the arrays through the descriptor heap instead of vertex inputs
+	DrawHandles instanceHandles = {};		//Heap slots of the transform and color arrays in instanceBuffer
+	DrawHandles culledInstanceHandles = {};	//And in culledInstanceBuffer
+	std::shared_future<VkPipeline> instancedPipelineFuture;
+	VkPipeline instancedPipeline = VK_NULL_HANDLE;
+
+	//GPU culling stuff - the compute pass compacts visible instances into culledInstanceBuffer and fills the indirect commands
+	VkBuffer culledInstanceBuffer = VK_NULL_HANDLE;
+	MemoryAllocation culledInstanceMemory;
+	VkBuffer indirectBuffer = VK_NULL_HANDLE;
+	MemoryAllocation indirectMemory;
+	uint32_t indirectCommandCount = 1;		//One per mesh. The triangle is the only mesh so far
+	bool multiDrawIndirectEnabled = false;
+	VulkanHandle<VkDescriptorSetLayout> cullDescriptorSetLayout;
+	VulkanHandle<VkDescriptorPool> cullDescriptorPool;
+	VkDescriptorSet cullDescriptorSet = VK_NULL_HANDLE;
+	VulkanHandle<VkPipelineLayout> cullPipelineLayout;
+	std::shared_future<VkPipeline> cullPipelineFuture;
+	VkPipeline cullPipeline = VK_NULL_HANDLE;
+
+	//Frame timing stuff, in milliseconds for the last frame that completed
+	GpuProfiler profiler;
+	bool pipelineStatisticsEnabled = false;	//pipelineStatisticsQuery and inheritedQueries, so secondaries can run inside the query
+	double cpuFrameTime = 0.0;				//Recording and submission, excluding waits on fences
+	double gpuFrameTime = 0.0;
+
+	//Startup timing stuff
+	std::chrono::high_resolution_clock::time_point startupStart;
+	std::vector<StartupStage> startupStages;
+
+	//Frame pacing stuff
+	std::chrono::high_resolution_clock::time_point nextFrameStart;
+	double presentLatencyTotal = 0.0;		//Frame start to present, in milliseconds
+	double presentLatencyWorst = 0.0;
+	uint64_t presentLatencySamples = 0;
+
+	//Frame stuff
+	std::vector<FrameData> frames;
+	std::vector<VkFence> imagesInFlight;		//Fence of the frame currently rendering into each swap chain image, if any
+	size_t currentFrame = 0;
+	uint64_t frameCount = 0;
 
 	//GLFW related functions
 	void InitializeWindow();				
@@ -108,6 +414,7 @@ private:
 	void CreateInstance();	
 	bool CheckValidationLayerSupport();
 	std::vector<const char*> GetRequiredExtensions();
+	static bool IsInstanceExtensionAvailable(const char* name);
 	void SetUpDebugCallBack();
 
 	//Window Surface creation related function
@@ -115,39 +422,108 @@ private:
 
 	//Physical Device related functions
 	void SelectPhysicalDevice();
-	bool isDeviceSuitable(VkPhysicalDevice device);
+	PhysicalDeviceInfo ProbePhysicalDevice(VkPhysicalDevice device);
+	bool isDeviceSuitable(PhysicalDeviceInfo& info);
+	int64_t RateDevice(const PhysicalDeviceInfo& info);
+	void ProbeDescriptorIndexing(PhysicalDeviceInfo& info);
 
 	//Queue Families stuff
-	QueueFamilyIndices FindQueueFamilies(VkPhysicalDevice device);
+	QueueFamilyIndices FindQueueFamilies(VkPhysicalDevice device, const std::vector<VkQueueFamilyProperties>& queueFamilyProperties);
 
 	//Logical Device related functions
 	void CreateLogicalDevice();
+	std::vector<const char*> GetRequiredDeviceExtensions();
 
 	//Swap chain creation related functions
 	bool CheckDeviceExtensionSupport(VkPhysicalDevice device);
 	SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice device);
 	VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 	VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes); 
+	uint32_t ChooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilities);
 	VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
 	void CreateSwapChain();
+	bool RecreateSwapChain();
+	static void FramebufferResizeCallback(GLFWwindow* window, int width, int height);
+	static void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+
+	//Format of the images rendered into, known before they are created
+	VkFormat ChooseColorFormat();
+
+	//Offscreen (headless) render target related functions
+	void CreateOffscreenImages();
 
 	//Image View related functions
 	void CreateImageView();
 
+	//Pipeline cache related functions
+	std::vector<char> ReadPipelineCacheFile();
+	void CreatePipelineCache(std::vector<char> cacheData);
+	void SavePipelineCache();
+	bool IsPipelineCacheCompatible(const std::vector<char>& cacheData);
+
 	//Graphics Pipeline
+	void LoadShaderArchive();
 	void CreateGraphicsPipeline();
-	VkShaderModule CreateShaderModule(std::vector<char>& code);
-
-	//Render pass
-	void CreateRenderPass();
+	std::vector<PipelineDescription> GetPipelineVariants(const PipelineDescription& base, uint32_t count);
+
+	//Per frame uploads
+	void CreateUploadRing();
+	void CreateDescriptorSetLayout();
+	void CreateDescriptorSet();
+	void CreateDescriptorHeap();
+	void CreateDrawParameters();
+	void CreateTextureStreamer();
+	void UpdateTextures();
+	void UpdateFrameData(FrameData& frame);
+
+	//Buffers
+	VkBuffer CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required, MemoryAllocation& allocation);
+	void OwnBuffer(VkBuffer buffer, MemoryAllocation allocation);
+
+	//Async queues
+	void CreateAsyncQueues();
+	std::vector<AsyncWork> TakePendingAsyncWork(uint32_t dstFamily);
+
+	//Instancing
+	void CreateInstanceBuffer(uint32_t capacity);
+	PipelineDescription GetInstancedPipelineDescription(const PipelineDescription& base);
+	void RunInstancingBenchmark();
+
+	//GPU culling
+	void CreateCullResources();
+	void RecordCullPass(FrameData& frame, VkCommandBuffer commandBuffer);
+	void SubmitAsyncCullPass(FrameData& frame);
+
+	//Render graph
+	void ChooseRenderTargetFormats();
+	void BuildRenderGraph();
+	void CreateRenderTargets();
+
+	//Frame resources - per frame slot command pool, command buffer and sync objects
+	void CreateFrameResources();
+	void RecordCommandBuffer(FrameData& frame, uint32_t imageIndex, uint32_t threadCount);
+	void RecordSecondaryCommandBuffer(FrameData& frame, uint32_t thread, uint32_t imageIndex, uint32_t firstDraw, uint32_t drawCount);
+
+	//Measures CPU recording time per frame for 1 to recordingThreadCount threads
+	void RunRecordingBenchmark();
+
+	//Acquires an image, records and submits the frame and presents it. Only blocks when the frame slot is still in use
+	void DrawFrame();
+
+	//Holds back the start of the next frame as the present policy asks, and reports the resulting latency
+	void PaceFrame();
+	void PrintPresentLatency();
+
+	//Records how long each step to the first frame took, and prints them once it has been submitted
+	void AddStartupStage(const char* name, std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end, bool background);
+	std::chrono::high_resolution_clock::time_point EndStartupStage(const char* name, std::chrono::high_resolution_clock::time_point start);
+	void PrintStartupReport();
 
 	void InitializeVulkan();				
 	void MainLoop();						
 	void CleanUp();
 
-	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objType, uint64_t obj, size_t location, int32_t code, const char* layerPrefix, const char* msg, void* userData);
-
-	//Function to load binary data from files
-	static std::vector<char> readFile(const std::string& filename);
+	//Writes to a temporary file and renames it over the target, so readers never see a partially written file
+	static void writeFileAtomic(const std::string& filename, const std::vector<char>& data);
 };
 
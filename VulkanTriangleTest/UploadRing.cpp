@@ -0,0 +1,121 @@
+#include "UploadRing.h"
+#include <stdexcept>
+#include <algorithm>
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+
+UploadRing::UploadRing() : head(0)
+{
+}
+
+
+UploadRing::~UploadRing()
+{
+	Destroy();
+}
+
+void UploadRing::Initialize(VkDevice device, MemoryAllocator& allocator, const VkPhysicalDeviceLimits& limits, VkDeviceSize bytesPerFrame, uint32_t frameCount)
+{
+	this->device = device;
+	this->allocator = &allocator;
+
+	uniformAlignment = limits.minUniformBufferOffsetAlignment;
+	nonCoherentAtomSize = limits.nonCoherentAtomSize;
+
+	//Regions start on a boundary that suits uniforms, vertices and flushes alike
+	regionAlignment = std::max(std::max(uniformAlignment, nonCoherentAtomSize), (VkDeviceSize)256);
+	regionSize = AlignUp(bytesPerFrame, regionAlignment);
+	regionCount = frameCount;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = regionSize * regionCount;
+	bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create upload ring buffer!");
+	}
+
+	//Flushed ranges have to start and end on nonCoherentAtomSize, so the buffer starts on one in its memory too
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(device, buffer, &requirements);
+	requirements.alignment = std::max(requirements.alignment, nonCoherentAtomSize);
+	requirements.size = AlignUp(requirements.size, nonCoherentAtomSize);
+
+	memory = allocator.Allocate(requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ResourceKind::Linear);
+	if (vkBindBufferMemory(device, buffer, memory.memory, memory.offset) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to bind upload ring memory!");
+	}
+
+	mappedData = static_cast<uint8_t*>(memory.mappedData);
+	coherent = allocator.IsHostCoherent(memory.memoryTypeIndex);
+	regionStart = 0;
+	head = 0;
+}
+
+void UploadRing::Destroy()
+{
+	if (buffer == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	vkDestroyBuffer(device, buffer, nullptr);
+	allocator->Free(memory);
+	buffer = VK_NULL_HANDLE;
+	mappedData = nullptr;
+}
+
+void UploadRing::BeginFrame(uint32_t frameIndex)
+{
+	regionStart = regionSize * (frameIndex % regionCount);
+	head = 0;
+}
+
+void UploadRing::Flush()
+{
+	VkDeviceSize used = head.load(std::memory_order_acquire);
+	if (coherent || used == 0)
+	{
+		return;
+	}
+
+	VkMappedMemoryRange range = {};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.memory = memory.memory;
+	range.offset = memory.offset + regionStart;
+	range.size = std::min(AlignUp(used, nonCoherentAtomSize), regionSize);
+
+	if (vkFlushMappedMemoryRanges(device, 1, &range) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to flush upload ring!");
+	}
+}
+
+UploadAllocation UploadRing::Allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+	//Recording threads allocate concurrently, so claim the range with a compare-exchange instead of a lock
+	VkDeviceSize current = head.load(std::memory_order_relaxed);
+	VkDeviceSize offset;
+	do
+	{
+		offset = AlignUp(current, alignment);
+		if (offset + size > regionSize)
+		{
+			throw std::runtime_error("upload ring frame region is full!");
+		}
+	} while (!head.compare_exchange_weak(current, offset + size, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+	UploadAllocation allocation;
+	allocation.buffer = buffer;
+	allocation.offset = regionStart + offset;
+	allocation.data = mappedData + regionStart + offset;
+	return allocation;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include "MemoryAllocator.h"
+
+//Space for one upload, addressed both from the CPU and as an offset into the ring's buffer
+struct UploadAllocation
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;				//From the start of the buffer. Usable as a dynamic uniform or vertex buffer offset
+	void* data = nullptr;
+};
+
+//A host visible buffer that stays mapped for its whole lifetime, split into one region per frame in flight.
+//Each frame bumps through its own region, so writing never waits on the GPU and nothing is mapped or allocated per frame.
+class UploadRing
+{
+public:
+	UploadRing();
+	~UploadRing();
+
+	UploadRing(const UploadRing&) = delete;
+	UploadRing& operator=(const UploadRing&) = delete;
+
+	void Initialize(VkDevice device, MemoryAllocator& allocator, const VkPhysicalDeviceLimits& limits, VkDeviceSize bytesPerFrame, uint32_t frameCount);
+	void Destroy();
+
+	//Starts filling the region of the given frame slot. Only call once the slot's fence has signaled
+	void BeginFrame(uint32_t frameIndex);
+
+	//Makes this frame's writes visible to the device when the memory is not HOST_COHERENT. Call before submitting
+	void Flush();
+
+	//Thread safe. Alignment must be a power of two no larger than GetMaxAlignment(). Throws when the frame's region is full
+	UploadAllocation Allocate(VkDeviceSize size, VkDeviceSize alignment);
+	UploadAllocation AllocateUniform(VkDeviceSize size) { return Allocate(size, uniformAlignment); }
+	UploadAllocation AllocateVertices(VkDeviceSize size) { return Allocate(size, 16); }
+
+	VkBuffer GetBuffer() const { return buffer; }
+	VkDeviceSize GetMaxAlignment() const { return regionAlignment; }
+	VkDeviceSize GetBytesUsed() const { return head.load(std::memory_order_relaxed); }
+	bool IsCoherent() const { return coherent; }
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+	MemoryAllocation memory;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	uint8_t* mappedData = nullptr;
+	bool coherent = true;
+
+	VkDeviceSize uniformAlignment = 256;
+	VkDeviceSize nonCoherentAtomSize = 1;
+	VkDeviceSize regionAlignment = 256;		//Every region starts on a multiple of this
+	VkDeviceSize regionSize = 0;
+	uint32_t regionCount = 0;
+
+	//Current region, and how far into it has been handed out
+	VkDeviceSize regionStart = 0;
+	std::atomic<VkDeviceSize> head;
+};
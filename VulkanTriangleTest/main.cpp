@@ -1,19 +1,169 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include "TriangleApplication.h"
 
-int main() 
+//Reads the command line options into the application settings
+static ApplicationSettings ParseArguments(int argc, char** argv)
 {
-	TriangleApplication application;
+	ApplicationSettings settings;
 
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+		{
+			settings.headless = true;
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			settings.headlessFrameCount = (uint32_t)std::stoul(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--offscreen-images") == 0 && i + 1 < argc)
+		{
+			settings.offscreenImageCount = std::max(1u, (uint32_t)std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+		{
+			settings.framesInFlight = std::max(1u, (uint32_t)std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--pipeline-cache") == 0 && i + 1 < argc)
+		{
+			settings.pipelineCachePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--no-pipeline-cache") == 0)
+		{
+			settings.pipelineCachePath.clear();
+		}
+		else if (strcmp(argv[i], "--shader-archive") == 0 && i + 1 < argc)
+		{
+			settings.shaderArchivePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--worker-threads") == 0 && i + 1 < argc)
+		{
+			settings.workerThreadCount = (unsigned)std::stoul(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--pipeline-variants") == 0 && i + 1 < argc)
+		{
+			settings.pipelineVariantCount = (uint32_t)std::stoul(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--draws") == 0 && i + 1 < argc)
+		{
+			settings.drawCount = (uint32_t)std::stoul(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--draw-uniforms") == 0)
+		{
+			settings.drawParameters = DrawParameterSource::DynamicUniforms;
+		}
+		else if (strcmp(argv[i], "--recording-threads") == 0 && i + 1 < argc)
+		{
+			settings.recordingThreadCount = std::max(1u, (uint32_t)std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--recording-benchmark") == 0)
+		{
+			settings.recordingBenchmark = true;
+		}
+		else if (strcmp(argv[i], "--upload-ring-size") == 0 && i + 1 < argc)
+		{
+			settings.uploadRingSize = std::max(1024u, (uint32_t)std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+		{
+			settings.instanceCount = (uint32_t)std::stoul(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--instancing-benchmark") == 0)
+		{
+			settings.instancingBenchmark = true;
+		}
+		else if (strcmp(argv[i], "--instancing-benchmark-max") == 0 && i + 1 < argc)
+		{
+			settings.instancingBenchmarkMax = std::max(1u, (uint32_t)std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--gpu-culling") == 0)
+		{
+			settings.gpuCulling = true;
+		}
+		else if (strcmp(argv[i], "--async-compute") == 0)
+		{
+			settings.asyncCompute = true;
+		}
+		else if (strcmp(argv[i], "--present-policy") == 0 && i + 1 < argc)
+		{
+			std::string policy = argv[++i];
+			if (policy == "default")
+				settings.presentPolicy = PresentPolicy::Default;
+			else if (policy == "low-latency")
+				settings.presentPolicy = PresentPolicy::LowLatency;
+			else if (policy == "max-throughput")
+				settings.presentPolicy = PresentPolicy::MaxThroughput;
+			else if (policy == "power-saving")
+				settings.presentPolicy = PresentPolicy::PowerSaving;
+			else
+				throw std::runtime_error("Unknown present policy: " + policy);
+		}
+		else if (strcmp(argv[i], "--frame-limit") == 0 && i + 1 < argc)
+		{
+			settings.frameRateLimit = (uint32_t)std::stoul(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--profile") == 0)
+		{
+			settings.profile = true;
+		}
+		else if (strcmp(argv[i], "--pipeline-statistics") == 0)
+		{
+			settings.pipelineStatistics = true;
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+			settings.tracePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--no-depth") == 0)
+		{
+			settings.depthBuffer = false;
+		}
+		else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+		{
+			settings.sampleCount = std::max(1u, (uint32_t)std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--no-bindless") == 0)
+		{
+			settings.bindless = false;
+		}
+		else if (strcmp(argv[i], "--texture") == 0 && i + 1 < argc)
+		{
+			settings.texturePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+		{
+			settings.textureUploadBudget = (uint32_t)std::stoul(argv[++i]);
+		}
+		else
+		{
+			throw std::runtime_error(std::string("Unknown argument: ") + argv[i]);
+		}
+	}
+
+	//Culling works on the instance buffer, which only exists when something draws instances
+	if (settings.gpuCulling && settings.instanceCount == 0 && !settings.instancingBenchmark)
+	{
+		throw std::runtime_error("--gpu-culling needs --instances or --instancing-benchmark");
+	}
+
+	return settings;
+}
+
+int main(int argc, char** argv) 
+{
 	try
 	{
+		TriangleApplication application(ParseArguments(argc, argv));
 		application.Run();
 	}
-	catch (const std::runtime_error& err)
+	catch (const std::exception& err)
 	{
 		std::cerr << err.what() << std::endl;
 		return EXIT_FAILURE;
@@ -21,4 +171,4 @@ int main()
 
 	return EXIT_SUCCESS;
 	getchar();
-}
\ No newline at end of file
+}